@@ -0,0 +1,378 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "anim.h"
+#include "display.h"
+#include "fetch.h"
+
+// NOTE(easimer): stb_image only decodes every frame of a GIF at once
+// through it's API, which would keep all of them in memory. The frame by
+// frame decoder it uses internally is reached through a private copy of
+// the library that only has the GIF decoder in it.
+#define STB_IMAGE_STATIC
+#define STBI_ONLY_GIF
+#define STBI_NO_STDIO
+#define STBI_NO_FAILURE_STRINGS
+#define STB_IMAGE_IMPLEMENTATION
+#if __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "stb_image.h"
+#if __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+using Lock = std::mutex;
+using Lock_Guard = std::lock_guard<std::mutex>;
+using Unique_Lock = std::unique_lock<std::mutex>;
+using Thread = std::thread;
+using Cond_Var = std::condition_variable;
+using Clock = std::chrono::steady_clock;
+
+// Browsers show frames with a shorter delay than this for
+// ANIM_DEFAULT_DELAY milliseconds instead, and GIFs are made to look
+// right in browsers
+#define ANIM_MIN_DELAY (20)
+#define ANIM_DEFAULT_DELAY (100)
+// How often a player checks for frames that are late, in milliseconds
+#define ANIM_POLL_INTERVAL (10)
+
+struct Anim_Decoder {
+    const uint8_t* data;
+    size_t size;
+    stbi__context ctx;
+    stbi__gif gif;
+    // The last two frames; stb_image needs the one before the last to
+    // undo frames that are disposed of by restoring what was under them.
+    // previous[i % 2] holds the i-th frame.
+    uint8_t* previous[2];
+    unsigned frame_count; // since the first frame
+};
+
+static void StartDecoding(Anim_Decoder* decoder) {
+    stbi__start_mem(&decoder->ctx, decoder->data, (int)decoder->size);
+    memset(&decoder->gif, 0, sizeof(decoder->gif));
+    decoder->frame_count = 0;
+}
+
+static void FreeDecoderState(Anim_Decoder* decoder) {
+    STBI_FREE(decoder->gif.out);
+    STBI_FREE(decoder->gif.history);
+    STBI_FREE(decoder->gif.background);
+}
+
+Anim_Decoder* Anim_OpenDecoder(const uint8_t* data, size_t size) {
+    Anim_Decoder* ret = NULL;
+    stbi__context ctx;
+    assert(data || size == 0);
+    if(data && size > 0 && size <= INT_MAX) {
+        stbi__start_mem(&ctx, data, (int)size);
+        if(stbi__gif_test(&ctx)) {
+            // NOTE(easimer): stbi__gif has a table of 8192 LZW codes in it,
+            // it's too large for the stack
+            ret = (Anim_Decoder*)malloc(sizeof(Anim_Decoder));
+        }
+    }
+    if(ret) {
+        ret->data = data;
+        ret->size = size;
+        ret->previous[0] = ret->previous[1] = NULL;
+        StartDecoding(ret);
+    }
+    return ret;
+}
+
+void Anim_CloseDecoder(Anim_Decoder* decoder) {
+    if(decoder) {
+        FreeDecoderState(decoder);
+        free(decoder->previous[0]);
+        free(decoder->previous[1]);
+        free(decoder);
+    }
+}
+
+const uint8_t* Anim_NextFrame(Anim_Decoder* decoder, int* width, int* height, int* delay) {
+    const uint8_t* ret = NULL;
+    int comp;
+    assert(decoder && width && height && delay);
+    if(decoder) {
+        uint8_t* two_back = NULL;
+        if(decoder->frame_count >= 2) {
+            two_back = decoder->previous[decoder->frame_count % 2];
+        }
+        stbi_uc* pixels = stbi__gif_load_next(&decoder->ctx, &decoder->gif, &comp, 4, two_back);
+        // The context itself is returned after the last frame
+        if(pixels && pixels != (stbi_uc*)&decoder->ctx) {
+            size_t size = (size_t)decoder->gif.w * decoder->gif.h * 4;
+            // Replaces the frame before the previous one, which was needed
+            // for this one at most
+            uint8_t*& slot = decoder->previous[decoder->frame_count % 2];
+            if(!slot) {
+                slot = (uint8_t*)malloc(size);
+            }
+            if(slot) {
+                memcpy(slot, pixels, size);
+                decoder->frame_count++;
+                *width = decoder->gif.w;
+                *height = decoder->gif.h;
+                *delay = decoder->gif.delay;
+                ret = pixels;
+            }
+        }
+    }
+    return ret;
+}
+
+void Anim_Rewind(Anim_Decoder* decoder) {
+    assert(decoder);
+    if(decoder) {
+        FreeDecoderState(decoder);
+        StartDecoding(decoder);
+    }
+}
+
+// A decoded frame in an animation's ring
+struct Anim_Slot {
+    uint8_t* buffer;
+    Pixel_Format format;
+    int delay; // milliseconds
+};
+
+struct Animation {
+    std::string path;
+    Thread thread;
+    
+    Lock lock;
+    // Signaled when a slot is freed or the animation is closed
+    Cond_Var cv;
+    bool quit;
+    Anim_Status status;
+    bool done; // the decoding thread has stopped
+    int width, height;
+    // The frame that's shown is slots[first], the ones after it follow it
+    // around the ring
+    Anim_Slot slots[ANIM_RING_FRAMES];
+    unsigned first;
+    unsigned count;
+    
+    // Only used by the thread playing the animation
+    bool started; // the first frame has been shown
+    Clock::time_point due; // when the next frame is shown
+};
+
+// Returns the Pixel_Conversion flags the display needs
+static unsigned DisplayConversion() {
+    unsigned ret = 0;
+    if(Display_SwapRedBlueChannels()) {
+        ret |= PIXCONV_SWAP_RED_BLUE;
+    }
+    if(Display_PremultipliedAlpha()) {
+        ret |= PIXCONV_PREMULTIPLY;
+    }
+    return ret;
+}
+
+static void DecodeFunc(Animation* anim) {
+    Fetch_Buffer file;
+    Anim_Decoder* decoder = NULL;
+    unsigned conversion = DisplayConversion();
+    unsigned frames = 0; // decoded since the first frame
+    
+    if(Fetch_ReadFile(anim->path.c_str(), &file)) {
+        decoder = Anim_OpenDecoder(file.data, file.size);
+    }
+    while(decoder) {
+        int w, h, delay;
+        auto pixels = Anim_NextFrame(decoder, &w, &h, &delay);
+        if(!pixels) {
+            if(frames < 2) {
+                // Not animated
+                break;
+            }
+            Anim_Rewind(decoder);
+            frames = 0;
+            continue;
+        }
+        frames++;
+        
+        Unique_Lock lock(anim->lock);
+        anim->cv.wait(lock, [anim]() { return anim->quit || anim->count < ANIM_RING_FRAMES; });
+        if(anim->quit) {
+            break;
+        }
+        // The slot after the last ready frame is only touched by this
+        // thread until it's counted
+        auto& slot = anim->slots[(anim->first + anim->count) % ANIM_RING_FRAMES];
+        lock.unlock();
+        
+        size_t count = (size_t)w * h;
+        if(!slot.buffer) {
+            // Every frame is as large as the whole image
+            slot.buffer = (uint8_t*)malloc(count * 4);
+            if(!slot.buffer) {
+                break;
+            }
+        }
+        memcpy(slot.buffer, pixels, count * 4);
+        Pixel_Convert(slot.buffer, count, conversion);
+        slot.format = Pixel_IsOpaque(slot.buffer, count) ? PIXFMT_RGB24 : PIXFMT_ARGB32;
+        slot.delay = delay < ANIM_MIN_DELAY ? ANIM_DEFAULT_DELAY : delay;
+        
+        lock.lock();
+        anim->width = w;
+        anim->height = h;
+        anim->count++;
+        if(anim->count >= 2 && anim->status == ANIM_LOADING) {
+            anim->status = ANIM_PLAYING;
+        }
+    }
+    
+    {
+        Lock_Guard guard(anim->lock);
+        if(anim->status == ANIM_LOADING) {
+            anim->status = ANIM_STILL;
+        }
+        anim->done = true;
+    }
+    Anim_CloseDecoder(decoder);
+    Fetch_Free(&file);
+}
+
+Animation* Anim_Open(const char* path) {
+    Animation* ret = NULL;
+    assert(path);
+    if(path) {
+        ret = new Animation;
+        ret->path = path;
+        ret->quit = false;
+        ret->status = ANIM_LOADING;
+        ret->done = false;
+        ret->width = ret->height = 0;
+        for(auto& slot : ret->slots) {
+            slot.buffer = NULL;
+            slot.format = PIXFMT_ARGB32;
+            slot.delay = 0;
+        }
+        ret->first = 0;
+        ret->count = 0;
+        ret->started = false;
+        ret->thread = Thread(DecodeFunc, ret);
+    }
+    return ret;
+}
+
+void Anim_Close(Animation* anim) {
+    if(anim) {
+        {
+            Lock_Guard guard(anim->lock);
+            anim->quit = true;
+        }
+        anim->cv.notify_all();
+        anim->thread.join();
+        for(auto& slot : anim->slots) {
+            free(slot.buffer);
+        }
+        delete anim;
+    }
+}
+
+Anim_Status Anim_GetStatus(Animation* anim) {
+    Anim_Status ret = ANIM_STILL;
+    assert(anim);
+    if(anim) {
+        Lock_Guard guard(anim->lock);
+        ret = anim->status;
+    }
+    return ret;
+}
+
+bool Anim_GetFrame(Animation* anim, Anim_Frame* frame) {
+    bool ret = false;
+    assert(anim && frame);
+    if(anim && frame) {
+        Lock_Guard guard(anim->lock);
+        if(anim->status == ANIM_PLAYING) {
+            auto& slot = anim->slots[anim->first];
+            frame->width = anim->width;
+            frame->height = anim->height;
+            frame->buffer = slot.buffer;
+            frame->format = slot.format;
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+bool Anim_Update(Animation* anim) {
+    bool ret = false;
+    assert(anim);
+    if(anim) {
+        Lock_Guard guard(anim->lock);
+        auto now = Clock::now();
+        if(anim->status == ANIM_PLAYING && !anim->started) {
+            // The first frame is the still image that's shown already
+            anim->started = true;
+            anim->due = now + std::chrono::milliseconds(anim->slots[anim->first].delay);
+        } else if(anim->status == ANIM_PLAYING && now >= anim->due && anim->count >= 2) {
+            anim->first = (anim->first + 1) % ANIM_RING_FRAMES;
+            anim->count--;
+            auto delay = std::chrono::milliseconds(anim->slots[anim->first].delay);
+            // Frames keep their pace through small hiccups. After a long
+            // one (e.g. a frame that took too long to decode) the frames
+            // that follow are shown for their whole delay instead of being
+            // rushed through.
+            anim->due += delay;
+            if(anim->due <= now) {
+                anim->due = now + delay;
+            }
+            anim->cv.notify_one();
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+int Anim_GetWait(Animation* anim) {
+    int ret = -1;
+    assert(anim);
+    if(anim) {
+        Lock_Guard guard(anim->lock);
+        if(anim->status == ANIM_LOADING) {
+            ret = ANIM_POLL_INTERVAL;
+        } else if(anim->status == ANIM_PLAYING && !anim->started) {
+            ret = 0;
+        } else if(anim->status == ANIM_PLAYING) {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(anim->due - Clock::now()).count();
+            // Rounded up so that the frame is due by then
+            ret = us > 0 ? (int)((us + 999) / 1000) : 0;
+            if(anim->count < 2) {
+                // The next frame is still being decoded
+                ret = anim->done ? -1 : (ret > ANIM_POLL_INTERVAL ? ret : ANIM_POLL_INTERVAL);
+            }
+        }
+    }
+    return ret;
+}
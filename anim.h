@@ -0,0 +1,96 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "pixel.h"
+
+// Animated GIFs. Their frames are decoded one at a time while they play,
+// so that only a few of them are ever in memory.
+
+// Decodes the frames of a GIF one after the other
+struct Anim_Decoder;
+
+// Starts decoding the GIF in `data`, which must stay valid until the
+// decoder is closed.
+// Returns NULL if it's not a GIF.
+Anim_Decoder* Anim_OpenDecoder(const uint8_t* data, size_t size);
+
+// Closes the decoder.
+//
+// If decoder is NULL, this is a no-op.
+void Anim_CloseDecoder(Anim_Decoder* decoder);
+
+// Decodes the next frame. Frames are whole images of 8-bit RGBA pixels,
+// with the previous frames already composed under them. `*delay` receives
+// how long the frame is shown in milliseconds.
+// Returns NULL after the last frame or if the file is broken. The pixels
+// belong to the decoder and are overwritten by the next frame.
+const uint8_t* Anim_NextFrame(Anim_Decoder* decoder, int* width, int* height, int* delay);
+
+// Goes back to the first frame
+void Anim_Rewind(Anim_Decoder* decoder);
+
+// An animation being played
+struct Animation;
+
+// Number of decoded frames an animation holds at most, including the one
+// that's shown
+#define ANIM_RING_FRAMES (6)
+
+enum Anim_Status {
+    // The first frames are being decoded
+    ANIM_LOADING = 0,
+    // There's more than one frame
+    ANIM_PLAYING,
+    // The file has a single frame or isn't a GIF
+    ANIM_STILL,
+};
+
+// A decoded frame, converted for the display like the images of the
+// image loader
+struct Anim_Frame {
+    int width, height;
+    const void* buffer;
+    Pixel_Format format;
+};
+
+// Starts playing the GIF at `path`. The file is read and decoded on a
+// thread of the animation's own, which stays ANIM_RING_FRAMES - 1 frames
+// ahead of the one that's shown. The animation loops forever.
+Animation* Anim_Open(const char* path);
+
+// Stops the animation and frees it's frames.
+//
+// If anim is NULL, this is a no-op.
+void Anim_Close(Animation* anim);
+
+Anim_Status Anim_GetStatus(Animation* anim);
+
+// Gets the frame that's shown now.
+// Returns false unless the animation is playing. The buffer stays valid
+// until the next Anim_Update.
+bool Anim_GetFrame(Animation* anim, Anim_Frame* frame);
+
+// Moves to the next frame if the shown one has been shown long enough
+// and the next one has been decoded.
+// Returns whether the shown frame changed.
+bool Anim_Update(Animation* anim);
+
+// Returns the number of milliseconds until Anim_Update should be called
+// again, or -1 if the animation will never change.
+int Anim_GetWait(Animation* anim);
@@ -93,4 +93,47 @@ void* Arena_Resolve(Mem_Arena* arena, Mem_Arena_Offset idx) {
     }
 
     return ((uint8_t*)(arena + 1)) + idx;
-}
\ No newline at end of file
+}
+
+Mem_Arena_Offset Arena_OffsetOf(Mem_Arena* arena, const void* ptr) {
+    Mem_Arena_Offset ret = MEM_ARENA_INVALID_OFFSET;
+    if(ptr) {
+        const uint8_t* base = (const uint8_t*)(arena + 1);
+        if(!arena || (const uint8_t*)ptr < base || (const uint8_t*)ptr >= base + arena->size) {
+            abort();
+        }
+        ret = (Mem_Arena_Offset)((const uint8_t*)ptr - base);
+    }
+    return ret;
+}
+
+unsigned Arena_ImageSize(Mem_Arena* arena) {
+    assert(arena);
+    unsigned ret = 0;
+    if(arena) {
+        ret = sizeof(Mem_Arena) + arena->used;
+    }
+    return ret;
+}
+
+void Arena_WriteImage(Mem_Arena* arena, void* buf) {
+    assert(arena && buf);
+    if(arena && buf) {
+        Mem_Arena* hdr = (Mem_Arena*)buf;
+        hdr->size = arena->used;
+        hdr->used = arena->used;
+        memcpy(hdr + 1, arena + 1, arena->used);
+    }
+}
+
+Mem_Arena* Arena_FromImage(const void* image, unsigned size) {
+    Mem_Arena* ret = NULL;
+    assert(image);
+    if(image && size >= sizeof(Mem_Arena)) {
+        const Mem_Arena* hdr = (const Mem_Arena*)image;
+        if(hdr->size == hdr->used && hdr->size == size - sizeof(Mem_Arena)) {
+            ret = (Mem_Arena*)image;
+        }
+    }
+    return ret;
+}
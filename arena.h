@@ -47,4 +47,21 @@ unsigned Arena_Size(Mem_Arena* arena);
 
 Mem_Arena_Offset Arena_AllocEx(Mem_Arena* arena, unsigned size);
 
-void* Arena_Resolve(Mem_Arena* arena, Mem_Arena_Offset idx);
\ No newline at end of file
+void* Arena_Resolve(Mem_Arena* arena, Mem_Arena_Offset idx);
+
+// The inverse of Arena_Resolve: returns the offset of an address
+// inside the arena. Returns MEM_ARENA_INVALID_OFFSET if ptr is NULL.
+Mem_Arena_Offset Arena_OffsetOf(Mem_Arena* arena, const void* ptr);
+
+// Returns how many bytes Arena_WriteImage will write
+unsigned Arena_ImageSize(Mem_Arena* arena);
+
+// Writes a memory image of the arena into `buf`. Only the allocated
+// part of the arena is written.
+void Arena_WriteImage(Mem_Arena* arena, void* buf);
+
+// Wraps a memory image created by Arena_WriteImage. The image is not
+// copied and may be read-only; no allocations can be made from the
+// returned arena and it must not be destroyed.
+// Returns NULL if the image is malformed.
+Mem_Arena* Arena_FromImage(const void* image, unsigned size);
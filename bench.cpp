@@ -0,0 +1,1170 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "present.h"
+#include "render_queue.h"
+#include "image_load.h"
+#include "resample.h"
+#include "pixel.h"
+#include "diskcache.h"
+#include "decode.h"
+#include "compress.h"
+#include "fetch.h"
+#include "anim.h"
+#include "tiles.h"
+#include "hash.h"
+#include "stb_image.h"
+
+#if _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Bench_Timing {
+    double min_us;
+    double avg_us;
+};
+
+struct Bench_Entry {
+    const char* name;
+    const char* usage;
+    int (*func)(int argc, char** argv);
+};
+
+static double ElapsedMicroseconds(Clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// CPU time spent by the calling thread
+static double ThreadCpuMicroseconds() {
+    double ret = 0;
+#if _WIN32
+    FILETIME creation, exit, kernel, user;
+    if(GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        u.LowPart = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        // 100ns units
+        ret = (k.QuadPart + u.QuadPart) / 10.0;
+    }
+#else
+    timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        ret = ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+    }
+#endif
+    return ret;
+}
+
+static void PrintTiming(const char* name, const Bench_Timing& t) {
+    printf("%-24s min %10.1f us  avg %10.1f us\n", name, t.min_us, t.avg_us);
+}
+
+// Measures how long it takes to open (and close) a presentation
+static bool TimeOpen(Bench_Timing* out, const char* path, int iterations) {
+    bool ret = true;
+    double total = 0;
+    out->min_us = 1e30;
+    for(int i = 0; i < iterations && ret; i++) {
+        auto start = Clock::now();
+        auto file = Present_Open(path);
+        auto elapsed = ElapsedMicroseconds(start);
+        if(file) {
+            Present_Close(file);
+            total += elapsed;
+            if(elapsed < out->min_us) {
+                out->min_us = elapsed;
+            }
+        } else {
+            ret = false;
+        }
+    }
+    out->avg_us = total / iterations;
+    return ret;
+}
+
+// Compares opening a presentation file to opening it's compiled form
+static int BenchOpen(int argc, char** argv) {
+    int ret = 1;
+    Bench_Timing text, compiled;
+    int iterations = 100;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    if(argc >= 2) {
+        iterations = atoi(argv[1]);
+        if(iterations < 1) {
+            iterations = 1;
+        }
+    }
+    
+    std::string compiled_path = std::string(argv[0]) + ".bench.prsc";
+    if(Present_Compile(argv[0], compiled_path.c_str())) {
+        if(TimeOpen(&text, argv[0], iterations) && TimeOpen(&compiled, compiled_path.c_str(), iterations)) {
+            printf("Opening '%s', %d iterations:\n", argv[0], iterations);
+            PrintTiming("text", text);
+            PrintTiming("compiled", compiled);
+            printf("speedup: %.1fx\n", text.avg_us / compiled.avg_us);
+            ret = 0;
+        }
+        remove(compiled_path.c_str());
+    }
+    
+    return ret;
+}
+
+// Renders every slide of a presentation into a render queue
+static double TimeRenderAll(Present_File* file) {
+    int cur = Present_SeekTo(file, 0);
+    int prev = -1;
+    // Allocating a render queue isn't measured
+    auto rq = RQ_Alloc();
+    auto start = Clock::now();
+    // Seeking past the end slide stays on it
+    while(cur != prev) {
+        Present_FillRenderQueue(file, rq);
+        RQ_Clear(rq);
+        prev = cur;
+        cur = Present_Seek(file, 1);
+    }
+    auto ret = ElapsedMicroseconds(start);
+    RQ_Free(rq);
+    return ret;
+}
+
+// Compares rendering the slides of a presentation with and without the
+// images being in the image cache
+static int BenchRedraw(int argc, char** argv) {
+    int ret = 1;
+    Image_Cache_Stats stats;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    
+    ImageLoader_Init();
+    auto file = Present_Open(argv[0]);
+    if(file) {
+        auto cold = TimeRenderAll(file);
+        auto warm = TimeRenderAll(file);
+        ImageLoader_GetCacheStats(&stats);
+        printf("Rendering every slide of '%s':\n", argv[0]);
+        printf("%-24s %10.1f us\n", "cold cache", cold);
+        printf("%-24s %10.1f us\n", "warm cache", warm);
+        printf("speedup: %.1fx\n", cold / warm);
+        printf("cache: %u images, %zu / %zu bytes, %lu hits, %lu misses, %lu evictions\n",
+               stats.entries, stats.bytes, stats.budget, stats.hits, stats.misses, stats.evictions);
+        Present_Close(file);
+        ret = 0;
+    }
+    ImageLoader_Shutdown();
+    
+    return ret;
+}
+
+// Renders every slide of a presentation once with an empty image cache
+static double TimeColdRender(const char* path, bool progressive) {
+    double ret = 0;
+    ImageLoader_Init();
+    auto file = Present_Open(path);
+    if(file) {
+        Present_SetProgressive(file, progressive);
+        ret = TimeRenderAll(file);
+        Present_Close(file);
+    }
+    ImageLoader_Shutdown();
+    return ret;
+}
+
+// Compares how long it takes for the slides to appear when they wait
+// for their images and when images are replaced by placeholders
+static int BenchProgressive(int argc, char** argv) {
+    if(argc < 1) {
+        return 2;
+    }
+    
+    auto blocking = TimeColdRender(argv[0], false);
+    auto progressive = TimeColdRender(argv[0], true);
+    printf("First paint of every slide of '%s', cold cache:\n", argv[0]);
+    printf("%-24s %10.1f us\n", "waiting for images", blocking);
+    printf("%-24s %10.1f us\n", "placeholders", progressive);
+    
+    return 0;
+}
+
+// Steps forward through a presentation, spending `dwell_ms` on each
+// slide like a presenter would, and measures how long each slide took
+// to render. Returns the longest render time.
+static double TimeNavigation(const char* path, int ahead, int behind, int dwell_ms, double* total_us) {
+    double ret = 0;
+    *total_us = 0;
+    // Start with an empty cache
+    ImageLoader_Init();
+    auto file = Present_Open(path);
+    if(file) {
+        Present_SetPrefetch(file, ahead, behind);
+        auto rq = RQ_Alloc();
+        int cur = Present_SeekTo(file, 0);
+        int prev = -1;
+        while(cur != prev) {
+            auto start = Clock::now();
+            Present_FillRenderQueue(file, rq);
+            auto elapsed = ElapsedMicroseconds(start);
+            RQ_Clear(rq);
+            *total_us += elapsed;
+            if(elapsed > ret) {
+                ret = elapsed;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(dwell_ms));
+            prev = cur;
+            cur = Present_Seek(file, 1);
+        }
+        RQ_Free(rq);
+        Present_Close(file);
+    }
+    ImageLoader_Shutdown();
+    return ret;
+}
+
+// Compares forward navigation with and without prefetching
+static int BenchNavigate(int argc, char** argv) {
+    double total_off, total_on;
+    int dwell_ms = 200;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    if(argc >= 2) {
+        dwell_ms = atoi(argv[1]);
+    }
+    
+    auto max_off = TimeNavigation(argv[0], 0, 0, dwell_ms, &total_off);
+    auto max_on = TimeNavigation(argv[0], 2, 1, dwell_ms, &total_on);
+    printf("Stepping through '%s', %d ms on each slide:\n", argv[0], dwell_ms);
+    printf("%-24s longest %10.1f us  total %10.1f us\n", "no prefetch", max_off, total_off);
+    printf("%-24s longest %10.1f us  total %10.1f us\n", "prefetch 2 ahead", max_on, total_on);
+    
+    return 0;
+}
+
+// Loads an image with a cold cache and measures how much CPU time the
+// waiting thread burns compared to how long it waits
+static int BenchAwait(int argc, char** argv) {
+    int ret = 0;
+    int iterations = 10;
+    double wall = 0, cpu = 0;
+    unsigned timeouts = 0;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    if(argc >= 2) {
+        iterations = atoi(argv[1]);
+    }
+    
+    for(int i = 0; i < iterations && ret == 0; i++) {
+        // Start with an empty cache
+        ImageLoader_Init();
+        auto pimg = ImageLoader_Request(argv[0]);
+        auto cpu_start = ThreadCpuMicroseconds();
+        auto start = Clock::now();
+        Loaded_Image* limg = NULL;
+        // Exercise the timed wait before blocking for good
+        while(!ImageLoader_AwaitFor(pimg, 1, &limg)) {
+            timeouts++;
+        }
+        wall += ElapsedMicroseconds(start);
+        cpu += ThreadCpuMicroseconds() - cpu_start;
+        if(limg) {
+            ImageLoader_Free(limg);
+        } else {
+            fprintf(stderr, "Couldn't load '%s'\n", argv[0]);
+            ret = 1;
+        }
+        ImageLoader_Shutdown();
+    }
+    
+    if(ret == 0) {
+        printf("Waiting for '%s' to load, %d times:\n", argv[0], iterations);
+        printf("%-24s %10.1f us\n", "avg wait", wall / iterations);
+        printf("%-24s %10.1f us\n", "avg cpu while waiting", cpu / iterations);
+        printf("waiter cpu usage: %.1f%% (%u timed out waits)\n", wall > 0 ? 100 * cpu / wall : 0, timeouts);
+    }
+    
+    return ret;
+}
+
+// Shrinks an image to the width it's shown at and compares the cost of
+// keeping it at full size with the cost of shrinking it once
+static int BenchDownscale(int argc, char** argv) {
+    int ret = 1;
+    int w, h, channels;
+    unsigned dst_w = 1280;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    if(argc >= 2) {
+        dst_w = atoi(argv[1]);
+    }
+    
+    auto start = Clock::now();
+    auto src = stbi_load(argv[0], &w, &h, &channels, STBI_rgb_alpha);
+    auto decode = ElapsedMicroseconds(start);
+    if(src && dst_w > 0 && dst_w <= (unsigned)w) {
+        unsigned dst_h = (unsigned)((double)h * dst_w / w + 0.5);
+        size_t src_size = (size_t)w * h * 4;
+        size_t dst_size = (size_t)dst_w * dst_h * 4;
+        auto dst = (uint8_t*)malloc(dst_size);
+        
+        start = Clock::now();
+        Resample_Downscale(src, w, h, dst, dst_w, dst_h, 1);
+        auto single = ElapsedMicroseconds(start);
+        start = Clock::now();
+        Resample_Downscale(src, w, h, dst, dst_w, dst_h);
+        auto threaded = ElapsedMicroseconds(start);
+        
+        // Every redraw copies the image into the render queue (see
+        // LayoutImage) and the display scales it from there
+        // Called through a volatile pointer so that it's not optimized out
+        void* (*volatile copy_func)(void*, const void*, size_t) = memcpy;
+        auto copy = calloc(src_size, 1);
+        start = Clock::now();
+        copy_func(copy, src, src_size);
+        auto copy_full = ElapsedMicroseconds(start);
+        start = Clock::now();
+        copy_func(copy, dst, dst_size);
+        auto copy_shrunk = ElapsedMicroseconds(start);
+        free(copy);
+        
+        printf("'%s' is %dx%d, shrunk to %ux%u:\n", argv[0], w, h, dst_w, dst_h);
+        printf("%-24s %10.1f us\n", "decode", decode);
+        printf("%-24s %10.1f us\n", "shrink, 1 thread", single);
+        printf("%-24s %10.1f us\n", "shrink, threaded", threaded);
+        printf("%-24s %10zu / %zu KiB\n", "memory", src_size / 1024, dst_size / 1024);
+        printf("%-24s %10.1f / %.1f us\n", "copy per redraw", copy_full, copy_shrunk);
+        free(dst);
+        ret = 0;
+    } else if(src) {
+        fprintf(stderr, "'%s' is only %d pixels wide\n", argv[0], w);
+    } else {
+        fprintf(stderr, "Couldn't load '%s'\n", argv[0]);
+    }
+    stbi_image_free(src);
+    
+    return ret;
+}
+
+// Times every pixel conversion kernel the CPU supports and checks that
+// they give the same result as the scalar one
+static int BenchConvert(int argc, char** argv) {
+    int ret = 0;
+    double megapixels = 8;
+    const int iterations = 10;
+    static const unsigned conversions[] = {
+        PIXCONV_SWAP_RED_BLUE,
+        PIXCONV_PREMULTIPLY,
+        PIXCONV_SWAP_RED_BLUE | PIXCONV_PREMULTIPLY,
+    };
+    
+    if(argc >= 1) {
+        megapixels = atof(argv[0]);
+    }
+    // An odd count so that the kernels' scalar tails are tested too
+    size_t count = (size_t)(megapixels * 1000 * 1000) | 1;
+    
+    auto input = (uint8_t*)malloc(count * 4);
+    auto expected = (uint8_t*)malloc(count * 4);
+    auto output = (uint8_t*)malloc(count * 4);
+    srand(1);
+    for(size_t i = 0; i < count * 4; i++) {
+        input[i] = (uint8_t)rand();
+    }
+    
+    printf("Converting %zu pixels, best kernel is %s:\n", count, Pixel_KernelName(Pixel_BestKernel()));
+    for(auto conversion : conversions) {
+        memcpy(expected, input, count * 4);
+        Pixel_ConvertWith(PIXKERN_SCALAR, expected, count, conversion);
+        for(int k = 0; k < PIXKERN_MAX; k++) {
+            auto kernel = (Pixel_Kernel)k;
+            double best = 1e30;
+            bool supported = true;
+            for(int i = 0; i < iterations && supported; i++) {
+                memcpy(output, input, count * 4);
+                auto start = Clock::now();
+                supported = Pixel_ConvertWith(kernel, output, count, conversion);
+                auto elapsed = ElapsedMicroseconds(start);
+                if(elapsed < best) {
+                    best = elapsed;
+                }
+            }
+            if(!supported) {
+                printf("%-8s %-20s unsupported\n", Pixel_KernelName(kernel), "");
+                continue;
+            }
+            bool same = memcmp(output, expected, count * 4) == 0;
+            printf("%-8s %-20s %10.1f us  %8.1f Mpx/s  %s\n", Pixel_KernelName(kernel),
+                   conversion == PIXCONV_SWAP_RED_BLUE ? "swap" :
+                   conversion == PIXCONV_PREMULTIPLY ? "premultiply" : "swap+premultiply",
+                   best, count / best, same ? "ok" : "MISMATCH");
+            if(!same) {
+                ret = 1;
+            }
+        }
+    }
+    
+    free(input);
+    free(expected);
+    free(output);
+    return ret;
+}
+
+// Times checking whether an image is opaque with each kernel, for an
+// opaque image and for images with one transparent pixel at the end and
+// near the start, and times packing opaque pixels into 16 bits
+static int BenchOpacity(int argc, char** argv) {
+    int ret = 0;
+    double megapixels = 8;
+    const int iterations = 10;
+    
+    if(argc >= 1) {
+        megapixels = atof(argv[0]);
+    }
+    // An odd count so that the kernels' scalar tails are tested too
+    size_t count = (size_t)(megapixels * 1000 * 1000) | 1;
+    
+    auto pixels = (uint8_t*)malloc(count * 4);
+    srand(1);
+    for(size_t i = 0; i < count * 4; i++) {
+        pixels[i] = (i % 4 == 3) ? 255 : (uint8_t)rand();
+    }
+    
+    struct Opacity_Case {
+        const char* name;
+        size_t transparent; // index of the transparent pixel
+        bool expected;
+    };
+    const Opacity_Case cases[] = {
+        {"opaque", count, true},
+        {"last transparent", count - 1, false},
+        {"early transparent", count / 100, false},
+    };
+    printf("Checking the opacity of %zu pixels, best kernel is %s:\n", count, Pixel_KernelName(Pixel_BestKernel()));
+    for(auto& test : cases) {
+        if(test.transparent < count) {
+            pixels[test.transparent * 4 + 3] = 254;
+        }
+        for(int k = 0; k < PIXKERN_MAX; k++) {
+            auto kernel = (Pixel_Kernel)k;
+            double best = 1e30;
+            bool supported = true;
+            bool opaque = false;
+            for(int i = 0; i < iterations && supported; i++) {
+                auto start = Clock::now();
+                supported = Pixel_IsOpaqueWith(kernel, pixels, count, &opaque);
+                auto elapsed = ElapsedMicroseconds(start);
+                if(elapsed < best) {
+                    best = elapsed;
+                }
+            }
+            if(!supported) {
+                printf("%-8s %-20s unsupported\n", Pixel_KernelName(kernel), "");
+                continue;
+            }
+            bool same = opaque == test.expected;
+            printf("%-8s %-20s %10.1f us  %8.1f Mpx/s  %s\n", Pixel_KernelName(kernel), test.name, best, count / best,
+                   same ? "ok" : "MISMATCH");
+            if(!same) {
+                ret = 1;
+            }
+        }
+        if(test.transparent < count) {
+            pixels[test.transparent * 4 + 3] = 255;
+        }
+    }
+    
+    // Packed as one row, in place. The pixels are BGRA.
+    uint16_t expected = (uint16_t)(((pixels[2] >> 3) << 11) | ((pixels[1] >> 2) << 5) | (pixels[0] >> 3));
+    auto start = Clock::now();
+    Pixel_PackRGB565(pixels, (unsigned)count, 1, pixels);
+    auto elapsed = ElapsedMicroseconds(start);
+    uint16_t first;
+    memcpy(&first, pixels, sizeof(first));
+    bool same = first == expected;
+    printf("%-8s %-20s %10.1f us  %8.1f Mpx/s  %s\n", "scalar", "pack to RGB16_565", elapsed, count / elapsed,
+           same ? "ok" : "MISMATCH");
+    if(!same) {
+        ret = 1;
+    }
+    
+    free(pixels);
+    return ret;
+}
+
+// Times halving an image with each kernel and checks that they agree
+// with the scalar one
+static int BenchMipmap(int argc, char** argv) {
+    int ret = 0;
+    double megapixels = 8;
+    const int iterations = 10;
+    
+    if(argc >= 1) {
+        megapixels = atof(argv[0]);
+    }
+    // Odd sizes so that the kernels' scalar tails are tested too
+    unsigned src_h = (unsigned)sqrt(megapixels * 1000 * 1000 * 9 / 16) | 1;
+    unsigned src_w = (src_h * 16 / 9) | 1;
+    size_t src_count = (size_t)src_w * src_h;
+    size_t dst_count = (size_t)(src_w / 2) * (src_h / 2);
+    
+    auto input = (uint8_t*)malloc(src_count * 4);
+    auto expected = (uint8_t*)malloc(dst_count * 4);
+    auto output = (uint8_t*)malloc(dst_count * 4);
+    srand(1);
+    for(size_t i = 0; i < src_count * 4; i++) {
+        input[i] = (uint8_t)rand();
+    }
+    
+    printf("Halving a %ux%u image, best kernel is %s:\n", src_w, src_h, Pixel_KernelName(Pixel_BestKernel()));
+    Pixel_HalveWith(PIXKERN_SCALAR, input, src_w, src_h, expected);
+    for(int k = 0; k < PIXKERN_MAX; k++) {
+        auto kernel = (Pixel_Kernel)k;
+        double best = 1e30;
+        bool supported = true;
+        for(int i = 0; i < iterations && supported; i++) {
+            memset(output, 0, dst_count * 4);
+            auto start = Clock::now();
+            supported = Pixel_HalveWith(kernel, input, src_w, src_h, output);
+            auto elapsed = ElapsedMicroseconds(start);
+            if(elapsed < best) {
+                best = elapsed;
+            }
+        }
+        if(!supported) {
+            printf("%-8s unsupported\n", Pixel_KernelName(kernel));
+            continue;
+        }
+        bool same = memcmp(output, expected, dst_count * 4) == 0;
+        printf("%-8s %10.1f us  %8.1f Mpx/s  %s\n", Pixel_KernelName(kernel), best, src_count / best,
+               same ? "ok" : "MISMATCH");
+        if(!same) {
+            ret = 1;
+        }
+    }
+    
+    free(input);
+    free(expected);
+    free(output);
+    return ret;
+}
+
+static void CollectImage(const char* path, Present_Dependency kind, void* user) {
+    if(kind == PDEP_IMAGE) {
+        ((std::vector<std::string>*)user)->push_back(path);
+    }
+}
+
+// Loads every image of a presentation in the background with an empty
+// cache and returns how long it took
+static double TimeWarmup(const std::vector<std::string>& paths, unsigned threads) {
+    ImageLoader_SetDecodeThreads(threads);
+    ImageLoader_Init();
+    auto start = Clock::now();
+    std::vector<Promised_Image*> promises;
+    for(auto& path : paths) {
+        promises.push_back(ImageLoader_Request(path.c_str(), IMGPRI_PREFETCH));
+    }
+    // Poll instead of waiting, waiting would make them visible requests
+    for(auto promise : promises) {
+        while(!ImageLoader_Poll(promise)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    auto ret = ElapsedMicroseconds(start);
+    for(auto promise : promises) {
+        ImageLoader_Free(promise);
+    }
+    ImageLoader_Shutdown();
+    ImageLoader_SetDecodeThreads(0);
+    return ret;
+}
+
+// Measures how loading every image of a presentation scales with the
+// number of decoding threads
+static int BenchPool(int argc, char** argv) {
+    int ret = 1;
+    std::vector<std::string> paths;
+    unsigned max_threads = std::thread::hardware_concurrency();
+    
+    if(argc < 1) {
+        return 2;
+    }
+    if(argc >= 2) {
+        max_threads = atoi(argv[1]);
+    }
+    if(max_threads < 1) {
+        max_threads = 1;
+    }
+    
+    auto file = Present_Open(argv[0]);
+    if(file) {
+        Present_ForEachDependency(file, CollectImage, &paths);
+        Present_Close(file);
+        
+        std::vector<double> times;
+        for(unsigned threads = 1; threads <= max_threads; threads *= 2) {
+            times.push_back(TimeWarmup(paths, threads));
+        }
+        printf("Loading the %zu images of '%s' in the background:\n", paths.size(), argv[0]);
+        for(unsigned i = 0; i < times.size(); i++) {
+            printf("%3u threads %14.1f us  %5.2fx\n", 1u << i, times[i], times[0] / times[i]);
+        }
+        ret = 0;
+    }
+    
+    return ret;
+}
+
+// Loads every image of a presentation and reports how many had to be
+// decoded and how much memory they take
+static int BenchFootprint(int argc, char** argv) {
+    int ret = 1;
+    std::vector<std::string> paths;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    
+    auto file = Present_Open(argv[0]);
+    if(file) {
+        Present_ForEachDependency(file, CollectImage, &paths);
+        Present_Close(file);
+        
+        ImageLoader_Init();
+        std::vector<Promised_Image*> promises;
+        std::vector<Loaded_Image*> images;
+        for(auto& path : paths) {
+            promises.push_back(ImageLoader_Request(path.c_str()));
+        }
+        for(auto promise : promises) {
+            images.push_back(ImageLoader_Await(promise));
+        }
+        Image_Cache_Stats stats;
+        ImageLoader_GetCacheStats(&stats);
+        printf("%zu images of '%s': %lu decoded, %lu shared, %.1f MiB of pixels\n",
+               paths.size(), argv[0], stats.finished[IMGSTAGE_DECODE], stats.deduplicated,
+               stats.bytes / (1024.0 * 1024.0));
+        for(auto image : images) {
+            ImageLoader_Free(image);
+        }
+        ImageLoader_Shutdown();
+        ret = 0;
+    }
+    
+    return ret;
+}
+
+// Compares how long it takes to know the size of every image of
+// a presentation from the headers of their files with loading them
+static int BenchProbe(int argc, char** argv) {
+    int ret = 1;
+    std::vector<std::string> paths;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    
+    auto file = Present_Open(argv[0]);
+    if(file) {
+        Present_ForEachDependency(file, CollectImage, &paths);
+        Present_Close(file);
+        
+        ImageLoader_Init();
+        auto start = Clock::now();
+        for(auto& path : paths) {
+            ImageLoader_Probe(path.c_str());
+        }
+        unsigned known = 0;
+        for(auto& path : paths) {
+            int w, h;
+            // Gives up on files whose header can't be read
+            auto deadline = Clock::now() + std::chrono::seconds(1);
+            while(!ImageLoader_GetSize(path.c_str(), &w, &h) && Clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            if(Clock::now() < deadline) {
+                known++;
+            }
+        }
+        auto probed = ElapsedMicroseconds(start);
+        ImageLoader_Shutdown();
+        auto loaded = TimeWarmup(paths, 0);
+        
+        printf("Sizes of the %zu images of '%s':\n", paths.size(), argv[0]);
+        printf("from the headers %14.1f us  (%u known)\n", probed, known);
+        printf("by loading them  %14.1f us  %5.2fx\n", loaded, loaded / probed);
+        ret = 0;
+    }
+    
+    return ret;
+}
+
+// Compares loading every image of a presentation without the disk cache,
+// with an empty one and with one that has every image
+static int BenchDiskCache(int argc, char** argv) {
+    int ret = 1;
+    std::vector<std::string> paths;
+    
+    if(argc < 2) {
+        return 2;
+    }
+    
+    auto file = Present_Open(argv[0]);
+    if(file) {
+        Present_ForEachDependency(file, CollectImage, &paths);
+        Present_Close(file);
+        
+        // NOTE(easimer): the directory is emptied, so it shouldn't be the
+        // one that's used normally
+        if(DiskCache_Open(argv[1], (size_t)-1)) {
+            DiskCache_Clear();
+            DiskCache_Close();
+            
+            auto none = TimeWarmup(paths, 0);
+            ImageLoader_SetDiskCache(argv[1], (size_t)-1);
+            auto cold = TimeWarmup(paths, 0);
+            auto warm = TimeWarmup(paths, 0);
+            ImageLoader_SetDiskCache(NULL, 0);
+            
+            printf("Loading the %zu images of '%s':\n", paths.size(), argv[0]);
+            printf("without disk cache %14.1f ms\n", none / 1000);
+            printf("empty disk cache   %14.1f ms  %5.2fx\n", cold / 1000, none / cold);
+            printf("full disk cache    %14.1f ms  %5.2fx\n", warm / 1000, none / warm);
+            ret = 0;
+        }
+    }
+    
+    return ret;
+}
+
+// Decodes a file with one decoder repeatedly for at least half
+// a second. Returns the average time of a decode, or a negative number if
+// the decoder can't decode the file; `*out` receives the pixels of the
+// last decode.
+static double TimeDecode(unsigned backend, const Fetch_Buffer& file, unsigned min_width, uint8_t** out, int* w,
+                         int* h) {
+    double ret = -1;
+    bool has_alpha;
+    int iterations = 0;
+    *out = NULL;
+    auto start = Clock::now();
+    do {
+        free(*out);
+        *out = Decode_ImageWith(backend, file.data, file.size, min_width, w, h, &has_alpha);
+        iterations++;
+    } while(*out && ElapsedMicroseconds(start) < 500000);
+    if(*out) {
+        ret = ElapsedMicroseconds(start) / iterations;
+    }
+    return ret;
+}
+
+// Compares the decoders present was built with on a set of image files,
+// at full size and when the image is only needed `screen_width` pixels
+// wide. The pixels of every decoder are compared with stb_image's.
+static int BenchDecoders(int argc, char** argv) {
+    int ret = 0;
+    unsigned screen_width = 1920;
+    unsigned count = Decode_GetBackendCount();
+    // stb_image is the last one
+    unsigned reference = count - 1;
+    // Decoding every file with the decoder Decode_Image would pick and
+    // with stb_image
+    double total_picked = 0, total_reference = 0;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    
+    for(int i = 0; i < argc; i++) {
+        Fetch_Buffer file;
+        if(!Fetch_ReadFile(argv[i], &file)) {
+            fprintf(stderr, "Couldn't read '%s'\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        uint8_t* expected;
+        int ref_w, ref_h;
+        TimeDecode(reference, file, 0, &expected, &ref_w, &ref_h);
+        printf("%s (%.1f MiB):\n", argv[i], file.size / (1024.0 * 1024.0));
+        bool picked = false;
+        for(unsigned backend = 0; backend < count; backend++) {
+            int full_w = 0, full_h = 0;
+            for(auto min_width : {0u, screen_width}) {
+                uint8_t* pixels;
+                int w, h;
+                auto us = TimeDecode(backend, file, min_width, &pixels, &w, &h);
+                if(us < 0) {
+                    continue;
+                }
+                if(min_width == 0) {
+                    full_w = w;
+                    full_h = h;
+                    if(!picked) {
+                        total_picked += us;
+                        picked = true;
+                    }
+                    if(backend == reference) {
+                        total_reference += us;
+                    }
+                } else if(w == full_w) {
+                    // The decoder can't decode at a smaller size
+                    free(pixels);
+                    continue;
+                }
+                // Throughput in pixels of the file
+                printf("  %-10s %5dx%-5d %10.1f ms %8.1f Mpx/s", Decode_GetBackendName(backend), w, h, us / 1000,
+                       (double)full_w * full_h / us);
+                if(expected && w == ref_w && h == ref_h) {
+                    // Decoders may round differently
+                    int max_diff = 0;
+                    for(size_t p = 0; p < (size_t)w * h * 4; p++) {
+                        int diff = abs((int)pixels[p] - (int)expected[p]);
+                        max_diff = diff > max_diff ? diff : max_diff;
+                    }
+                    printf("  max difference %d", max_diff);
+                }
+                printf("\n");
+                free(pixels);
+            }
+        }
+        free(expected);
+        Fetch_Free(&file);
+    }
+    
+    printf("Decoding every file at full size:\n");
+    printf("  %-22s %10.1f ms\n", "with the best decoders", total_picked / 1000);
+    printf("  %-22s %10.1f ms\n", "with stb_image", total_reference / 1000);
+    
+    return ret;
+}
+
+// Loads an image through the loader and frees it.
+// Returns how long it took in microseconds, or a negative value if it
+// couldn't be loaded.
+static double TimeLoad(const char* path) {
+    double ret = -1;
+    auto start = Clock::now();
+    auto limg = ImageLoader_Await(ImageLoader_Request(path));
+    if(limg) {
+        ret = ElapsedMicroseconds(start);
+        ImageLoader_Free(limg);
+    }
+    return ret;
+}
+
+// Measures how well decoded images compress, how fast they compress and
+// decompress and checks that they decompress to the same pixels. Then
+// evicts each image from the loader's cache and compares loading it from
+// the compressed tier with decoding it.
+static int BenchCompress(int argc, char** argv) {
+    int ret = 0;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    
+    printf("%-32s %10s %8s %10s %12s %12s\n", "image", "MiB", "ratio", "decode ms", "compress ms", "expand ms");
+    for(int i = 0; i < argc; i++) {
+        Fetch_Buffer file;
+        if(!Fetch_ReadFile(argv[i], &file)) {
+            fprintf(stderr, "Couldn't read '%s'\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        int w, h;
+        bool has_alpha;
+        auto start = Clock::now();
+        auto pixels = Decode_Image(file.data, file.size, 0, &w, &h, &has_alpha);
+        auto decode_us = ElapsedMicroseconds(start);
+        Fetch_Free(&file);
+        if(!pixels) {
+            fprintf(stderr, "Couldn't decode '%s'\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        size_t size = (size_t)w * h * 4;
+        auto compressed = (uint8_t*)malloc(Compress_Bound(size));
+        auto expanded = (uint8_t*)malloc(size);
+        start = Clock::now();
+        auto compressed_size = Compress_LZ4(pixels, size, compressed);
+        auto compress_us = ElapsedMicroseconds(start);
+        start = Clock::now();
+        bool ok = Compress_ExpandLZ4(compressed, compressed_size, expanded, size);
+        auto expand_us = ElapsedMicroseconds(start);
+        if(!ok || memcmp(pixels, expanded, size) != 0) {
+            fprintf(stderr, "'%s' didn't decompress to the same pixels\n", argv[i]);
+            ret = 1;
+        }
+        printf("%-32s %10.1f %7.2fx %10.1f %12.1f %12.1f\n", argv[i], size / (1024.0 * 1024.0),
+               (double)size / compressed_size, decode_us / 1000, compress_us / 1000, expand_us / 1000);
+        free(compressed);
+        free(expanded);
+        free(pixels);
+    }
+    
+    if(ret == 0) {
+        printf("Loading through the image loader, decoded vs. restored from the compressed tier:\n");
+        for(int i = 0; i < argc; i++) {
+            ImageLoader_Init();
+            // Every image is evicted as soon as it's freed
+            ImageLoader_SetCacheBudget(0);
+            auto decode_us = TimeLoad(argv[i]);
+            // Wait for the compressing thread
+            Image_Cache_Stats stats;
+            auto start = Clock::now();
+            do {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ImageLoader_GetCacheStats(&stats);
+            } while(stats.compressed_entries == 0 && ElapsedMicroseconds(start) < 10000000);
+            auto restore_us = TimeLoad(argv[i]);
+            ImageLoader_GetCacheStats(&stats);
+            if(decode_us < 0 || stats.compressed_hits != 1) {
+                fprintf(stderr, "'%s' wasn't restored from the compressed tier\n", argv[i]);
+                ret = 1;
+            } else {
+                printf("%-32s %10.1f ms %10.1f ms\n", argv[i], decode_us / 1000, restore_us / 1000);
+            }
+            ImageLoader_Shutdown();
+        }
+        ImageLoader_SetCacheBudget(IMAGE_CACHE_DEFAULT_BUDGET);
+    }
+    
+    return ret;
+}
+
+// Streams the frames of a GIF like an animation does, twice, and checks
+// that the second time gives the same frames as the first
+static int BenchGif(int argc, char** argv) {
+    int ret = 0;
+    Fetch_Buffer file;
+    int w = 0, h = 0, comp;
+    std::vector<uint64_t> hashes;
+    std::vector<int> delays;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    if(!Fetch_ReadFile(argv[0], &file)) {
+        fprintf(stderr, "Couldn't read '%s'\n", argv[0]);
+        return 1;
+    }
+    
+    // NOTE(easimer): the frames aren't checked against
+    // stbi_load_gif_from_memory, which reads outside of it's buffer when
+    // a frame is disposed of by restoring the one before it
+    auto first = stbi_load_from_memory(file.data, (int)file.size, &w, &h, &comp, 4);
+    auto decoder = Anim_OpenDecoder(file.data, file.size);
+    if(!first || !decoder) {
+        fprintf(stderr, "Couldn't decode '%s'\n", argv[0]);
+        ret = 1;
+    } else {
+        size_t frame_size = (size_t)w * h * 4;
+        double total_ms = 0;
+        double slowest_us = 0;
+        double stream_us = 0;
+        for(int pass = 0; pass < 2 && ret == 0; pass++) {
+            unsigned count = 0;
+            for(;;) {
+                int fw, fh, delay;
+                auto start = Clock::now();
+                auto pixels = Anim_NextFrame(decoder, &fw, &fh, &delay);
+                auto us = ElapsedMicroseconds(start);
+                if(!pixels) {
+                    break;
+                }
+                auto hash = Hash_Bytes(pixels, frame_size);
+                if(pass == 0) {
+                    hashes.push_back(hash);
+                    delays.push_back(delay);
+                    total_ms += delay;
+                    stream_us += us;
+                    slowest_us = us > slowest_us ? us : slowest_us;
+                }
+                if(fw != w || fh != h || (count == 0 && memcmp(pixels, first, frame_size) != 0) ||
+                   count >= hashes.size() || hashes[count] != hash || delays[count] != delay) {
+                    fprintf(stderr, "Frame %u differs\n", count);
+                    ret = 1;
+                    break;
+                }
+                count++;
+            }
+            if(ret == 0 && count != hashes.size()) {
+                fprintf(stderr, "%u frames after rewinding instead of %u\n", count, (unsigned)hashes.size());
+                ret = 1;
+            }
+            Anim_Rewind(decoder);
+        }
+        if(ret == 0) {
+            size_t frames = hashes.size();
+            // The ring of converted frames and the decoder's own buffers:
+            // the current image, the background, the last two frames and
+            // a byte per pixel of history
+            size_t streamed = (ANIM_RING_FRAMES + 4) * frame_size + (size_t)w * h;
+            printf("%u frames of %dx%d, %.1f s long\n", (unsigned)frames, w, h, total_ms / 1000);
+            printf("Decoding:    %.1f ms, %.2f ms per frame, slowest %.2f ms\n", stream_us / 1000,
+                   stream_us / 1000 / frames, slowest_us / 1000);
+            printf("Memory:      %.1f MiB streamed, %.1f MiB for every frame\n", streamed / (1024.0 * 1024.0),
+                   frames * frame_size / (1024.0 * 1024.0));
+        }
+    }
+    
+    Anim_CloseDecoder(decoder);
+    stbi_image_free(first);
+    Fetch_Free(&file);
+    return ret;
+}
+
+// Screens the tiles are fetched for
+#define BENCH_VIEWPORTS (100)
+
+static int BenchTiles(int argc, char** argv) {
+    int ret = 0;
+    Tiles_Stats stats;
+    int w, h, levels;
+    
+    if(argc < 1) {
+        return 2;
+    }
+    
+    Tiles_Init();
+    auto image = Tiles_Open(argv[0]);
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        Tiles_GetStats(image, &stats);
+    } while(!stats.built && !stats.failed);
+    
+    if(stats.failed || !Tiles_GetInfo(image, &w, &h, &levels)) {
+        fprintf(stderr, "Couldn't tile '%s'\n", argv[0]);
+        ret = 1;
+    } else {
+        printf("%dx%d, %d levels, %u tiles of %d pixels\n", w, h, levels, stats.tiles, TILE_SIZE);
+        printf("Tiling:    %.2f s, %.1f Mpx/s\n", stats.build_seconds, (double)w * h / 1e6 / stats.build_seconds);
+        printf("Stored:    %.1f MiB of %.1f MiB (%.1f%%)\n", stats.stored_bytes / (1024.0 * 1024.0),
+               stats.raw_bytes / (1024.0 * 1024.0), 100.0 * stats.stored_bytes / stats.raw_bytes);
+        
+        // Random 1920x1080 screens at random levels, like zooming and
+        // panning around
+        double total_us = 0, slowest_us = 0;
+        size_t peak = 0;
+        unsigned fetched = 0;
+        srand(1);
+        for(int i = 0; i < BENCH_VIEWPORTS; i++) {
+            int level = rand() % levels;
+            int level_w = w >> level, level_h = h >> level;
+            int x0 = level_w > 1920 ? rand() % (level_w - 1920) : 0;
+            int y0 = level_h > 1080 ? rand() % (level_h - 1080) : 0;
+            int x1 = (x0 + 1920 < level_w ? x0 + 1920 : level_w) - 1;
+            int y1 = (y0 + 1080 < level_h ? y0 + 1080 : level_h) - 1;
+            auto start = Clock::now();
+            Tiles_NextFrame(image);
+            for(int y = y0 / TILE_SIZE; y <= y1 / TILE_SIZE; y++) {
+                for(int x = x0 / TILE_SIZE; x <= x1 / TILE_SIZE; x++) {
+                    Tile tile;
+                    if(!Tiles_GetTile(image, level, x, y, &tile, true)) {
+                        fprintf(stderr, "Couldn't get tile %d/%d,%d\n", level, x, y);
+                        ret = 1;
+                    }
+                    fetched++;
+                }
+            }
+            auto us = ElapsedMicroseconds(start);
+            total_us += us;
+            slowest_us = us > slowest_us ? us : slowest_us;
+            Tiles_GetStats(image, &stats);
+            peak = stats.cached_bytes > peak ? stats.cached_bytes : peak;
+        }
+        printf("Screens:   %.2f ms on average, slowest %.2f ms, %u tiles\n", total_us / 1000 / BENCH_VIEWPORTS,
+               slowest_us / 1000, fetched);
+        printf("Cache:     %lu hits, %lu misses, at most %.1f MiB of %.1f MiB\n", stats.hits, stats.misses,
+               peak / (1024.0 * 1024.0), TILES_DEFAULT_BUDGET / (1024.0 * 1024.0));
+        printf("Whole:     %.1f MiB decoded at once\n", (double)w * h * 4 / (1024.0 * 1024.0));
+    }
+    
+    Tiles_Close(image);
+    Tiles_Shutdown();
+    return ret;
+}
+
+static const Bench_Entry gBenchmarks[] = {
+    {"open", "open <file.prs> [iterations]", BenchOpen},
+    {"redraw", "redraw <file.prs>", BenchRedraw},
+    {"navigate", "navigate <file.prs> [milliseconds per slide]", BenchNavigate},
+    {"await", "await <image> [iterations]", BenchAwait},
+    {"progressive", "progressive <file.prs>", BenchProgressive},
+    {"downscale", "downscale <image> [width]", BenchDownscale},
+    {"convert", "convert [megapixels]", BenchConvert},
+    {"mipmap", "mipmap [megapixels]", BenchMipmap},
+    {"opacity", "opacity [megapixels]", BenchOpacity},
+    {"pool", "pool <file.prs> [max decoding threads]", BenchPool},
+    {"diskcache", "diskcache <file.prs> <scratch directory>", BenchDiskCache},
+    {"footprint", "footprint <file.prs>", BenchFootprint},
+    {"probe", "probe <file.prs>", BenchProbe},
+    {"decoders", "decoders <image> [image...]", BenchDecoders},
+    {"compress", "compress <image> [image...]", BenchCompress},
+    {"gif", "gif <file.gif>", BenchGif},
+    {"tiles", "tiles <image>", BenchTiles},
+};
+
+int Bench_Run(int argc, char** argv) {
+    int ret = 2;
+    
+    if(argc >= 1) {
+        for(auto& bench : gBenchmarks) {
+            if(strcmp(bench.name, argv[0]) == 0) {
+                ret = bench.func(argc - 1, argv + 1);
+                if(ret == 2) {
+                    fprintf(stderr, "Usage: --bench %s\n", bench.usage);
+                }
+                return ret;
+            }
+        }
+    }
+    
+    fprintf(stderr, "Benchmarks:\n");
+    for(auto& bench : gBenchmarks) {
+        fprintf(stderr, "    --bench %s\n", bench.usage);
+    }
+    
+    return ret;
+}
@@ -0,0 +1,23 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// Runs the benchmark named by argv[0], passing it the rest of the
+// arguments. If there is no such benchmark then the list of benchmarks
+// is printed.
+// Returns the exit code of the program.
+int Bench_Run(int argc, char** argv);
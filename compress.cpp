@@ -0,0 +1,263 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compress.h"
+
+// Matches are at least this long
+#define LZ_MIN_MATCH (4)
+// Matches are found through a hash table of the last position of every
+// 5 byte sequence. Hashing 5 bytes rather than the 4 that have to match
+// keeps 4 byte matches, which barely save anything, from displacing
+// longer ones.
+#define LZ_HASH_BITS (16)
+#define LZ_MAX_OFFSET (65535)
+// The format requires the last match to start at least 12 bytes before
+// the end of the block, and the last 5 bytes to be literals
+#define LZ_MATCH_START_LIMIT (12)
+#define LZ_LAST_LITERALS (5)
+// After this many misses in a row positions start being skipped, so
+// that incompressible data is passed over quickly
+#define LZ_SKIP_TRIGGER (6)
+
+static uint32_t Read32(const uint8_t* p) {
+    uint32_t ret;
+    memcpy(&ret, p, sizeof(ret));
+    return ret;
+}
+
+static uint64_t Read64(const uint8_t* p) {
+    uint64_t ret;
+    memcpy(&ret, p, sizeof(ret));
+    return ret;
+}
+
+static uint32_t Hash(const uint8_t* p) {
+    // NOTE(easimer): the lowest 5 bytes of the little-endian read
+    return (uint32_t)(((Read64(p) << 24) * 889523592379ull) >> (64 - LZ_HASH_BITS));
+}
+
+// Returns the number of bytes that are the same at `a` and `b`, without
+// reading from `limit` onwards at `a`
+static size_t CountMatching(const uint8_t* a, const uint8_t* b, const uint8_t* limit) {
+    const uint8_t* start = a;
+    while(a + 8 <= limit) {
+        uint64_t diff = Read64(a) ^ Read64(b);
+        if(diff) {
+            // NOTE(easimer): assumes a little-endian CPU, like the rest of
+            // the pixel code
+            while(!(diff & 0xFF)) {
+                diff >>= 8;
+                a++;
+            }
+            return a - start;
+        }
+        a += 8;
+        b += 8;
+    }
+    while(a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return a - start;
+}
+
+// Writes the part of a length that didn't fit into the token
+static uint8_t* WriteLength(uint8_t* op, size_t length) {
+    while(length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// Writes a sequence: literals followed by a match. The last sequence of
+// a block has no match.
+static uint8_t* WriteSequence(uint8_t* op, const uint8_t* literals, size_t literal_count, size_t offset,
+                              size_t match_length) {
+    uint8_t* token = op++;
+    *token = 0;
+    if(literal_count >= 15) {
+        *token = 15 << 4;
+        op = WriteLength(op, literal_count - 15);
+    } else {
+        *token = (uint8_t)(literal_count << 4);
+    }
+    if(literal_count > 0) {
+        memcpy(op, literals, literal_count);
+        op += literal_count;
+    }
+    if(offset > 0) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        match_length -= LZ_MIN_MATCH;
+        if(match_length >= 15) {
+            *token |= 15;
+            op = WriteLength(op, match_length - 15);
+        } else {
+            *token |= (uint8_t)match_length;
+        }
+    }
+    return op;
+}
+
+size_t Compress_Bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t Compress_LZ4(const uint8_t* src, size_t size, uint8_t* dst) {
+    uint8_t* op = dst;
+    const uint8_t* anchor = src; // start of the pending literals
+    const uint8_t* end = src + size;
+    assert(dst && (src || size == 0));
+    
+    if(size > LZ_MATCH_START_LIMIT) {
+        auto table = (uint32_t*)calloc((size_t)1 << LZ_HASH_BITS, sizeof(uint32_t));
+        const uint8_t* start_limit = end - LZ_MATCH_START_LIMIT;
+        const uint8_t* match_limit = end - LZ_LAST_LITERALS;
+        const uint8_t* ip = src;
+        unsigned misses = 0;
+        while(table && ip < start_limit) {
+            uint32_t sequence = Read32(ip);
+            uint32_t h = Hash(ip);
+            const uint8_t* ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if(ref < ip && ip - ref <= LZ_MAX_OFFSET && Read32(ref) == sequence) {
+                // The match may start before the sequence that was found
+                while(ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                    ip--;
+                    ref--;
+                }
+                size_t length = LZ_MIN_MATCH + CountMatching(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, match_limit);
+                op = WriteSequence(op, anchor, ip - anchor, ip - ref, length);
+                ip += length;
+                anchor = ip;
+                misses = 0;
+                // Makes the position right before the next one findable
+                if(ip - 2 < start_limit) {
+                    table[Hash(ip - 2)] = (uint32_t)(ip - 2 - src);
+                }
+            } else {
+                ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+            }
+        }
+        free(table);
+    }
+    // The rest is literals
+    op = WriteSequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+// Reads the part of a length that didn't fit into the token.
+// Returns false if the block ends first.
+static bool ReadLength(const uint8_t** ip, const uint8_t* end, size_t* length) {
+    uint8_t byte;
+    do {
+        if(*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+bool Compress_ExpandLZ4(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + size;
+    uint8_t* op = dst;
+    uint8_t* op_end = dst + dst_size;
+    bool ret = false;
+    assert((src || size == 0) && (dst || dst_size == 0));
+    
+    while(ip < end) {
+        uint8_t token = *ip++;
+        size_t literal_count = token >> 4;
+        if(literal_count == 15 && !ReadLength(&ip, end, &literal_count)) {
+            break;
+        }
+        if(literal_count > (size_t)(end - ip) || literal_count > (size_t)(op_end - op)) {
+            break;
+        }
+        if(literal_count <= 16 && end - ip >= 16 && op_end - op >= 16) {
+            // Short literals are copied in one fixed-size move; the bytes
+            // written past them are overwritten by what comes next
+            memcpy(op, ip, 16);
+        } else {
+            memcpy(op, ip, literal_count);
+        }
+        op += literal_count;
+        ip += literal_count;
+        if(ip == end) {
+            // The last sequence has no match
+            ret = op == op_end;
+            break;
+        }
+        
+        if(end - ip < 2) {
+            break;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if(length == 15 && !ReadLength(&ip, end, &length)) {
+            break;
+        }
+        length += LZ_MIN_MATCH;
+        if(offset == 0 || offset > (size_t)(op - dst) || length > (size_t)(op_end - op)) {
+            break;
+        }
+        const uint8_t* match = op - offset;
+        if(offset >= 16 && (size_t)(op_end - op) >= length + 16) {
+            // Copied 16 bytes at a time, the last move may write past the
+            // match. Each move only reads bytes that are already final.
+            uint8_t* copy_end = op + length;
+            do {
+                memcpy(op, match, 16);
+                op += 16;
+                match += 16;
+            } while(op < copy_end);
+            op = copy_end;
+            length = 0;
+        } else if(offset >= 8 && (size_t)(op_end - op) >= length + 8) {
+            // The same for nearer matches, 8 bytes at a time
+            uint8_t* copy_end = op + length;
+            do {
+                memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            } while(op < copy_end);
+            op = copy_end;
+            length = 0;
+        }
+        // The match may overlap the bytes it produces, repeating the last
+        // `offset` bytes. Every copy doubles what can be copied at once.
+        while(length > 0) {
+            size_t chunk = (size_t)(op - match);
+            if(chunk > length) {
+                chunk = length;
+            }
+            memcpy(op, match, chunk);
+            op += chunk;
+            length -= chunk;
+        }
+    }
+    
+    return ret;
+}
@@ -0,0 +1,35 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Fast lossless compression in the LZ4 block format, for keeping decoded
+// images in memory in less space. Compression is a greedy single pass;
+// decompression runs at memory speed.
+
+// Returns the largest size `size` bytes can take compressed
+size_t Compress_Bound(size_t size);
+
+// Compresses `size` bytes into `dst`, which must have room for
+// Compress_Bound(size) bytes.
+// Returns the compressed size.
+size_t Compress_LZ4(const uint8_t* src, size_t size, uint8_t* dst);
+
+// Decompresses a block that expands to exactly `dst_size` bytes.
+// Returns false if the block is malformed or doesn't expand to that size.
+bool Compress_ExpandLZ4(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size);
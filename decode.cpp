@@ -0,0 +1,483 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <setjmp.h>
+#include "decode.h"
+#include "pixel.h"
+#include "stb_image.h"
+#if HAVE_LIBJPEG
+#include <jpeglib.h>
+#ifndef JCS_EXTENSIONS
+// Only libjpeg-turbo can decode to RGBA
+#undef HAVE_LIBJPEG
+#endif
+#endif
+#if HAVE_SPNG
+#include <spng.h>
+#endif
+
+struct Decode_Backend {
+    const char* name;
+    // Returns whether the file is in a format this decoder supports,
+    // judging by it's first bytes
+    bool (*accepts)(const uint8_t* data, size_t size);
+    uint8_t* (*decode)(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha);
+};
+
+#if HAVE_LIBJPEG
+static bool IsJPEG(const uint8_t* data, size_t size) {
+    return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+#endif
+
+#if HAVE_SPNG
+static bool IsPNG(const uint8_t* data, size_t size) {
+    return size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0;
+}
+#endif
+
+static bool AcceptsAny(const uint8_t* data, size_t size) {
+    return true;
+}
+
+static uint8_t* DecodeSTB(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha) {
+    int channels;
+    // NOTE(easimer): stb_image allocates with malloc
+    auto ret = stbi_load_from_memory(data, (int)size, w, h, &channels, STBI_rgb_alpha);
+    // `channels` is the number of channels in the file
+    *has_alpha = channels == 2 || channels == 4;
+    return ret;
+}
+
+#if HAVE_LIBJPEG
+struct JPEG_Error {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void OnJPEGError(j_common_ptr cinfo) {
+    longjmp(((JPEG_Error*)cinfo->err)->jump, 1);
+}
+
+static void OnJPEGMessage(j_common_ptr cinfo, int level) {
+    // Warnings about corrupt data aren't printed; stb_image is quiet too
+}
+
+// Decodes with libjpeg(-turbo). Large images are scaled down while
+// decoding (in the DCT domain), which skips most of the work of decoding
+// the pixels that would be thrown away by shrinking.
+static uint8_t* DecodeLibJPEG(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha) {
+    // NOTE(easimer): locals that are changed after setjmp must be volatile
+    uint8_t* volatile ret = NULL;
+    jpeg_decompress_struct cinfo;
+    JPEG_Error err;
+    
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = OnJPEGError;
+    err.mgr.emit_message = OnJPEGMessage;
+    if(setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(ret);
+        return NULL;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, (unsigned long)size);
+    jpeg_read_header(&cinfo, TRUE);
+    // CMYK files can't be converted to RGBA; stb_image takes them
+    if(cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    cinfo.out_color_space = JCS_EXT_RGBA;
+    // The smallest scale of M/8 that keeps the image at least
+    // `min_width` wide
+    cinfo.scale_num = 8;
+    cinfo.scale_denom = 8;
+    if(min_width > 0) {
+        while(cinfo.scale_num > 1 && (cinfo.image_width * (cinfo.scale_num - 1) + 7) / 8 >= min_width) {
+            cinfo.scale_num--;
+        }
+    }
+    jpeg_start_decompress(&cinfo);
+    size_t stride = (size_t)cinfo.output_width * 4;
+    ret = (uint8_t*)malloc(stride * cinfo.output_height);
+    if(!ret) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    while(cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW rows[4];
+        int count = 0;
+        for(; count < 4 && cinfo.output_scanline + count < cinfo.output_height; count++) {
+            rows[count] = ret + stride * (cinfo.output_scanline + count);
+        }
+        jpeg_read_scanlines(&cinfo, rows, count);
+    }
+    *w = (int)cinfo.output_width;
+    *h = (int)cinfo.output_height;
+    *has_alpha = false;
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return ret;
+}
+#endif
+
+#if HAVE_SPNG
+static uint8_t* DecodeSPNG(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha) {
+    uint8_t* ret = NULL;
+    spng_ihdr ihdr;
+    spng_trns trns;
+    size_t out_size;
+    
+    auto ctx = spng_ctx_new(0);
+    if(ctx) {
+        if(spng_set_png_buffer(ctx, data, size) == 0 && spng_get_ihdr(ctx, &ihdr) == 0 &&
+           spng_decoded_image_size(ctx, SPNG_FMT_RGBA8, &out_size) == 0) {
+            ret = (uint8_t*)malloc(out_size);
+            // Transparent colors (tRNS) are turned into alpha too
+            if(ret && spng_decode_image(ctx, ret, out_size, SPNG_FMT_RGBA8, SPNG_DECODE_TRNS) == 0) {
+                *w = (int)ihdr.width;
+                *h = (int)ihdr.height;
+                *has_alpha = ihdr.color_type == SPNG_COLOR_TYPE_TRUECOLOR_ALPHA ||
+                    ihdr.color_type == SPNG_COLOR_TYPE_GRAYSCALE_ALPHA || spng_get_trns(ctx, &trns) == 0;
+            } else {
+                free(ret);
+                ret = NULL;
+            }
+        }
+        spng_ctx_free(ctx);
+    }
+    return ret;
+}
+#endif
+
+// In the order they're tried; stb_image is the last one since it takes
+// every format
+static const Decode_Backend gBackends[] = {
+#if HAVE_LIBJPEG
+    {"libjpeg", IsJPEG, DecodeLibJPEG},
+#endif
+#if HAVE_SPNG
+    {"libspng", IsPNG, DecodeSPNG},
+#endif
+    {"stb_image", AcceptsAny, DecodeSTB},
+};
+
+#define BACKEND_COUNT (sizeof(gBackends) / sizeof(gBackends[0]))
+
+unsigned Decode_GetBackendCount() {
+    return BACKEND_COUNT;
+}
+
+const char* Decode_GetBackendName(unsigned idx) {
+    const char* ret = NULL;
+    assert(idx < BACKEND_COUNT);
+    if(idx < BACKEND_COUNT) {
+        ret = gBackends[idx].name;
+    }
+    return ret;
+}
+
+uint8_t* Decode_ImageWith(unsigned idx, const uint8_t* data, size_t size, unsigned min_width, int* w, int* h,
+                          bool* has_alpha) {
+    uint8_t* ret = NULL;
+    assert(idx < BACKEND_COUNT && data && w && h && has_alpha);
+    if(idx < BACKEND_COUNT && data && gBackends[idx].accepts(data, size)) {
+        ret = gBackends[idx].decode(data, size, min_width, w, h, has_alpha);
+    }
+    return ret;
+}
+
+struct Decode_Rows {
+#if HAVE_LIBJPEG
+    // Set while libjpeg decodes the file
+    struct JPEG_Rows* jpeg;
+#endif
+#if HAVE_SPNG
+    // Set while libspng decodes the file
+    spng_ctx* png;
+#endif
+    // Otherwise the whole image, decoded by stb_image
+    uint8_t* pixels;
+    int width, height;
+    // The number of rows read so far
+    int y;
+};
+
+#if HAVE_LIBJPEG
+struct JPEG_Rows {
+    jpeg_decompress_struct cinfo;
+    JPEG_Error err;
+};
+
+static bool OpenRowsLibJPEG(Decode_Rows* rows, const uint8_t* data, size_t size, unsigned min_width) {
+    auto jpeg = (JPEG_Rows*)calloc(1, sizeof(JPEG_Rows));
+    if(!jpeg) {
+        return false;
+    }
+    auto cinfo = &jpeg->cinfo;
+    cinfo->err = jpeg_std_error(&jpeg->err.mgr);
+    jpeg->err.mgr.error_exit = OnJPEGError;
+    jpeg->err.mgr.emit_message = OnJPEGMessage;
+    if(setjmp(jpeg->err.jump)) {
+        jpeg_destroy_decompress(cinfo);
+        free(jpeg);
+        return false;
+    }
+    jpeg_create_decompress(cinfo);
+    jpeg_mem_src(cinfo, data, (unsigned long)size);
+    jpeg_read_header(cinfo, TRUE);
+    if(cinfo->jpeg_color_space == JCS_CMYK || cinfo->jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(cinfo);
+        free(jpeg);
+        return false;
+    }
+    cinfo->out_color_space = JCS_EXT_RGBA;
+    // Scaled like in DecodeLibJPEG
+    cinfo->scale_num = 8;
+    cinfo->scale_denom = 8;
+    if(min_width > 0) {
+        while(cinfo->scale_num > 1 && (cinfo->image_width * (cinfo->scale_num - 1) + 7) / 8 >= min_width) {
+            cinfo->scale_num--;
+        }
+    }
+    jpeg_start_decompress(cinfo);
+    rows->jpeg = jpeg;
+    rows->width = (int)cinfo->output_width;
+    rows->height = (int)cinfo->output_height;
+    return true;
+}
+
+static bool ReadRowsLibJPEG(Decode_Rows* rows, uint8_t* dst, int count) {
+    auto cinfo = &rows->jpeg->cinfo;
+    size_t stride = (size_t)rows->width * 4;
+    // NOTE(easimer): every call needs its own jump target, since the one
+    // set while opening the file has returned already
+    if(setjmp(rows->jpeg->err.jump)) {
+        return false;
+    }
+    for(int i = 0; i < count;) {
+        JSAMPROW row = dst + stride * i;
+        if(jpeg_read_scanlines(cinfo, &row, 1) != 1) {
+            return false;
+        }
+        i++;
+    }
+    return true;
+}
+#endif
+
+#if HAVE_SPNG
+static bool OpenRowsSPNG(Decode_Rows* rows, const uint8_t* data, size_t size, bool* has_alpha) {
+    bool ret = false;
+    spng_ihdr ihdr;
+    spng_trns trns;
+    
+    auto ctx = spng_ctx_new(0);
+    if(ctx) {
+        // Interlaced images can't be decoded a row at a time in order
+        if(spng_set_png_buffer(ctx, data, size) == 0 && spng_get_ihdr(ctx, &ihdr) == 0 &&
+           ihdr.interlace_method == 0 &&
+           spng_decode_image(ctx, NULL, 0, SPNG_FMT_RGBA8, SPNG_DECODE_TRNS | SPNG_DECODE_PROGRESSIVE) == 0) {
+            rows->png = ctx;
+            rows->width = (int)ihdr.width;
+            rows->height = (int)ihdr.height;
+            *has_alpha = ihdr.color_type == SPNG_COLOR_TYPE_TRUECOLOR_ALPHA ||
+                ihdr.color_type == SPNG_COLOR_TYPE_GRAYSCALE_ALPHA || spng_get_trns(ctx, &trns) == 0;
+            ret = true;
+        } else {
+            spng_ctx_free(ctx);
+        }
+    }
+    return ret;
+}
+
+static bool ReadRowsSPNG(Decode_Rows* rows, uint8_t* dst, int count) {
+    size_t stride = (size_t)rows->width * 4;
+    for(int i = 0; i < count; i++) {
+        // The last row returns SPNG_EOI
+        int res = spng_decode_row(rows->png, dst + stride * i, stride);
+        if(res != 0 && res != SPNG_EOI) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+Decode_Rows* Decode_OpenRows(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha) {
+    Decode_Rows* ret = NULL;
+    bool ok = false;
+    assert(data && w && h && has_alpha);
+    
+    if(data) {
+        ret = (Decode_Rows*)calloc(1, sizeof(Decode_Rows));
+    }
+    if(ret) {
+#if HAVE_LIBJPEG
+        if(!ok && IsJPEG(data, size)) {
+            ok = OpenRowsLibJPEG(ret, data, size, min_width);
+            *has_alpha = false;
+        }
+#endif
+#if HAVE_SPNG
+        if(!ok && IsPNG(data, size)) {
+            ok = OpenRowsSPNG(ret, data, size, has_alpha);
+        }
+#endif
+        if(!ok) {
+            ret->pixels = DecodeSTB(data, size, min_width, &ret->width, &ret->height, has_alpha);
+            ok = ret->pixels != NULL;
+        }
+        if(ok) {
+            *w = ret->width;
+            *h = ret->height;
+        } else {
+            free(ret);
+            ret = NULL;
+        }
+    }
+    return ret;
+}
+
+bool Decode_ReadRows(Decode_Rows* rows, uint8_t* dst, int count) {
+    bool ret = false;
+    assert(rows && dst && count >= 0);
+    if(rows && dst && count >= 0 && count <= rows->height - rows->y) {
+#if HAVE_LIBJPEG
+        if(rows->jpeg) {
+            ret = ReadRowsLibJPEG(rows, dst, count);
+        }
+#endif
+#if HAVE_SPNG
+        if(rows->png) {
+            ret = ReadRowsSPNG(rows, dst, count);
+        }
+#endif
+        if(rows->pixels) {
+            size_t stride = (size_t)rows->width * 4;
+            memcpy(dst, rows->pixels + stride * rows->y, stride * count);
+            ret = true;
+        }
+        if(ret) {
+            rows->y += count;
+        } else {
+            // Broken files stay broken
+            rows->y = rows->height;
+        }
+    }
+    return ret;
+}
+
+void Decode_CloseRows(Decode_Rows* rows) {
+    if(rows) {
+#if HAVE_LIBJPEG
+        if(rows->jpeg) {
+            // Unread rows are fine; destroying aborts the decompression
+            jpeg_destroy_decompress(&rows->jpeg->cinfo);
+            free(rows->jpeg);
+        }
+#endif
+#if HAVE_SPNG
+        if(rows->png) {
+            spng_ctx_free(rows->png);
+        }
+#endif
+        stbi_image_free(rows->pixels);
+        free(rows);
+    }
+}
+
+// Decodes an image a few rows at a time while halving it, as many times
+// as it can be without becoming narrower than `min_width`. Only the
+// result and a band of rows are in memory at once.
+// NOTE(easimer): the pixels are averaged before they're premultiplied,
+// so the edges of transparent areas may bleed a little
+static uint8_t* DecodeReduced(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha) {
+    uint8_t* ret = NULL;
+    int src_w, src_h;
+    
+    auto rows = Decode_OpenRows(data, size, min_width, &src_w, &src_h, has_alpha);
+    if(rows) {
+        int halvings = 0;
+        while(halvings < 16 && (src_w >> (halvings + 1)) >= (int)min_width && (src_h >> (halvings + 1)) > 0) {
+            halvings++;
+        }
+        int band = 1 << halvings;
+        int out_w = src_w >> halvings;
+        int out_h = src_h >> halvings;
+        size_t src_stride = (size_t)src_w * 4;
+        size_t out_stride = (size_t)out_w * 4;
+        // Halved back and forth between two buffers
+        auto scratch0 = (uint8_t*)malloc(src_stride * band);
+        auto scratch1 = (uint8_t*)malloc(src_stride * band / 4 + 4);
+        ret = (uint8_t*)malloc(out_stride * out_h);
+        bool ok = scratch0 && scratch1 && ret;
+        for(int y = 0; ok && y < out_h; y++) {
+            ok = Decode_ReadRows(rows, scratch0, band);
+            uint8_t* src = scratch0;
+            uint8_t* dst = scratch1;
+            unsigned lw = (unsigned)src_w, lh = (unsigned)band;
+            for(int i = 0; ok && i < halvings; i++) {
+                Pixel_Halve(src, lw, lh, dst);
+                lw /= 2;
+                lh /= 2;
+                auto tmp = src;
+                src = dst;
+                dst = tmp;
+            }
+            if(ok) {
+                memcpy(ret + out_stride * y, src, out_stride);
+            }
+        }
+        free(scratch0);
+        free(scratch1);
+        if(ok) {
+            *w = out_w;
+            *h = out_h;
+        } else {
+            free(ret);
+            ret = NULL;
+        }
+        Decode_CloseRows(rows);
+    }
+    return ret;
+}
+
+uint8_t* Decode_Image(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha) {
+    uint8_t* ret = NULL;
+    unsigned idx = 0;
+    int info_w, info_h, info_channels;
+    if(min_width > 0 && data && stbi_info_from_memory(data, (int)size, &info_w, &info_h, &info_channels) &&
+       (size_t)info_w * info_h > DECODE_MAX_WHOLE_PIXELS) {
+        ret = DecodeReduced(data, size, min_width, w, h, has_alpha);
+    }
+    while(!ret && idx < BACKEND_COUNT - 1 && !gBackends[idx].accepts(data, size)) {
+        idx++;
+    }
+    if(!ret) {
+        ret = Decode_ImageWith(idx, data, size, min_width, w, h, has_alpha);
+        if(!ret && idx != BACKEND_COUNT - 1) {
+            // Files the library can't handle, like CMYK JPEGs
+            ret = Decode_ImageWith(BACKEND_COUNT - 1, data, size, min_width, w, h, has_alpha);
+        }
+    }
+    return ret;
+}
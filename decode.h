@@ -0,0 +1,69 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Decodes image files into 8-bit RGBA pixels. Every format is decoded
+// by stb_image; faster libraries are used for some formats when present
+// was built with them (see the Makefile).
+
+// Number of decoders present was built with, including stb_image
+unsigned Decode_GetBackendCount();
+// Name of the `idx`th decoder
+const char* Decode_GetBackendName(unsigned idx);
+
+// Decodes an image file with the fastest decoder that supports it's
+// format. If that decoder fails then stb_image is tried too.
+// `min_width` is a hint: decoders that can decode an image at a smaller
+// size for free (like JPEG decoders) may return an image that's smaller
+// than the file but still at least this wide. 0 means full size.
+// `has_alpha` receives whether the file has transparent pixels.
+// Returns NULL if the file couldn't be decoded; the pixels are
+// allocated with malloc.
+uint8_t* Decode_Image(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha);
+
+// Decodes an image file with the `idx`th decoder only.
+// Returns NULL if the decoder doesn't support the file's format or the
+// file couldn't be decoded.
+uint8_t* Decode_ImageWith(unsigned idx, const uint8_t* data, size_t size, unsigned min_width, int* w, int* h,
+                          bool* has_alpha);
+
+// Images with more pixels than this are decoded a few rows at a time by
+// Decode_Image and shrunk while they're decoded, if they may be returned
+// smaller, instead of being decoded whole
+#define DECODE_MAX_WHOLE_PIXELS ((size_t)64 * 1024 * 1024)
+
+// Decodes an image a few rows at a time, top to bottom, so that images
+// too large to be held in memory can be worked on
+struct Decode_Rows;
+
+// Starts decoding an image. `min_width` is a hint like Decode_Image's;
+// `w` and `h` receive the size of the rows that will be returned.
+// JPEGs (with libjpeg) and non-interlaced PNGs (with libspng) are
+// decoded as the rows are read; other files are decoded whole here.
+// Returns NULL if the file couldn't be decoded.
+Decode_Rows* Decode_OpenRows(const uint8_t* data, size_t size, unsigned min_width, int* w, int* h, bool* has_alpha);
+
+// Decodes the next `count` rows of 8-bit RGBA pixels into `dst`.
+// Returns false if the file is broken or there are fewer rows left.
+bool Decode_ReadRows(Decode_Rows* rows, uint8_t* dst, int count);
+
+// Stops decoding; the rest of the rows don't have to be read.
+//
+// If rows is NULL, this is a no-op.
+void Decode_CloseRows(Decode_Rows* rows);
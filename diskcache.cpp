@@ -0,0 +1,353 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include "diskcache.h"
+#if _WIN32
+#define WIN32_MEAN_AND_LEAN
+#include <Windows.h>
+#include <sys/utime.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <errno.h>
+#endif
+
+#define DISK_CACHE_MAGIC "PRSPIX1"
+#define DISK_CACHE_SUFFIX ".pix"
+
+// Start of every file in the cache, followed by the pixels.
+// NOTE(easimer): the size is a multiple of 64 so the pixels of a mapped
+// file are aligned for SIMD loads.
+struct Disk_Cache_Header {
+    char magic[8];
+    uint64_t hash;
+    uint64_t size;
+    uint32_t max_width;
+    uint32_t conversion;
+    uint32_t width;
+    uint32_t height;
+    uint8_t reserved[24];
+};
+static_assert(sizeof(Disk_Cache_Header) == 64, "Disk_Cache_Header must be 64 bytes");
+
+// A file in the cache directory
+struct Disk_Cache_Entry {
+    std::string name;
+    uint64_t size;
+    int64_t mtime; // only used for ordering
+};
+
+// Protects everything below
+static std::mutex gLock;
+static bool gOpen = false;
+static std::string gDir;
+static size_t gBudget = 0;
+// Size of the files in the cache, as far as we know
+static uint64_t gBytes = 0;
+
+// Makes temporary file names unique between the threads of this process
+static std::atomic<unsigned> gTempCounter(0);
+
+#if _WIN32
+static bool DefaultDirectory(std::string* out) {
+    bool ret = false;
+    auto base = getenv("LOCALAPPDATA");
+    if(base && base[0]) {
+        *out = std::string(base) + "/present";
+        ret = true;
+    }
+    return ret;
+}
+
+static bool MakeDirectory(const std::string& path) {
+    return CreateDirectoryA(path.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+static void ListEntries(const std::string& dir, std::vector<Disk_Cache_Entry>* out) {
+    WIN32_FIND_DATAA fd;
+    auto pattern = dir + "/*" DISK_CACHE_SUFFIX;
+    HANDLE hFind = FindFirstFileA(pattern.c_str(), &fd);
+    if(hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if(!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                Disk_Cache_Entry entry;
+                entry.name = fd.cFileName;
+                entry.size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+                entry.mtime = ((int64_t)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime;
+                out->push_back(entry);
+            }
+        } while(FindNextFileA(hFind, &fd));
+        FindClose(hFind);
+    }
+}
+
+static bool ReplaceFile(const std::string& from, const std::string& to) {
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+static void TouchFile(const std::string& path) {
+    _utime(path.c_str(), NULL);
+}
+
+static unsigned ProcessId() {
+    return (unsigned)GetCurrentProcessId();
+}
+#else
+static bool DefaultDirectory(std::string* out) {
+    bool ret = false;
+    // https://specifications.freedesktop.org/basedir-spec/latest/
+    // Relative paths in the variable are invalid and must be ignored
+    auto xdg = getenv("XDG_CACHE_HOME");
+    auto home = getenv("HOME");
+    if(xdg && xdg[0] == '/') {
+        *out = std::string(xdg) + "/present";
+        ret = true;
+    } else if(home && home[0]) {
+        *out = std::string(home) + "/.cache/present";
+        ret = true;
+    }
+    return ret;
+}
+
+static bool MakeDirectory(const std::string& path) {
+    return mkdir(path.c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+static void ListEntries(const std::string& dir, std::vector<Disk_Cache_Entry>* out) {
+    auto suffix_len = strlen(DISK_CACHE_SUFFIX);
+    DIR* d = opendir(dir.c_str());
+    if(d) {
+        struct dirent* ent;
+        while((ent = readdir(d))) {
+            auto len = strlen(ent->d_name);
+            if(len > suffix_len && strcmp(ent->d_name + len - suffix_len, DISK_CACHE_SUFFIX) == 0) {
+                struct stat st;
+                auto path = dir + "/" + ent->d_name;
+                if(stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                    Disk_Cache_Entry entry;
+                    entry.name = ent->d_name;
+                    entry.size = (uint64_t)st.st_size;
+                    entry.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+                    out->push_back(entry);
+                }
+            }
+        }
+        closedir(d);
+    }
+}
+
+static bool ReplaceFile(const std::string& from, const std::string& to) {
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+static void TouchFile(const std::string& path) {
+    utime(path.c_str(), NULL);
+}
+
+static unsigned ProcessId() {
+    return (unsigned)getpid();
+}
+#endif
+
+// Creates a directory and it's missing parents
+static bool MakeDirectories(const std::string& path) {
+    for(size_t i = 1; i < path.size(); i++) {
+        if((path[i] == '/' || path[i] == '\\') && path[i - 1] != ':') {
+            // A parent may exist without us being able to create it, so
+            // only the last one counts
+            MakeDirectory(path.substr(0, i));
+        }
+    }
+    return MakeDirectory(path);
+}
+
+static std::string EntryPath(const Disk_Cache_Key& key) {
+    char name[96];
+    snprintf(name, sizeof(name), "%016llx-%llx-%x-%x" DISK_CACHE_SUFFIX,
+             (unsigned long long)key.hash, (unsigned long long)key.size,
+             key.max_width, key.conversion);
+    return gDir + "/" + name;
+}
+
+// Deletes the least recently used files until the cache is at most
+// `target` bytes large.
+// gLock must be held.
+static void Trim(uint64_t target) {
+    std::vector<Disk_Cache_Entry> entries;
+    ListEntries(gDir, &entries);
+    gBytes = 0;
+    for(auto& entry : entries) {
+        gBytes += entry.size;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Disk_Cache_Entry& lhs, const Disk_Cache_Entry& rhs) {
+        return lhs.mtime < rhs.mtime;
+    });
+    for(size_t i = 0; i < entries.size() && gBytes > target; i++) {
+        auto path = gDir + "/" + entries[i].name;
+        if(remove(path.c_str()) == 0) {
+            gBytes -= entries[i].size;
+        }
+    }
+}
+
+bool DiskCache_Open(const char* dir, size_t budget) {
+    bool ret = false;
+    std::string path;
+    if(dir) {
+        path = dir;
+    } else if(!DefaultDirectory(&path)) {
+        fprintf(stderr, "Disk cache: can't find a cache directory\n");
+    }
+    if(!path.empty()) {
+        if(MakeDirectories(path)) {
+            std::lock_guard<std::mutex> G(gLock);
+            gDir = path;
+            gBudget = budget;
+            gOpen = true;
+            Trim(gBudget);
+            ret = true;
+        } else {
+            fprintf(stderr, "Disk cache: can't create '%s'\n", path.c_str());
+        }
+    }
+    return ret;
+}
+
+void DiskCache_Close() {
+    std::lock_guard<std::mutex> G(gLock);
+    gOpen = false;
+    gDir.clear();
+    gBytes = 0;
+}
+
+bool DiskCache_Load(const Disk_Cache_Key& key, Fetch_Buffer* file,
+                    uint8_t** pixels, int* width, int* height) {
+    bool ret = false;
+    std::string path;
+    assert(file && pixels && width && height);
+    {
+        std::lock_guard<std::mutex> G(gLock);
+        if(gOpen) {
+            path = EntryPath(key);
+        }
+    }
+    if(!path.empty() && Fetch_ReadFile(path.c_str(), file)) {
+        Disk_Cache_Header hdr;
+        if(file->size >= sizeof(hdr)) {
+            memcpy(&hdr, file->data, sizeof(hdr));
+            // The name may collide or the file may be truncated
+            ret = memcmp(hdr.magic, DISK_CACHE_MAGIC, sizeof(hdr.magic)) == 0 &&
+                hdr.hash == key.hash && hdr.size == key.size &&
+                hdr.max_width == key.max_width && hdr.conversion == key.conversion &&
+                hdr.width > 0 && hdr.height > 0 &&
+                file->size == sizeof(hdr) + (uint64_t)hdr.width * hdr.height * 4;
+        }
+        if(ret) {
+            *pixels = file->data + sizeof(hdr);
+            *width = (int)hdr.width;
+            *height = (int)hdr.height;
+            // Recently used images are kept when trimming
+            TouchFile(path);
+        } else {
+            Fetch_Free(file);
+        }
+    }
+    return ret;
+}
+
+void DiskCache_Store(const Disk_Cache_Key& key, const void* pixels, int width, int height) {
+    std::string path, temp;
+    assert(pixels && width > 0 && height > 0);
+    {
+        std::lock_guard<std::mutex> G(gLock);
+        if(gOpen) {
+            path = EntryPath(key);
+        }
+    }
+    if(path.empty()) {
+        return;
+    }
+    
+    Disk_Cache_Header hdr = {};
+    memcpy(hdr.magic, DISK_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.hash = key.hash;
+    hdr.size = key.size;
+    hdr.max_width = key.max_width;
+    hdr.conversion = key.conversion;
+    hdr.width = (uint32_t)width;
+    hdr.height = (uint32_t)height;
+    size_t pixels_size = (size_t)width * height * 4;
+    
+    // Written under a temporary name first so that other instances never
+    // see a partial file
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%u-%u.tmp", ProcessId(), gTempCounter++);
+    temp = path + suffix;
+    bool written = false;
+    FILE* f = fopen(temp.c_str(), "wb");
+    if(f) {
+        written = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+            fwrite(pixels, 1, pixels_size, f) == pixels_size;
+        written = (fclose(f) == 0) && written;
+    }
+    if(written && ReplaceFile(temp, path)) {
+        std::lock_guard<std::mutex> G(gLock);
+        gBytes += sizeof(hdr) + pixels_size;
+        if(gOpen && gBytes > gBudget) {
+            // Make some room at once instead of trimming after every image
+            Trim(gBudget / 4 * 3);
+        }
+    } else {
+        remove(temp.c_str());
+    }
+}
+
+void DiskCache_Clear() {
+    std::lock_guard<std::mutex> G(gLock);
+    if(gOpen) {
+        Trim(0);
+    }
+}
+
+bool DiskCache_GetDirectory(char* out, size_t size) {
+    bool ret = false;
+    std::string path;
+    assert(out && size > 0);
+    {
+        std::lock_guard<std::mutex> G(gLock);
+        path = gDir;
+    }
+    if(path.empty() && DefaultDirectory(&path) && !MakeDirectories(path)) {
+        path.clear();
+    }
+    if(!path.empty() && path.size() < size) {
+        memcpy(out, path.c_str(), path.size() + 1);
+        ret = true;
+    }
+    return ret;
+}
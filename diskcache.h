@@ -0,0 +1,59 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "fetch.h"
+
+// Decoded images stored on disk, ready to be drawn, so that a file
+// doesn't have to be decoded again the next time it's shown.
+// Images are found by the contents of their file and by how they were
+// converted, not by their path. The least recently used images are
+// deleted once the cache grows over it's budget.
+// All functions may be called from any thread.
+
+// Identifies a decoded image
+struct Disk_Cache_Key {
+    uint64_t hash; // Hash_Bytes of the file
+    uint64_t size; // size of the file
+    uint32_t max_width; // images were shrunk to this width; 0 if not
+    uint32_t conversion; // Pixel_Conversion flags of the display
+};
+
+// Opens the cache in `dir` (created if needed), or in the default
+// directory if `dir` is NULL. Deletes old images until the cache fits
+// into `budget` bytes.
+// Returns false if the directory can't be used.
+bool DiskCache_Open(const char* dir, size_t budget);
+void DiskCache_Close();
+
+// Looks up an image. On a hit the file is mapped into memory: `file`
+// owns the mapping (free it with Fetch_Free) and `*pixels` points to
+// the pixels inside it, which mustn't be written to.
+// Returns false if the image isn't in the cache.
+bool DiskCache_Load(const Disk_Cache_Key& key, Fetch_Buffer* file,
+                    uint8_t** pixels, int* width, int* height);
+// Stores an image of 4 byte pixels. Failures are ignored, the image
+// will just be decoded again next time.
+void DiskCache_Store(const Disk_Cache_Key& key, const void* pixels, int width, int height);
+// Deletes every image in the cache
+void DiskCache_Clear();
+// Copies the directory of the cache into `out`: the one it was opened
+// in, or the default one (created if needed) if it isn't open.
+// Returns false if there's no such directory or it doesn't fit into
+// `size` bytes.
+bool DiskCache_GetDirectory(char* out, size_t size);
@@ -41,6 +41,28 @@ enum Display_Event {
     DISPEV_FOCUS,
     // User wants to execute the command line on the current slide
     DISPEV_EXEC,
+    // A file used by the presentation has changed
+    DISPEV_RELOAD,
+    // More of a streamed presentation can be read
+    DISPEV_STREAM,
+    // An image requested by the presentation has been loaded
+    DISPEV_IMAGE,
+    // User wants the image loader's statistics to be printed
+    DISPEV_STATS,
+    // The time set with Display_SetTimer has passed
+    DISPEV_TIMER,
+    // User pressed the left or right arrow key: seeks to the previous or
+    // next slide unless an image is zoomed in, which is panned instead
+    DISPEV_LEFT,
+    DISPEV_RIGHT,
+    // User wants to pan a zoomed in image up or down
+    DISPEV_UP,
+    DISPEV_DOWN,
+    // User wants to zoom in or out of the large image on the slide, or
+    // to see all of it again
+    DISPEV_ZOOM_IN,
+    DISPEV_ZOOM_OUT,
+    DISPEV_ZOOM_RESET,
     // Invalid event
     DISPEV_MAX
 };
@@ -61,12 +83,42 @@ void Display_Close(Display* display);
 // If display is NULL, this is a no-op and will return false.
 bool Display_FetchEvent(Display* display, Display_Event& out);
 
+// Makes Display_FetchEvent return `ev` when the file descriptor `fd`
+// becomes readable. The fd is not read by the display; the receiver of
+// the event must drain it.
+// Returns false if the platform doesn't support this or if there are
+// too many wakeup sources.
+bool Display_AddWakeupSource(Display* display, int fd, Display_Event ev);
+
+// Stops waking up when `fd` becomes readable.
+// Must be called before closing a descriptor passed to
+// Display_AddWakeupSource and once it has reached end-of-file.
+void Display_RemoveWakeupSource(Display* display, int fd);
+
+// Makes Display_FetchEvent return DISPEV_TIMER once, `milliseconds`
+// from now. Replaces the time set before; a negative value cancels it.
+void Display_SetTimer(Display* display, int milliseconds);
+
+// Returns the largest size in pixels the display may draw slides at.
+//
+// If display is NULL, this is a no-op.
+void Display_GetMaxSize(Display* display, int* width, int* height);
+
 // Draws a Render_Queue to the display.
 void Display_RenderQueue(Display* display, Render_Queue* rq);
 
+// Draws the part of a Render_Queue that falls into `area`; the rest of
+// the display is left as it is. Used to draw an area that changed on a
+// slide that's already shown.
+void Display_RenderQueueArea(Display* display, Render_Queue* rq, const RQ_Rect* area);
+
 // Returns whether images queued to be drawn should
 // have their red and blue channels swapped.
-// Used in present.cpp when loading an image.
+// Used in image_load.cpp when loading an image.
 bool Display_SwapRedBlueChannels();
 
+// Returns whether images queued to be drawn should have their color
+// channels multiplied by their alpha channel.
+bool Display_PremultipliedAlpha();
+
 void Display_Focus(Display* display);
\ No newline at end of file
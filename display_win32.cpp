@@ -32,6 +32,9 @@ using namespace Gdiplus;
 // WPARAM and LPARAM are always zero.
 #define WM_JUMPSTART (WM_USER + 0x0000)
 
+// Identifier of the timer set with Display_SetTimer
+#define TIMER_DISPLAY (1)
+
 #define HOTKEY_FOCUS (0)
 #define HOTKEY_FOCUS_VK (0x46) // F key
 #define HOTKEY_FOCUS_FLAGS (MOD_SHIFT | MOD_ALT)
@@ -106,19 +109,38 @@ static void ProcessRenderQueue(Display* disp, HWND hWnd, HDC hDC, const RECT* rC
                 RQ_Draw_Image* dimg = (RQ_Draw_Image*)cur;
                 int x = (int)(dimg->x * disp->s_width);
                 int y = (int)(dimg->y * disp->s_height);
-                int w = (int)(dimg->width);
-                int h = (int)(dimg->height);
+                // NOTE(easimer): measured from the edges so that images
+                // that are next to each other (like tiles) don't leave gaps
+                int destW = (int)((dimg->x + dimg->w) * disp->s_width) - x;
+                int destH = (int)((dimg->y + dimg->h) * disp->s_height) - y;
+                // Stretching a smaller level is faster and looks the same
+                auto level = RQ_PickImageLevel(dimg, (float)destW, (float)destH);
+                int w = level.width;
+                int h = level.height;
                 // upload image to GDI
-                BITMAPINFO bmpinf = {0};
+                // NOTE(easimer): 16-bit DIBs need the masks of the
+                // channels right after the header
+                struct {
+                    BITMAPINFOHEADER bmiHeader;
+                    DWORD masks[3];
+                } bmpinf = {0};
                 //memset(bmpinf, 0, sizeof(bmpinf));
                 bmpinf.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-                bmpinf.bmiHeader.biWidth = dimg->width;
-                bmpinf.bmiHeader.biHeight = -dimg->height;
+                bmpinf.bmiHeader.biWidth = w;
+                bmpinf.bmiHeader.biHeight = -h;
                 bmpinf.bmiHeader.biPlanes = 1;
-                bmpinf.bmiHeader.biBitCount = 32;
-                bmpinf.bmiHeader.biCompression = BI_RGB;
+                if(dimg->format == PIXFMT_RGB16_565) {
+                    bmpinf.bmiHeader.biBitCount = 16;
+                    bmpinf.bmiHeader.biCompression = BI_BITFIELDS;
+                    bmpinf.masks[0] = 0xF800;
+                    bmpinf.masks[1] = 0x07E0;
+                    bmpinf.masks[2] = 0x001F;
+                } else {
+                    bmpinf.bmiHeader.biBitCount = 32;
+                    bmpinf.bmiHeader.biCompression = BI_RGB;
+                }
                 void* buffer = NULL;
-                HBITMAP hDib = CreateDIBSection(hDC, &bmpinf,
+                HBITMAP hDib = CreateDIBSection(hDC, (BITMAPINFO*)&bmpinf,
                                                 DIB_RGB_COLORS, &buffer,
                                                 0, 0);
                 if(buffer == NULL) {
@@ -127,18 +149,14 @@ static void ProcessRenderQueue(Display* disp, HWND hWnd, HDC hDC, const RECT* rC
                 HDC hDibDC = CreateCompatibleDC(hDC);
                 SelectObject(hDibDC, hDib);
                 
-                // TODO(easimer): what about stride?
-                memcpy(buffer, dimg->buffer, dimg->width * dimg->height * 4);
-                
-                (void)x, (void)y, (void)w, (void)h;
+                // DIB rows start at 4 byte boundaries, like the loaded images'
+                memcpy(buffer, level.buffer, Pixel_Stride(dimg->format, w) * h);
                 
                 SetStretchBltMode(hDC, HALFTONE);
-                float aspect = dimg->h / dimg->w;
-                int destW = (int)(disp->s_width * dimg->w);
-                int destH = (int)(disp->s_height * aspect);
-                StretchBlt(hDC, x, y, destW, destH, hDibDC, 0, 0, dimg->width, dimg->height, SRCCOPY);
+                StretchBlt(hDC, x, y, destW, destH, hDibDC, 0, 0, w, h, SRCCOPY);
 
-                ReleaseDC(disp->wnd, hDibDC);
+                DeleteDC(hDibDC);
+                DeleteObject(hDib);
                 break;
             }
             case RQCMD_DRAW_RECTANGLE: {
@@ -158,6 +176,17 @@ static void ProcessRenderQueue(Display* disp, HWND hWnd, HDC hDC, const RECT* rC
                 DeleteObject(brRect);
                 break;
             }
+            case RQCMD_PUSH_CLIP: {
+                RQ_Push_Clip* clip = (RQ_Push_Clip*)cur;
+                SaveDC(hDC);
+                IntersectClipRect(hDC, (int)(clip->area.x0 * disp->s_width), (int)(clip->area.y0 * disp->s_height),
+                                  (int)(clip->area.x1 * disp->s_width), (int)(clip->area.y1 * disp->s_height));
+                break;
+            }
+            case RQCMD_POP_CLIP: {
+                RestoreDC(hDC, -1);
+                break;
+            }
             default: {
                 fprintf(stderr, "Unknown render command type '%d'\n", cur->cmd);
                 break;
@@ -207,12 +236,31 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
                 disp->ev_res = true;
                 switch (wParam) {
                     case VK_LEFT:
-                    *disp->ev_out = DISPEV_PREV;
+                    *disp->ev_out = DISPEV_LEFT;
                     break;
                     case VK_RIGHT:
+                    *disp->ev_out = DISPEV_RIGHT;
+                    break;
+                    case VK_UP:
+                    *disp->ev_out = DISPEV_UP;
+                    break;
+                    case VK_DOWN:
+                    *disp->ev_out = DISPEV_DOWN;
+                    break;
                     case VK_SPACE:
                     *disp->ev_out = DISPEV_NEXT;
                     break;
+                    case VK_ADD:
+                    case VK_OEM_PLUS:
+                    *disp->ev_out = DISPEV_ZOOM_IN;
+                    break;
+                    case VK_SUBTRACT:
+                    case VK_OEM_MINUS:
+                    *disp->ev_out = DISPEV_ZOOM_OUT;
+                    break;
+                    case '0':
+                    *disp->ev_out = DISPEV_ZOOM_RESET;
+                    break;
                     case VK_PRIOR:
                     *disp->ev_out = DISPEV_START;
                     break;
@@ -232,6 +280,13 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
             }
             break;
         }
+        case WM_MOUSEWHEEL: {
+            if(disp->ev_out) {
+                disp->ev_res = true;
+                *disp->ev_out = GET_WHEEL_DELTA_WPARAM(wParam) > 0 ? DISPEV_ZOOM_IN : DISPEV_ZOOM_OUT;
+            }
+            return 0;
+        }
         case WM_SIZE: {
             if(disp->ev_out) {
                 disp->ev_res = true;
@@ -241,6 +296,18 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
             disp->s_height = HIWORD(lParam);
             break;
         }
+        case WM_TIMER: {
+            if(wParam == TIMER_DISPLAY) {
+                // The timer fires once
+                KillTimer(hWnd, TIMER_DISPLAY);
+                if(disp->ev_out) {
+                    disp->ev_res = true;
+                    *disp->ev_out = DISPEV_TIMER;
+                }
+                return 0;
+            }
+            break;
+        }
         case WM_JUMPSTART: {
             if(disp->ev_out) {
                 disp->ev_res = true;
@@ -379,6 +446,37 @@ bool Display_FetchEvent(Display* disp, Display_Event& out) {
     return ret;
 }
 
+bool Display_AddWakeupSource(Display* display, int fd, Display_Event ev) {
+    // NOTE(easimer): GetMessageA only waits for window messages, so
+    // there are no wakeup sources on Windows. Callers fall back to
+    // waiting for images, polling streams on a timer and not watching
+    // files.
+    return false;
+}
+
+void Display_RemoveWakeupSource(Display* display, int fd) {
+}
+
+void Display_SetTimer(Display* disp, int milliseconds) {
+    if(disp) {
+        if(milliseconds >= 0) {
+            // NOTE(easimer): SetTimer rounds times shorter than
+            // USER_TIMER_MINIMUM up to it
+            SetTimer(disp->wnd, TIMER_DISPLAY, (UINT)milliseconds, NULL);
+        } else {
+            KillTimer(disp->wnd, TIMER_DISPLAY);
+        }
+    }
+}
+
+void Display_GetMaxSize(Display* disp, int* width, int* height) {
+    if(disp) {
+        // The window covers the whole monitor
+        *width = (int)disp->s_width;
+        *height = (int)disp->s_height;
+    }
+}
+
 void Display_RenderQueue(Display* disp, Render_Queue* rq) {
     MSG msg = {0};
     
@@ -391,10 +489,31 @@ void Display_RenderQueue(Display* disp, Render_Queue* rq) {
     }
 }
 
+void Display_RenderQueueArea(Display* disp, Render_Queue* rq, const RQ_Rect* area) {
+    if(disp && rq && area) {
+        RECT r;
+        r.left = (LONG)(area->x0 * disp->s_width);
+        r.top = (LONG)(area->y0 * disp->s_height);
+        r.right = (LONG)(area->x1 * disp->s_width + 0.999f);
+        r.bottom = (LONG)(area->y1 * disp->s_height + 0.999f);
+        assert(!disp->rq);
+        disp->rq = rq;
+        // BeginPaint clips drawing to the invalidated rectangle
+        InvalidateRect(disp->wnd, &r, FALSE);
+        UpdateWindow(disp->wnd);
+        disp->rq = NULL;
+    }
+}
+
 bool Display_SwapRedBlueChannels() {
     return true;
 }
 
+bool Display_PremultipliedAlpha() {
+    // Images are blitted with SRCCOPY, alpha is ignored
+    return false;
+}
+
 void Display_Focus(Display* display) {
     if(!display) {
         return;
@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <poll.h>
+#include <time.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 #include <xcb/xcb_ewmh.h>
@@ -25,6 +27,13 @@
 #include <cairo-xcb.h>
 #include "display.h"
 
+#define DISPLAY_MAX_WAKEUP_SOURCES (8)
+
+struct Display_Wakeup_Source {
+    int fd;
+    Display_Event ev;
+};
+
 struct Display {
     xcb_connection_t* conn;
     xcb_screen_t* scr;
@@ -35,8 +44,24 @@ struct Display {
     
     cairo_surface_t* surf;
     cairo_t* cr;
+    
+    Display_Wakeup_Source wakeup[DISPLAY_MAX_WAKEUP_SOURCES];
+    unsigned wakeup_count;
+    
+    // Time set with Display_SetTimer on the monotonic clock, in
+    // milliseconds; negative if there's none
+    long long timer;
 };
 
+// Returned by WaitForInput when the timer has expired
+#define WAIT_TIMER (-2)
+
+static long long Milliseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 static xcb_visualtype_t *FindVisual(xcb_connection_t *c, xcb_visualid_t visual)
 {
     xcb_screen_iterator_t screen_iter = xcb_setup_roots_iterator(xcb_get_setup(c));
@@ -122,6 +147,8 @@ Display* Display_Open() {
         
         ret->surf = cairo_xcb_surface_create(conn, wnd, visual, ret->s_width, ret->s_height);
         ret->cr = cairo_create(ret->surf);
+        ret->wakeup_count = 0;
+        ret->timer = -1;
     }
     
     return ret;
@@ -141,12 +168,108 @@ void Display_Close(Display* disp) {
     }
 }
 
+bool Display_AddWakeupSource(Display* disp, int fd, Display_Event ev) {
+    bool ret = false;
+    assert(disp && fd >= 0);
+    if(disp && fd >= 0 && disp->wakeup_count < DISPLAY_MAX_WAKEUP_SOURCES) {
+        disp->wakeup[disp->wakeup_count].fd = fd;
+        disp->wakeup[disp->wakeup_count].ev = ev;
+        disp->wakeup_count++;
+        ret = true;
+    }
+    return ret;
+}
+
+void Display_RemoveWakeupSource(Display* disp, int fd) {
+    assert(disp);
+    if(disp) {
+        for(unsigned i = 0; i < disp->wakeup_count; i++) {
+            if(disp->wakeup[i].fd == fd) {
+                disp->wakeup[i] = disp->wakeup[disp->wakeup_count - 1];
+                disp->wakeup_count--;
+                break;
+            }
+        }
+    }
+}
+
+void Display_SetTimer(Display* disp, int milliseconds) {
+    assert(disp);
+    if(disp) {
+        disp->timer = milliseconds >= 0 ? Milliseconds() + milliseconds : -1;
+    }
+}
+
+void Display_GetMaxSize(Display* disp, int* width, int* height) {
+    assert(disp && width && height);
+    if(disp) {
+        // The window goes fullscreen, but it may not have done so yet
+        *width = disp->s_width > disp->scr->width_in_pixels ? disp->s_width : disp->scr->width_in_pixels;
+        *height = disp->s_height > disp->scr->height_in_pixels ? disp->s_height : disp->scr->height_in_pixels;
+    }
+}
+
+// Blocks until either the X connection or one of the wakeup sources
+// becomes readable, or the timer expires. Returns the index of the first
+// readable wakeup source, WAIT_TIMER or -1 if the X connection should be
+// read.
+static int WaitForInput(Display* disp) {
+    int ret = -1;
+    pollfd fds[1 + DISPLAY_MAX_WAKEUP_SOURCES];
+    int timeout = -1;
+    int res;
+    
+    fds[0].fd = xcb_get_file_descriptor(disp->conn);
+    fds[0].events = POLLIN;
+    for(unsigned i = 0; i < disp->wakeup_count; i++) {
+        fds[1 + i].fd = disp->wakeup[i].fd;
+        fds[1 + i].events = POLLIN;
+    }
+    
+    if(disp->timer >= 0) {
+        long long left = disp->timer - Milliseconds();
+        timeout = left > 0 ? (int)left : 0;
+    }
+    
+    res = poll(fds, 1 + disp->wakeup_count, timeout);
+    if(res > 0 && !fds[0].revents) {
+        // User input is handled first
+        for(unsigned i = 0; i < disp->wakeup_count && ret == -1; i++) {
+            if(fds[1 + i].revents) {
+                ret = i;
+            }
+        }
+    } else if(res == 0) {
+        disp->timer = -1;
+        ret = WAIT_TIMER;
+    }
+    
+    return ret;
+}
+
 bool Display_FetchEvent(Display* disp, Display_Event& out) {
     bool ret = false;
     xcb_generic_event_t *e;
     assert(disp && disp->conn);
     if(disp) {
-        e = xcb_wait_for_event(disp->conn);
+        if(xcb_connection_has_error(disp->conn)) {
+            out = DISPEV_EXIT;
+            return true;
+        }
+        
+        e = xcb_poll_for_event(disp->conn);
+        if(!e) {
+            int src = WaitForInput(disp);
+            if(src >= 0) {
+                out = disp->wakeup[src].ev;
+                return true;
+            }
+            if(src == WAIT_TIMER) {
+                out = DISPEV_TIMER;
+                return true;
+            }
+            e = xcb_poll_for_event(disp->conn);
+        }
         if(e) {
             switch(e->response_type & ~0x80) {
                 case XCB_CONFIGURE_NOTIFY: {
@@ -167,6 +290,10 @@ bool Display_FetchEvent(Display* disp, Display_Event& out) {
                         out = DISPEV_NEXT;
                     } else if(ev->detail == 3) {
                         out = DISPEV_PREV;
+                    } else if(ev->detail == 4) { // wheel up
+                        out = DISPEV_ZOOM_IN;
+                    } else if(ev->detail == 5) { // wheel down
+                        out = DISPEV_ZOOM_OUT;
                     } else {
                         ret = false;
                     }
@@ -180,11 +307,30 @@ bool Display_FetchEvent(Display* disp, Display_Event& out) {
                         out = DISPEV_EXIT;
                         break;
                         case 65: // SPACE
-                        case 114: // right cursor
                         out = DISPEV_NEXT;
                         break;
+                        case 114: // right cursor
+                        out = DISPEV_RIGHT;
+                        break;
                         case 113: // left cursor
-                        out = DISPEV_PREV;
+                        out = DISPEV_LEFT;
+                        break;
+                        case 111: // up cursor
+                        out = DISPEV_UP;
+                        break;
+                        case 116: // down cursor
+                        out = DISPEV_DOWN;
+                        break;
+                        case 21: // = and +
+                        case 86: // keypad +
+                        out = DISPEV_ZOOM_IN;
+                        break;
+                        case 20: // -
+                        case 82: // keypad -
+                        out = DISPEV_ZOOM_OUT;
+                        break;
+                        case 19: // 0
+                        out = DISPEV_ZOOM_RESET;
                         break;
                         case 112: // Page up
                         out = DISPEV_START;
@@ -208,66 +354,120 @@ bool Display_FetchEvent(Display* disp, Display_Event& out) {
     return ret;
 }
 
-void Display_RenderQueue(Display* disp, Render_Queue* rq) {
-    assert(disp && rq && disp->conn);
-    if(disp && rq && disp->conn) {
-        auto hCur = rq->commands;
-        
-        // setup text drawing
-        cairo_select_font_face(disp->cr, "serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-        cairo_set_source_rgb(disp->cr, 0, 0, 0);
-        
-        while(hCur != MEM_ARENA_INVALID_OFFSET) {
-            auto* cur = (RQ_Draw_Cmd*)Arena_Resolve(rq->mem, hCur);
-            switch(cur->cmd) {
-                case RQCMD_DRAW_TEXT: {
-                    RQ_Draw_Text* dtxt = (RQ_Draw_Text*)cur;
-                    const char* font_name = dtxt->font_name ? dtxt->font_name : "sans-serif";
-                    cairo_select_font_face(disp->cr, font_name, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-                    cairo_set_font_size(disp->cr, dtxt->size * disp->s_height);
-                    cairo_move_to(disp->cr, dtxt->x * disp->s_width, dtxt->y * disp->s_height);
-                    cairo_set_source_rgba(disp->cr, dtxt->color.r, dtxt->color.g, dtxt->color.b, dtxt->color.a);
-                    cairo_show_text(disp->cr, dtxt->text);
-                    break;
+static void DrawQueue(Display* disp, Render_Queue* rq) {
+    auto hCur = rq->commands;
+    
+    // setup text drawing
+    cairo_select_font_face(disp->cr, "serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_source_rgb(disp->cr, 0, 0, 0);
+    
+    while(hCur != MEM_ARENA_INVALID_OFFSET) {
+        auto* cur = (RQ_Draw_Cmd*)Arena_Resolve(rq->mem, hCur);
+        switch(cur->cmd) {
+            case RQCMD_DRAW_TEXT: {
+                RQ_Draw_Text* dtxt = (RQ_Draw_Text*)cur;
+                const char* font_name = dtxt->font_name ? dtxt->font_name : "sans-serif";
+                cairo_select_font_face(disp->cr, font_name, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+                cairo_set_font_size(disp->cr, dtxt->size * disp->s_height);
+                cairo_move_to(disp->cr, dtxt->x * disp->s_width, dtxt->y * disp->s_height);
+                cairo_set_source_rgba(disp->cr, dtxt->color.r, dtxt->color.g, dtxt->color.b, dtxt->color.a);
+                cairo_show_text(disp->cr, dtxt->text);
+                break;
+            }
+            case RQCMD_DRAW_IMAGE: {
+                RQ_Draw_Image* dimg = (RQ_Draw_Image*)cur;
+                cairo_surface_t* imgsurf;
+                cairo_save(disp->cr);
+                float dest_width = dimg->w * disp->s_width;
+                float dest_height = dimg->h * disp->s_height;
+                auto level = RQ_PickImageLevel(dimg, dest_width, dest_height);
+                cairo_format_t format = CAIRO_FORMAT_ARGB32;
+                switch(dimg->format) {
+                    case PIXFMT_RGB24: format = CAIRO_FORMAT_RGB24; break;
+                    case PIXFMT_RGB16_565: format = CAIRO_FORMAT_RGB16_565; break;
+                    default: break;
                 }
-                case RQCMD_DRAW_IMAGE: {
-                    RQ_Draw_Image* dimg = (RQ_Draw_Image*)cur;
-                    cairo_surface_t* imgsurf;
-                    cairo_save(disp->cr);
-                    imgsurf = cairo_image_surface_create_for_data(
-                                                                  (unsigned char*)dimg->buffer,
-                                                                  CAIRO_FORMAT_ARGB32,
-                                                                  dimg->width, dimg->height,
-                                                                  dimg->width * 4);
-                    float dest_width = dimg->w * disp->s_width;
-                    float dest_height = dimg->h * disp->s_height;
-                    float scale_x = dest_width / dimg->width;
-                    float scale_y = dest_height / dimg->height;
-                    cairo_translate(disp->cr, dimg->x * disp->s_width, dimg->y * disp->s_height);
-                    cairo_scale(disp->cr, scale_x, scale_y);
-                    cairo_set_source_surface(disp->cr, imgsurf, 0, 0);
+                imgsurf = cairo_image_surface_create_for_data(
+                                                              (unsigned char*)level.buffer,
+                                                              format,
+                                                              level.width, level.height,
+                                                              (int)Pixel_Stride(dimg->format, level.width));
+                float scale_x = dest_width / level.width;
+                float scale_y = dest_height / level.height;
+                cairo_translate(disp->cr, dimg->x * disp->s_width, dimg->y * disp->s_height);
+                cairo_scale(disp->cr, scale_x, scale_y);
+                cairo_set_source_surface(disp->cr, imgsurf, 0, 0);
+                if(format == CAIRO_FORMAT_ARGB32) {
                     cairo_paint(disp->cr);
-                    cairo_surface_destroy(imgsurf);
-                    cairo_restore(disp->cr);
-                    break;
-                }
-                case RQCMD_DRAW_RECTANGLE: {
-                    RQ_Draw_Rect* drect = (RQ_Draw_Rect*)cur;
-                    int x, y, w, h;
-                    x = drect->x0 * disp->s_width;
-                    y = drect->y0 * disp->s_height;
-                    w = drect->x1 * disp->s_width - x;
-                    h = drect->y1 * disp->s_height - y;
-                    cairo_set_source_rgba(disp->cr, drect->color.r, drect->color.g, drect->color.b, drect->color.a);
-                    cairo_rectangle(disp->cr, x, y, w, h);
+                } else {
+                    // Opaque images replace what's under them instead
+                    // of being blended with it. SOURCE would clear
+                    // everything outside the image too, so only the
+                    // image's rectangle is filled, and the edge pixels
+                    // are repeated so that they aren't blended with
+                    // transparent ones when the image is scaled.
+                    cairo_pattern_set_extend(cairo_get_source(disp->cr), CAIRO_EXTEND_PAD);
+                    cairo_set_operator(disp->cr, CAIRO_OPERATOR_SOURCE);
+                    cairo_rectangle(disp->cr, 0, 0, level.width, level.height);
                     cairo_fill(disp->cr);
-                    break;
                 }
-                default:
+                cairo_surface_destroy(imgsurf);
+                cairo_restore(disp->cr);
                 break;
             }
-            hCur = cur->next;
+            case RQCMD_DRAW_RECTANGLE: {
+                RQ_Draw_Rect* drect = (RQ_Draw_Rect*)cur;
+                int x, y, w, h;
+                x = drect->x0 * disp->s_width;
+                y = drect->y0 * disp->s_height;
+                w = drect->x1 * disp->s_width - x;
+                h = drect->y1 * disp->s_height - y;
+                cairo_set_source_rgba(disp->cr, drect->color.r, drect->color.g, drect->color.b, drect->color.a);
+                cairo_rectangle(disp->cr, x, y, w, h);
+                cairo_fill(disp->cr);
+                break;
+            }
+            case RQCMD_PUSH_CLIP: {
+                RQ_Push_Clip* clip = (RQ_Push_Clip*)cur;
+                float x0 = clip->area.x0 * disp->s_width;
+                float y0 = clip->area.y0 * disp->s_height;
+                cairo_save(disp->cr);
+                cairo_rectangle(disp->cr, x0, y0, clip->area.x1 * disp->s_width - x0, clip->area.y1 * disp->s_height - y0);
+                cairo_clip(disp->cr);
+                break;
+            }
+            case RQCMD_POP_CLIP:
+            cairo_restore(disp->cr);
+            break;
+            default:
+            break;
         }
+        hCur = cur->next;
+    }
+}
+
+void Display_RenderQueue(Display* disp, Render_Queue* rq) {
+    assert(disp && rq && disp->conn);
+    if(disp && rq && disp->conn) {
+        DrawQueue(disp, rq);
+        cairo_surface_flush(disp->surf);
+        xcb_flush(disp->conn);
+    }
+}
+
+void Display_RenderQueueArea(Display* disp, Render_Queue* rq, const RQ_Rect* area) {
+    assert(disp && rq && area && disp->conn);
+    if(disp && rq && area && disp->conn) {
+        // Whole pixels that cover the area
+        int x0 = (int)(area->x0 * disp->s_width);
+        int y0 = (int)(area->y0 * disp->s_height);
+        int x1 = (int)(area->x1 * disp->s_width + 0.999f);
+        int y1 = (int)(area->y1 * disp->s_height + 0.999f);
+        cairo_save(disp->cr);
+        cairo_rectangle(disp->cr, x0, y0, x1 - x0, y1 - y0);
+        cairo_clip(disp->cr);
+        DrawQueue(disp, rq);
+        cairo_restore(disp->cr);
         cairo_surface_flush(disp->surf);
         xcb_flush(disp->conn);
     }
@@ -277,6 +477,11 @@ bool Display_SwapRedBlueChannels() {
     return true;
 }
 
+bool Display_PremultipliedAlpha() {
+    // CAIRO_FORMAT_ARGB32 is premultiplied
+    return true;
+}
+
 void Display_Focus(Display* display) {
     // TODO(danielm): implement
 }
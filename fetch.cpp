@@ -0,0 +1,516 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "fetch.h"
+
+#if _WIN32
+#include <Windows.h>
+#include <sys/stat.h>
+
+bool Fetch_ReadFile(const char* path, Fetch_Buffer* out) {
+    bool ret = false;
+    assert(path && out);
+    out->data = NULL;
+    out->size = 0;
+    out->mapped = false;
+    FILE* f = fopen(path, "rb");
+    if(f) {
+        struct _stat64 st;
+        if(_fstat64(_fileno(f), &st) == 0 && st.st_size > 0) {
+            out->data = (uint8_t*)malloc((size_t)st.st_size);
+            if(out->data && fread(out->data, 1, (size_t)st.st_size, f) == (size_t)st.st_size) {
+                out->size = (size_t)st.st_size;
+                ret = true;
+            } else {
+                free(out->data);
+                out->data = NULL;
+            }
+        }
+        fclose(f);
+    }
+    return ret;
+}
+
+void Fetch_Free(Fetch_Buffer* buf) {
+    if(buf && buf->data) {
+        free(buf->data);
+        buf->data = NULL;
+        buf->size = 0;
+    }
+}
+
+// Same layout as WIN32_MEMORY_RANGE_ENTRY, which older SDKs only declare
+// when targeting Windows 8
+struct Prefetch_Range {
+    void* address;
+    size_t size;
+};
+typedef BOOL(WINAPI* Prefetch_Virtual_Memory)(HANDLE, ULONG_PTR, Prefetch_Range*, ULONG);
+
+void Fetch_Advise(const char* path) {
+    assert(path);
+    // NOTE(easimer): PrefetchVirtualMemory is looked up at runtime since
+    // Windows 7 doesn't have it; there the hint does nothing
+    static auto prefetch = (Prefetch_Virtual_Memory)GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+    if(prefetch) {
+        auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if(file != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER size;
+            if(GetFileSizeEx(file, &size) && size.QuadPart > 0 && (uint64_t)size.QuadPart <= SIZE_MAX) {
+                auto mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                if(mapping) {
+                    auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    if(view) {
+                        // Starts reading without waiting for it; the pages
+                        // stay in the standby list after the view is unmapped
+                        Prefetch_Range range = { view, (size_t)size.QuadPart };
+                        prefetch(GetCurrentProcess(), 1, &range, 0);
+                        UnmapViewOfFile(view);
+                    }
+                    CloseHandle(mapping);
+                }
+            }
+            CloseHandle(file);
+        }
+    }
+}
+
+uint64_t Fetch_DiskOrder(const char* path) {
+    (void)path;
+    return 0;
+}
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#if __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+// Opens a file for reading and returns it's size in `size`.
+// Returns -1 on failure or if the file is empty.
+static int OpenFile(const char* path, size_t* size) {
+    int ret = open(path, O_RDONLY | O_CLOEXEC);
+    if(ret != -1) {
+        struct stat st;
+        if(fstat(ret, &st) != 0 || st.st_size <= 0) {
+            close(ret);
+            ret = -1;
+        } else {
+            *size = (size_t)st.st_size;
+        }
+    }
+    return ret;
+}
+
+// Reads `size` bytes, retrying after short reads.
+// Returns false on failure.
+static bool ReadAll(int fd, uint8_t* buf, size_t size) {
+    size_t done = 0;
+    while(done < size) {
+        auto res = read(fd, buf + done, size - done);
+        if(res > 0) {
+            done += res;
+        } else if(res == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    return done == size;
+}
+
+bool Fetch_ReadFile(const char* path, Fetch_Buffer* out) {
+    bool ret = false;
+    size_t size = 0;
+    assert(path && out);
+    out->data = NULL;
+    out->size = 0;
+    out->mapped = false;
+    int fd = OpenFile(path, &size);
+    if(fd != -1) {
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        // Read the whole file now, not when it's pages are touched
+        flags |= MAP_POPULATE;
+#endif
+        void* mapping = mmap(NULL, size, PROT_READ, flags, fd, 0);
+        if(mapping != MAP_FAILED) {
+            out->data = (uint8_t*)mapping;
+            out->mapped = true;
+            ret = true;
+        } else {
+            // Some file systems can't be mapped
+            out->data = (uint8_t*)malloc(size);
+            if(out->data && ReadAll(fd, out->data, size)) {
+                ret = true;
+            } else {
+                free(out->data);
+                out->data = NULL;
+            }
+        }
+        if(ret) {
+            out->size = size;
+        }
+        close(fd);
+    }
+    return ret;
+}
+
+void Fetch_Free(Fetch_Buffer* buf) {
+    if(buf && buf->data) {
+        if(buf->mapped) {
+            munmap(buf->data, buf->size);
+        } else {
+            free(buf->data);
+        }
+        buf->data = NULL;
+        buf->size = 0;
+        buf->mapped = false;
+    }
+}
+
+void Fetch_Advise(const char* path) {
+    assert(path);
+    size_t size;
+    int fd = OpenFile(path, &size);
+    if(fd != -1) {
+        // Starts reading without waiting for it; the pages stay in the
+        // page cache after the file is closed
+        posix_fadvise(fd, 0, (off_t)size, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+uint64_t Fetch_DiskOrder(const char* path) {
+    uint64_t ret = UINT64_MAX;
+    assert(path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd != -1) {
+        struct stat st;
+        if(fstat(fd, &st) == 0) {
+            ret = (uint64_t)st.st_ino;
+        }
+#if __linux__
+        // Where the first extent of the file is on the disk
+        uint64_t buf[(sizeof(fiemap) + sizeof(fiemap_extent)) / sizeof(uint64_t) + 1] = {};
+        auto map = (fiemap*)buf;
+        map->fm_length = FIEMAP_MAX_OFFSET;
+        map->fm_extent_count = 1;
+        if(ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents == 1 &&
+           !(map->fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN)) {
+            ret = map->fm_extents[0].fe_physical;
+        }
+#endif
+        close(fd);
+    }
+    return ret;
+}
+#endif
+
+#if __linux__
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// A read or a poll in progress
+struct Fetch_Op {
+    void* user;
+    bool poll;
+    int fd;
+    Fetch_Buffer buf;
+    size_t done; // bytes read so far
+    struct iovec iov;
+};
+
+struct Fetch_Ring {
+    int fd;
+    unsigned depth;
+    unsigned in_progress;
+    
+    // Submission queue
+    void* sq_ring;
+    size_t sq_ring_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+    
+    // Completion queue; may share the mapping of the submission queue
+    void* cq_ring;
+    size_t cq_ring_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+};
+
+static int RingSetup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int RingEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+Fetch_Ring* Fetch_CreateRing(unsigned depth) {
+    Fetch_Ring* ret = NULL;
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    
+    assert(depth > 0);
+    // Room for a poll too
+    int fd = RingSetup(depth + 1, &params);
+    if(fd != -1) {
+        ret = (Fetch_Ring*)calloc(1, sizeof(Fetch_Ring));
+        ret->fd = fd;
+        ret->depth = depth + 1;
+        ret->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ret->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap) {
+            if(ret->cq_ring_size > ret->sq_ring_size) {
+                ret->sq_ring_size = ret->cq_ring_size;
+            }
+            ret->cq_ring_size = ret->sq_ring_size;
+        }
+        ret->sq_ring = mmap(NULL, ret->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        ret->cq_ring = ret->sq_ring;
+        if(ret->sq_ring != MAP_FAILED && !single_mmap) {
+            ret->cq_ring = mmap(NULL, ret->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        }
+        ret->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        ret->sqes = (io_uring_sqe*)mmap(NULL, ret->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        
+        if(ret->sq_ring == MAP_FAILED || ret->cq_ring == MAP_FAILED || ret->sqes == MAP_FAILED) {
+            if(ret->sqes != MAP_FAILED) {
+                munmap(ret->sqes, ret->sqes_size);
+            }
+            if(ret->cq_ring != MAP_FAILED && ret->cq_ring != ret->sq_ring) {
+                munmap(ret->cq_ring, ret->cq_ring_size);
+            }
+            if(ret->sq_ring != MAP_FAILED) {
+                munmap(ret->sq_ring, ret->sq_ring_size);
+            }
+            close(fd);
+            free(ret);
+            ret = NULL;
+        } else {
+            auto sq = (uint8_t*)ret->sq_ring;
+            ret->sq_head = (unsigned*)(sq + params.sq_off.head);
+            ret->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+            ret->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+            ret->sq_array = (unsigned*)(sq + params.sq_off.array);
+            auto cq = (uint8_t*)ret->cq_ring;
+            ret->cq_head = (unsigned*)(cq + params.cq_off.head);
+            ret->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+            ret->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+            ret->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        }
+    }
+    
+    return ret;
+}
+
+// Queues a request on the ring and submits it to the kernel
+static bool Submit(Fetch_Ring* ring, Fetch_Op* op) {
+    bool ret = false;
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if(tail - head <= *ring->sq_mask) {
+        unsigned idx = tail & *ring->sq_mask;
+        auto sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = op->fd;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        if(op->poll) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll_events = POLLIN;
+        } else {
+            // NOTE(easimer): READV is older than READ (5.1 vs 5.6)
+            op->iov.iov_base = op->buf.data + op->done;
+            op->iov.iov_len = op->buf.size - op->done;
+            sqe->opcode = IORING_OP_READV;
+            sqe->addr = (uint64_t)(uintptr_t)&op->iov;
+            sqe->len = 1;
+            sqe->off = op->done;
+        }
+        ring->sq_array[idx] = idx;
+        __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        int res;
+        do {
+            res = RingEnter(ring->fd, 1, 0, 0);
+        } while(res < 0 && errno == EINTR);
+        ret = res >= 0;
+        if(!ret) {
+            // The kernel didn't take it; take it back
+            __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    return ret;
+}
+
+bool Fetch_StartRead(Fetch_Ring* ring, const char* path, void* user) {
+    bool ret = false;
+    size_t size = 0;
+    assert(ring && path);
+    if(ring && ring->in_progress < ring->depth) {
+        int fd = OpenFile(path, &size);
+        if(fd != -1) {
+            auto op = new Fetch_Op;
+            op->user = user;
+            op->poll = false;
+            op->fd = fd;
+            op->buf.data = (uint8_t*)malloc(size);
+            op->buf.size = size;
+            op->buf.mapped = false;
+            op->done = 0;
+            if(op->buf.data && Submit(ring, op)) {
+                ring->in_progress++;
+                ret = true;
+            } else {
+                free(op->buf.data);
+                close(fd);
+                delete op;
+            }
+        }
+    }
+    return ret;
+}
+
+bool Fetch_StartPoll(Fetch_Ring* ring, int fd, void* user) {
+    bool ret = false;
+    assert(ring && fd >= 0);
+    if(ring && ring->in_progress < ring->depth) {
+        auto op = new Fetch_Op;
+        op->user = user;
+        op->poll = true;
+        op->fd = fd;
+        op->buf = {NULL, 0, false};
+        op->done = 0;
+        if(Submit(ring, op)) {
+            ring->in_progress++;
+            ret = true;
+        } else {
+            delete op;
+        }
+    }
+    return ret;
+}
+
+unsigned Fetch_InProgress(Fetch_Ring* ring) {
+    return ring ? ring->in_progress : 0;
+}
+
+// Waits for the next completion
+static void WaitCompletion(Fetch_Ring* ring, io_uring_cqe* out) {
+    while(true) {
+        unsigned head = *ring->cq_head;
+        if(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            *out = ring->cqes[head & *ring->cq_mask];
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            break;
+        }
+        RingEnter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+    }
+}
+
+void* Fetch_Wait(Fetch_Ring* ring, Fetch_Buffer* out) {
+    void* ret = NULL;
+    io_uring_cqe cqe;
+    assert(ring && out);
+    
+    *out = {NULL, 0, false};
+    while(ring && ring->in_progress > 0 && !ret) {
+        WaitCompletion(ring, &cqe);
+        auto op = (Fetch_Op*)(uintptr_t)cqe.user_data;
+        bool finished = true;
+        if(!op->poll) {
+            if(cqe.res > 0) {
+                op->done += cqe.res;
+            }
+            if(cqe.res > 0 && op->done < op->buf.size) {
+                // Short read, read the rest
+                finished = !Submit(ring, op);
+            }
+            if(finished) {
+                close(op->fd);
+                if(op->done == op->buf.size) {
+                    *out = op->buf;
+                } else {
+                    free(op->buf.data);
+                }
+            }
+        }
+        if(finished) {
+            ring->in_progress--;
+            ret = op->user;
+            delete op;
+        }
+    }
+    
+    return ret;
+}
+
+void Fetch_DestroyRing(Fetch_Ring* ring) {
+    if(ring) {
+        // The kernel may still be writing into the buffers
+        Fetch_Buffer buf;
+        while(ring->in_progress > 0) {
+            Fetch_Wait(ring, &buf);
+            Fetch_Free(&buf);
+        }
+        munmap(ring->sqes, ring->sqes_size);
+        if(ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        free(ring);
+    }
+}
+#else
+Fetch_Ring* Fetch_CreateRing(unsigned depth) {
+    return NULL;
+}
+
+void Fetch_DestroyRing(Fetch_Ring* ring) {}
+
+bool Fetch_StartRead(Fetch_Ring* ring, const char* path, void* user) {
+    return false;
+}
+
+bool Fetch_StartPoll(Fetch_Ring* ring, int fd, void* user) {
+    return false;
+}
+
+unsigned Fetch_InProgress(Fetch_Ring* ring) {
+    return 0;
+}
+
+void* Fetch_Wait(Fetch_Ring* ring, Fetch_Buffer* out) {
+    return NULL;
+}
+#endif
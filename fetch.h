@@ -0,0 +1,80 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// The contents of a file in memory
+struct Fetch_Buffer {
+    uint8_t* data; // NULL if the file couldn't be read
+    size_t size;
+    bool mapped; // `data` is a mapping of the file
+};
+
+// Reads a whole file on the calling thread. Where possible the file is
+// mapped into memory and it's pages are read in right away, so that
+// using the buffer doesn't wait for the disk.
+// Returns false on failure.
+bool Fetch_ReadFile(const char* path, Fetch_Buffer* out);
+
+// Frees the buffer of a file; the buffer may be empty.
+void Fetch_Free(Fetch_Buffer* buf);
+
+// Tells the OS that a file will be read soon, so that it's read into
+// the page cache in the background. Doesn't wait for the disk.
+void Fetch_Advise(const char* path);
+
+// Returns a number for sorting files in the order they are stored on
+// the disk, so that reading them in that order seeks less. It's the
+// position of the file's first block where the file system tells it
+// and it's inode number otherwise; the two aren't comparable, nor are
+// the numbers of files on different disks. Files that can't be opened
+// get UINT64_MAX.
+uint64_t Fetch_DiskOrder(const char* path);
+
+// Reads files asynchronously; many reads can be in progress while a
+// single thread waits for them. Implemented with io_uring.
+// A ring must only be used by one thread at a time.
+struct Fetch_Ring;
+
+// Creates a ring with room for `depth` reads in progress.
+// Returns NULL if the platform or the kernel doesn't support it.
+Fetch_Ring* Fetch_CreateRing(unsigned depth);
+
+// Waits for the reads in progress and destroys the ring.
+//
+// If ring is NULL, this is a no-op.
+void Fetch_DestroyRing(Fetch_Ring* ring);
+
+// Opens a file and starts reading all of it. `user` is returned by
+// Fetch_Wait once it's read.
+// Returns false if the file couldn't be opened, it's empty or the ring
+// is full; no completion is delivered then.
+bool Fetch_StartRead(Fetch_Ring* ring, const char* path, void* user);
+
+// Starts waiting for `fd` to become readable. `user` is returned by
+// Fetch_Wait (with an empty buffer) once it is.
+// Returns false if the ring is full.
+bool Fetch_StartPoll(Fetch_Ring* ring, int fd, void* user);
+
+// Returns the number of reads and polls in progress
+unsigned Fetch_InProgress(Fetch_Ring* ring);
+
+// Blocks until a read or a poll has finished and returns it's `user`
+// pointer. A finished read's contents are moved into `out`; `out->data`
+// is NULL if the read failed.
+void* Fetch_Wait(Fetch_Ring* ring, Fetch_Buffer* out);
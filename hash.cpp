@@ -0,0 +1,110 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <string.h>
+#include "hash.h"
+
+// NOTE(easimer): this is the XXH64 algorithm by Yann Collet, written
+// from it's specification; hashes match the reference implementation.
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t RotateLeft(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+// Unaligned little-endian loads
+static inline uint64_t Read64(const uint8_t* p) {
+    uint64_t ret;
+    memcpy(&ret, p, sizeof(ret));
+    return ret;
+}
+
+static inline uint32_t Read32(const uint8_t* p) {
+    uint32_t ret;
+    memcpy(&ret, p, sizeof(ret));
+    return ret;
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = RotateLeft(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t MergeRound(uint64_t acc, uint64_t val) {
+    acc ^= Round(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t Hash_Bytes(const void* data, size_t size, uint64_t seed) {
+    auto p = (const uint8_t*)data;
+    auto end = p + size;
+    uint64_t ret;
+    
+    if(size >= 32) {
+        // Four independent lanes, so that the multiplications overlap
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        auto limit = end - 32;
+        do {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+            p += 32;
+        } while(p <= limit);
+        ret = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        ret = MergeRound(ret, v1);
+        ret = MergeRound(ret, v2);
+        ret = MergeRound(ret, v3);
+        ret = MergeRound(ret, v4);
+    } else {
+        ret = seed + PRIME5;
+    }
+    ret += (uint64_t)size;
+    
+    // The remaining 0-31 bytes
+    while(p + 8 <= end) {
+        ret ^= Round(0, Read64(p));
+        ret = RotateLeft(ret, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if(p + 4 <= end) {
+        ret ^= (uint64_t)Read32(p) * PRIME1;
+        ret = RotateLeft(ret, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while(p < end) {
+        ret ^= (*p) * PRIME5;
+        ret = RotateLeft(ret, 11) * PRIME1;
+        p++;
+    }
+    
+    // Avalanche
+    ret ^= ret >> 33;
+    ret *= PRIME2;
+    ret ^= ret >> 29;
+    ret *= PRIME3;
+    ret ^= ret >> 32;
+    return ret;
+}
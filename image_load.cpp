@@ -14,197 +14,1792 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "arena.h"
 #include "image_load.h"
 #include "display.h"
+#include "resample.h"
+#include "pixel.h"
+#include "fetch.h"
+#include "hash.h"
+#include "diskcache.h"
+#include "decode.h"
+#include "compress.h"
 #include <thread>
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <string>
-#include <queue>
 #include <list>
+#include <vector>
+#include <unordered_map>
+#include <sys/stat.h>
+#if _WIN32
+#define WIN32_MEAN_AND_LEAN
+#include <Windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#endif
+#if __linux__
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-using Request_Queue = std::queue<Promised_Image*>;
 using Lock = std::mutex;
 using Lock_Guard = std::lock_guard<std::mutex>;
 using Unique_Lock = std::unique_lock<std::mutex>;
 using Thread = std::thread;
 using Cond_Var = std::condition_variable;
+using Clock = std::chrono::steady_clock;
 
-#if __cplusplus <= 201703L
-struct Counting_Semaphore {
-    public:
-    void release() {
+// A one-shot event: signaled once, waited on by any number of threads.
+// On Linux waiters sleep on a futex on the state word; elsewhere on a
+// condition variable.
+struct Completion {
+    Completion() : state(0) {}
+    
+    // Returns whether the completion has been signaled
+    bool Poll() {
+        return state.load(std::memory_order_acquire) != 0;
+    }
+    
+    // Everything written by the signaling thread before this call is
+    // visible to the threads that see it signaled
+    void Signal() {
+#if __linux__
+        state.store(1, std::memory_order_release);
+        syscall(SYS_futex, (uint32_t*)&state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
         Lock_Guard G(mtx);
-        ++count;
-        cv.notify_one();
+        state.store(1, std::memory_order_release);
+        cv.notify_all();
+#endif
     }
     
-    void acquire() {
+    // Waits until the completion is signaled or `timeout_ms` milliseconds
+    // have passed; a negative timeout waits forever.
+    // Returns whether the completion has been signaled.
+    bool Wait(long timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+#if __linux__
+        while(!Poll()) {
+            timespec timeout;
+            timespec* ptimeout = NULL;
+            if(timeout_ms >= 0) {
+                auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+                if(left <= 0) {
+                    break;
+                }
+                timeout.tv_sec = left / 1000000000;
+                timeout.tv_nsec = left % 1000000000;
+                ptimeout = &timeout;
+            }
+            // Returns right away if the state is no longer 0
+            syscall(SYS_futex, (uint32_t*)&state, FUTEX_WAIT_PRIVATE, 0, ptimeout, NULL, 0);
+        }
+#else
         Unique_Lock UL(mtx);
-        while(!count) {
-            cv.wait(UL);
+        if(timeout_ms >= 0) {
+            cv.wait_until(UL, deadline, [this]() { return Poll(); });
+        } else {
+            cv.wait(UL, [this]() { return Poll(); });
         }
-        count--;
+#endif
+        return Poll();
     }
     
-    Counting_Semaphore() : count(0) {}
-    Counting_Semaphore(const Counting_Semaphore&) = delete;
-    void operator=(const Counting_Semaphore&) = delete;
-    private:
+    std::atomic<uint32_t> state;
+#if !__linux__
     Lock mtx;
     Cond_Var cv;
+#endif
+};
+
+// Identifies a version of a file
+struct File_Version {
+    int64_t mtime; // nanoseconds
+    int64_t size;
+    
+    bool operator==(const File_Version& other) const {
+        return mtime == other.mtime && size == other.size;
+    }
+};
+
+// Identifies the contents of a file
+struct Content_Key {
+    uint64_t hash; // Hash_Bytes of the file
+    uint64_t size;
+    
+    bool operator==(const Content_Key& other) const {
+        return hash == other.hash && size == other.size;
+    }
+};
+
+struct Content_Key_Hash {
+    size_t operator()(const Content_Key& key) const {
+        return (size_t)key.hash;
+    }
+};
+
+// Steps of loading an image that are timed
+enum Load_Step {
+    // Waiting to be read
+    LOADSTEP_QUEUED = 0,
+    // Reading the file
+    LOADSTEP_READ,
+    // Waiting for a decoding thread
+    LOADSTEP_WAITING,
+    // Decoding the file (or loading it from the disk cache)
+    LOADSTEP_DECODE,
+    // Shrinking, converting and making the mip levels
+    LOADSTEP_CONVERT,
+    LOADSTEP_MAX
+};
+
+static const char* gLoadStepNames[LOADSTEP_MAX] = {
+    "queued", "read", "waiting", "decode", "convert",
+};
+
+// Image files are told apart by their first few bytes
+enum Image_Format {
+    IMGFMT_PNG = 0,
+    IMGFMT_JPEG,
+    IMGFMT_GIF,
+    IMGFMT_BMP,
+    IMGFMT_OTHER,
+    // Pixels that were found in the disk cache, whatever the format of
+    // the file was
+    IMGFMT_DISK_CACHE,
+    // Pixels that were restored from the compressed tier
+    IMGFMT_COMPRESSED,
+    IMGFMT_MAX
+};
+
+static const char* gFormatNames[IMGFMT_MAX] = {
+    "PNG", "JPEG", "GIF", "BMP", "other", "disk cache", "compressed",
+};
+
+// Bucket `i` counts the durations between 2^i and 2^(i+1) microseconds;
+// the first one counts the shorter ones too, the last one the longer ones
+#define HISTOGRAM_BUCKETS (26)
+
+struct Histogram {
     unsigned long count;
+    double total_us;
+    double max_us;
+    unsigned long buckets[HISTOGRAM_BUCKETS];
 };
-#else
-#include <semaphore>
-using Counting_Semaphore = std::counting_semaphore;
-#endif
 
-struct Promised_Image {
-    Promised_Image(std::string&& path)
-        : path(path), processed(false), buffer(NULL),
-    w(0), h(0) {}
+struct Format_Timings {
+    unsigned long files;
+    size_t file_bytes; // size of the files
+    size_t pixel_bytes; // size of the pixels decoded from them, without mips
+    Histogram steps[LOADSTEP_MAX];
+};
+
+struct Cached_Image;
+using Request_Queue = std::list<Cached_Image*>;
+
+// Decoded pixels of a file.
+// Files with the same contents (copies, the same file under another
+// path) share one instance, so they're decoded once and kept in memory
+// once.
+struct Image_Pixels {
+    Image_Pixels(const Content_Key& key)
+        : key(key), max_width(0), conversion(0), rgb565(false), buffer(NULL), mapping(), w(0), h(0),
+    format(PIXFMT_ARGB32), mip_buffer(NULL), mip_count(0), mips(), bytes(0), done(false), users(0), waiting() {}
+    
+    Content_Key key;
+    // How the pixels were made from the file: the width they were shrunk
+    // to, the Pixel_Conversion flags and whether they were packed into 16
+    // bits if they're opaque
+    unsigned max_width;
+    unsigned conversion;
+    bool rgb565;
+    void* buffer; // NULL if the file couldn't be decoded
+    // Owns `buffer` if it's mapped from the disk cache
+    Fetch_Buffer mapping;
+    int w, h;
+    // Format of the image and of it's mips
+    Pixel_Format format;
+    // Mip levels, all in one allocation
+    uint8_t* mip_buffer;
+    int mip_count;
+    Image_Mip mips[IMAGE_MAX_MIPS];
+    size_t bytes; // the image and it's mips
+    
+    // Set once the file has been decoded
+    bool done;
+    // Number of entries referring to these pixels
+    unsigned users;
+    // Entries that are waiting for another entry's file to be decoded
+    std::vector<Cached_Image*> waiting;
+};
+
+// A decoded image.
+// Every request for the same version of a file shares one entry. Once
+// nobody uses an entry it's put on the LRU list and it stays in the
+// cache until it's evicted to make room.
+// Loading goes through two stages, each with it's own queues: first the
+// file is read into memory, then it's decoded.
+struct Cached_Image {
+    Cached_Image(const char* path, const File_Version& version)
+        : path(path), version(version), processed(false), pixels(NULL), buffer(NULL),
+    w(0), h(0), refcount(0), wanted(), queue(NULL), file(), cached(true) {}
     
     std::string path;
-    volatile bool processed;
+    File_Version version;
+    // Set once the image has been loaded (or it failed to load).
+    // `processed` is protected by gCacheLock, `done` is for the threads
+    // waiting for the image.
+    bool processed;
+    Completion done;
     
+    // Known once the file has been read
+    Image_Pixels* pixels;
+    // The pixels once they're decoded; NULL if the image failed to load
     void* buffer;
     int w, h;
+    
+    // Number of promises and loaded images referring to this entry
+    unsigned refcount;
+    // Number of promises of each priority
+    unsigned wanted[IMGPRI_MAX];
+    
+    // The queues of the stage it's waiting for; NULL if it's not queued
+    Request_Queue* queue;
+    Image_Priority priority; // the queue it's in
+    Request_Queue::iterator queue_pos;
+    // Contents of the file, between reading and decoding
+    Fetch_Buffer file;
+    // When the entry went through each step of loading
+    Clock::time_point queued, read_start, read_end, decode_start, decoded, converted;
+    
+    // Cleared if the entry was replaced by a newer version of the file
+    bool cached;
+    // Position on the LRU list, only valid if refcount is zero
+    std::list<Cached_Image*>::iterator lru;
+};
+
+struct Promised_Image {
+    Cached_Image* image;
+    Image_Priority priority;
+};
+
+// Size of an image read from the header of it's file
+struct Probed_Size {
+    File_Version version;
+    bool queued; // set until the header has been read
+    int w, h; // 0 if the header couldn't be read
+};
+
+// Identifies the pixels made from a file's contents in a particular way
+struct Compressed_Key {
+    Content_Key content;
+    unsigned max_width;
+    unsigned conversion;
+    bool rgb565;
+    
+    bool operator==(const Compressed_Key& other) const {
+        return content == other.content && max_width == other.max_width && conversion == other.conversion &&
+            rgb565 == other.rgb565;
+    }
+};
+
+struct Compressed_Key_Hash {
+    size_t operator()(const Compressed_Key& key) const {
+        return (size_t)(key.content.hash ^ ((uint64_t)key.max_width << 32) ^ key.conversion ^ ((unsigned)key.rgb565 << 8));
+    }
+};
+
+// Pixels of an evicted image, kept compressed in memory so that they
+// don't have to be decoded again if the image is requested again.
+// The mip levels aren't kept; they're quicker to make again than to
+// compress.
+struct Compressed_Image {
+    uint8_t* data;
+    size_t size;
+    int w, h;
+    Pixel_Format format;
+    bool raw; // stored uncompressed, because they didn't compress
+    // Position on the LRU list of the compressed tier
+    std::list<Compressed_Key>::iterator lru;
 };
 
+using Image_Cache = std::unordered_map<std::string, Cached_Image*>;
+using Probe_Cache = std::unordered_map<std::string, Probed_Size>;
+using Content_Index = std::unordered_map<Content_Key, Image_Pixels*, Content_Key_Hash>;
+using Image_LRU = std::list<Cached_Image*>;
+using Compressed_Cache = std::unordered_map<Compressed_Key, Compressed_Image, Compressed_Key_Hash>;
+
 static bool gShutdown = false;
+// Print the configuration and the statistics of the loader
+static bool gVerbose = false;
+
+// Protects everything below
+static Lock gCacheLock;
+static Image_Cache gCache;
+// Pixels of every file that was decoded or is being decoded, by their
+// contents
+static Content_Index gContent;
+// Unused entries, the least recently used is at the back
+static Image_LRU gLRU;
+// Evicted images kept LZ4-compressed in memory, and their own LRU list;
+// the least recently used is at the back
+static Compressed_Cache gCompressed;
+static std::list<Compressed_Key> gCompressedLRU;
+static size_t gCompressedBudget = IMAGE_COMPRESSED_DEFAULT_BUDGET;
+// Pixels of evicted images, waiting to be compressed
+static std::list<Image_Pixels*> gCompressQueue;
+static size_t gCompressQueueBytes = 0;
+static Cond_Var gCompressCV;
+// Sizes of the probed images by their path, and the paths waiting to be
+// probed
+static Probe_Cache gProbed;
+static std::list<std::string> gProbeQueue;
+static Cond_Var gProbeCV;
+static size_t gCacheBudget = IMAGE_CACHE_DEFAULT_BUDGET;
+static Image_Cache_Stats gCacheStats;
+static Format_Timings gTimings[IMGFMT_MAX];
+// Wider images are shrunk after decoding; 0 if unlimited
+static unsigned gMaxImageWidth = 0;
+static bool gRGB565 = false;
+// Decoded images are stored on disk too if the budget isn't 0
+static std::string gDiskCacheDir;
+static size_t gDiskCacheBudget = 0;
+static bool gDiskCacheOpen = false;
+// Images waiting to be read and to be decoded, one queue for each
+// priority
+static Request_Queue gReadQueue[IMGPRI_MAX];
+static Request_Queue gDecodeQueue[IMGPRI_MAX];
+// Signaled when a request is queued or on shutdown
+static Cond_Var gReadCV;
+static Cond_Var gDecodeCV;
 
-static Lock gQueueLock;
-static Request_Queue* gRequestQueue = NULL;
+// Becomes readable when an image that somebody is waiting for has been
+// loaded; -1 if unsupported
+static int gWakeupFd = -1;
 
-static Counting_Semaphore gSema;
+// Number of decoding threads and of files that may be read at once;
+// 0 if picked based on the CPU
+static unsigned gDecodeThreadLimit = 0;
+static unsigned gIOLimit = 0;
+// Number of threads for visible images that are waiting for work
+static unsigned gIdleForeground = 0;
 
+// Files are read either by a single thread through io_uring or by a
+// thread for each file read at once
+static Fetch_Ring* gRing = NULL;
+// Wakes up the io_uring thread when a file is queued to be read
+static int gReadWakeFd = -1;
+static Thread* gReadThread = NULL;
+static unsigned gReadThreadCount = 0;
+
+// Reads the headers of probed images
+static Thread* gProbeThread = NULL;
+// Compresses evicted images
+static Thread* gCompressThread = NULL;
+
+// Threads for visible images. They load other images too as long as
+// one of them stays free for the visible ones.
 static Thread* gThread = NULL;
 static unsigned gThreadCount = 0;
+// Threads running at a lower OS priority; these load images of any
+// priority, the most important first
+static Thread* gBackgroundThread = NULL;
+static unsigned gBackgroundThreadCount = 0;
+
+static bool GetFileVersion(const char* path, File_Version* out) {
+    bool ret = false;
+#if _WIN32
+    struct _stat64 st;
+    if(_stat64(path, &st) == 0) {
+        out->mtime = (int64_t)st.st_mtime * 1000000000;
+        out->size = st.st_size;
+        ret = true;
+    }
+#else
+    struct stat st;
+    if(stat(path, &st) == 0) {
+        out->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        out->size = st.st_size;
+        ret = true;
+    }
+#endif
+    return ret;
+}
+
+static void LowerThreadPriority() {
+#if _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#else
+    // On Linux the nice value is per-thread
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+#endif
+}
+
+// Returns the size of an image in bytes
+static size_t ImageBytes(Pixel_Format format, int w, int h) {
+    return Pixel_Stride(format, (unsigned)w) * h;
+}
+
+// Frees pixels and their mip levels
+static void FreePixels(Image_Pixels* pixels) {
+    if(pixels->mapping.data) {
+        Fetch_Free(&pixels->mapping);
+    } else if(pixels->buffer) {
+        free(pixels->buffer);
+    }
+    free(pixels->mip_buffer);
+    delete pixels;
+}
 
-static void SwapRedBlueChannels(uint8_t* rgba_buffer, unsigned width, unsigned height) {
-    for(unsigned y = 0; y < height; y++) {
-        for(unsigned x = 0; x < width; x++) {
-            auto& c0 = rgba_buffer[y * width * 4 + x * 4 + 0];
-            auto& c1 = rgba_buffer[y * width * 4 + x * 4 + 2];
-            std::swap(c0, c1);
+// Drops an entry's reference to it's pixels. Once nobody refers to them
+// they're handed to the compressing thread, or freed if the compressed
+// tier is disabled or too far behind.
+// gCacheLock must be held.
+static void ReleasePixels(Cached_Image* img) {
+    auto pixels = img->pixels;
+    img->pixels = NULL;
+    img->buffer = NULL;
+    if(pixels) {
+        assert(pixels->users > 0);
+        pixels->users--;
+        if(pixels->users == 0) {
+            // NOTE(easimer): entries only drop their pixels once the pixels
+            // are done
+            assert(pixels->done);
+            auto it = gContent.find(pixels->key);
+            if(it != gContent.end() && it->second == pixels) {
+                gContent.erase(it);
+            }
+            gCacheStats.bytes -= pixels->bytes;
+            // NOTE(easimer): the queue holds at most as many uncompressed
+            // bytes as the compressed tier may use, but at least one image,
+            // as it may compress well enough to fit
+            size_t raw_size = ImageBytes(pixels->format, pixels->w, pixels->h);
+            if(pixels->buffer && gCompressThread && !gShutdown && gCompressedBudget > 0 &&
+               (gCompressQueue.empty() || gCompressQueueBytes + raw_size <= gCompressedBudget)) {
+                gCompressQueue.push_back(pixels);
+                gCompressQueueBytes += raw_size;
+                gCompressCV.notify_one();
+            } else {
+                FreePixels(pixels);
+            }
         }
     }
 }
 
-static void ThreadFunc(int i) {
-    int w, h, channels;
+static void DeleteImage(Cached_Image* img) {
+    Fetch_Free(&img->file);
+    ReleasePixels(img);
+    delete img;
+}
+
+// Evicts unused images until the cache fits into it's budget.
+// gCacheLock must be held.
+static void EnforceCacheBudget() {
+    while(gCacheStats.bytes > gCacheBudget && !gLRU.empty()) {
+        auto img = gLRU.back();
+        gLRU.pop_back();
+        gCache.erase(img->path);
+        gCacheStats.evictions++;
+        DeleteImage(img);
+    }
+}
+
+// Evicts compressed images until the compressed tier fits into it's
+// budget.
+// gCacheLock must be held.
+static void EnforceCompressedBudget() {
+    while(gCacheStats.compressed_bytes > gCompressedBudget && !gCompressedLRU.empty()) {
+        auto it = gCompressed.find(gCompressedLRU.back());
+        assert(it != gCompressed.end());
+        gCompressedLRU.pop_back();
+        gCacheStats.compressed_bytes -= it->second.size;
+        gCacheStats.compressed_raw_bytes -= ImageBytes(it->second.format, it->second.w, it->second.h);
+        gCacheStats.compressed_evictions++;
+        free(it->second.data);
+        gCompressed.erase(it);
+    }
+}
+
+// Puts a compressed image into the compressed tier, which takes
+// ownership of it's data.
+// gCacheLock must be held.
+static void InsertCompressed(const Compressed_Key& key, const Compressed_Image& img) {
+    auto it = gCompressed.find(key);
+    if(it != gCompressed.end()) {
+        // NOTE(easimer): the same pixels were decoded again while these
+        // were being compressed
+        free(img.data);
+    } else {
+        auto& entry = gCompressed[key];
+        entry = img;
+        gCompressedLRU.push_front(key);
+        entry.lru = gCompressedLRU.begin();
+        gCacheStats.compressed_bytes += img.size;
+        gCacheStats.compressed_raw_bytes += ImageBytes(img.format, img.w, img.h);
+        EnforceCompressedBudget();
+    }
+}
+
+// Takes an image out of the compressed tier; the caller owns it's data
+// afterwards.
+// Returns false if it's not there.
+// gCacheLock must be held.
+static bool TakeCompressed(const Compressed_Key& key, Compressed_Image* out) {
+    bool ret = false;
+    auto it = gCompressed.find(key);
+    if(it != gCompressed.end()) {
+        *out = it->second;
+        gCompressedLRU.erase(it->second.lru);
+        gCacheStats.compressed_bytes -= out->size;
+        gCacheStats.compressed_raw_bytes -= ImageBytes(out->format, out->w, out->h);
+        gCompressed.erase(it);
+        ret = true;
+    }
+    return ret;
+}
+
+// Takes back the pixels of an evicted image that are still waiting to be
+// compressed.
+// Returns NULL if there are none.
+// gCacheLock must be held.
+static Image_Pixels* TakeEvicted(const Compressed_Key& key) {
+    Image_Pixels* ret = NULL;
+    for(auto it = gCompressQueue.begin(); it != gCompressQueue.end(); ++it) {
+        auto pixels = *it;
+        if(pixels->key == key.content && pixels->max_width == key.max_width && pixels->conversion == key.conversion &&
+           pixels->rgb565 == key.rgb565) {
+            gCompressQueue.erase(it);
+            gCompressQueueBytes -= ImageBytes(pixels->format, pixels->w, pixels->h);
+            ret = pixels;
+            break;
+        }
+    }
+    return ret;
+}
+
+// Restores the pixels of an image taken out of the compressed tier and
+// frees it's compressed data.
+// Returns NULL if the data is corrupt.
+static void* ExpandCompressed(Compressed_Image* img) {
+    void* ret = NULL;
+    if(img->raw) {
+        ret = img->data;
+    } else {
+        size_t size = ImageBytes(img->format, img->w, img->h);
+        ret = malloc(size);
+        if(ret && !Compress_ExpandLZ4(img->data, img->size, (uint8_t*)ret, size)) {
+            free(ret);
+            ret = NULL;
+        }
+        free(img->data);
+    }
+    img->data = NULL;
+    return ret;
+}
+
+// Compresses the pixels of evicted images into the compressed tier, one
+// image at a time
+static void CompressFunc() {
+    LowerThreadPriority();
+    
+    Unique_Lock UL(gCacheLock);
+    while(true) {
+        while(!gShutdown && gCompressQueue.empty()) {
+            gCompressCV.wait(UL);
+        }
+        if(gShutdown) break;
+        auto pixels = gCompressQueue.front();
+        gCompressQueue.pop_front();
+        size_t raw_size = ImageBytes(pixels->format, pixels->w, pixels->h);
+        gCompressQueueBytes -= raw_size;
+        Compressed_Key key = {pixels->key, pixels->max_width, pixels->conversion, pixels->rgb565};
+        UL.unlock();
+        
+        auto start = Clock::now();
+        Compressed_Image img = {};
+        img.w = pixels->w;
+        img.h = pixels->h;
+        img.format = pixels->format;
+        auto data = (uint8_t*)malloc(Compress_Bound(raw_size));
+        if(data) {
+            img.size = Compress_LZ4((const uint8_t*)pixels->buffer, raw_size, data);
+        }
+        if(data && img.size < raw_size) {
+            auto shrunk = (uint8_t*)realloc(data, img.size);
+            img.data = shrunk ? shrunk : data;
+        } else {
+            free(data);
+            // Photos with noise barely compress; they still take less
+            // memory here than in the decoded tier, as they lost their mips
+            if(!pixels->mapping.data) {
+                img.data = (uint8_t*)pixels->buffer;
+                img.size = raw_size;
+                img.raw = true;
+                pixels->buffer = NULL;
+            }
+        }
+        FreePixels(pixels);
+        auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        
+        UL.lock();
+        gCacheStats.compress_seconds += elapsed;
+        if(img.data) {
+            InsertCompressed(key, img);
+        }
+    }
+}
+
+// Removes an entry from the cache; it's deleted once it's unused and
+// loaded.
+// gCacheLock must be held.
+static void Uncache(Cached_Image* img) {
+    gCache.erase(img->path);
+    img->cached = false;
+    if(img->refcount == 0 && img->processed) {
+        gLRU.erase(img->lru);
+        DeleteImage(img);
+    }
+}
+
+// Wakes up the threads of a stage
+// gCacheLock must be held.
+static void NotifyStage(Request_Queue* queue) {
+    if(queue == gReadQueue) {
+        gReadCV.notify_all();
+#if __linux__
+        if(gReadWakeFd != -1) {
+            uint64_t one = 1;
+            (void)!write(gReadWakeFd, &one, sizeof(one));
+        }
+#endif
+    } else {
+        gDecodeCV.notify_all();
+    }
+}
+
+// Queues an image for a stage.
+// gCacheLock must be held.
+static void Enqueue(Cached_Image* img, Request_Queue* queue, Image_Priority priority) {
+    img->queue = queue;
+    img->priority = priority;
+    img->queue_pos = queue[priority].insert(queue[priority].end(), img);
+    gCacheStats.queued[queue == gReadQueue ? IMGSTAGE_READ : IMGSTAGE_DECODE]++;
+    NotifyStage(queue);
+}
+
+// Takes an image out of it's queue.
+// gCacheLock must be held.
+static void Dequeue(Cached_Image* img) {
+    assert(img->queue);
+    img->queue[img->priority].erase(img->queue_pos);
+    gCacheStats.queued[img->queue == gReadQueue ? IMGSTAGE_READ : IMGSTAGE_DECODE]--;
+    img->queue = NULL;
+}
+
+// Moves a queued image into the queue of the most important promise
+// that still waits for it.
+// gCacheLock must be held.
+static void UpdateQueuePosition(Cached_Image* img) {
+    if(img->queue) {
+        int pri = IMGPRI_MAX - 1;
+        while(pri > 0 && img->wanted[pri] == 0) {
+            pri--;
+        }
+        if(pri != img->priority) {
+            auto queue = img->queue;
+            Dequeue(img);
+            Enqueue(img, queue, (Image_Priority)pri);
+        }
+    }
+}
+
+// gCacheLock must be held
+static void Retain(Cached_Image* img) {
+    if(img->refcount == 0 && img->processed) {
+        gLRU.erase(img->lru);
+    }
+    img->refcount++;
+}
+
+// gCacheLock must be held
+static void Release(Cached_Image* img) {
+    assert(img->refcount > 0);
+    img->refcount--;
+    if(img->refcount == 0) {
+        if(img->queue) {
+            // Nobody wants it anymore; cancel the request
+            Dequeue(img);
+            if(img->cached) {
+                gCache.erase(img->path);
+            }
+            gCacheStats.cancellations++;
+            DeleteImage(img);
+        } else if(!img->cached) {
+            if(img->processed) {
+                DeleteImage(img);
+            }
+        } else if(img->processed && !img->buffer) {
+            // Failed loads are not cached, the file may get fixed
+            gCache.erase(img->path);
+            DeleteImage(img);
+        } else if(img->processed) {
+            gLRU.push_front(img);
+            img->lru = gLRU.begin();
+            EnforceCacheBudget();
+        }
+    }
+}
+
+// Takes the most important image from the queues of a stage, but not
+// less important than `lowest`.
+// gCacheLock must be held.
+static Cached_Image* PopRequest(Request_Queue* queue, int lowest) {
+    Cached_Image* ret = NULL;
+    for(int pri = IMGPRI_MAX - 1; pri >= lowest && !ret; pri--) {
+        if(!queue[pri].empty()) {
+            ret = queue[pri].front();
+            Dequeue(ret);
+        }
+    }
+    return ret;
+}
+
+// Takes the most important image a decoding thread may work on.
+// gCacheLock must be held.
+static Cached_Image* PopDecodeRequest(bool background) {
+    int lowest = background ? 0 : IMGPRI_VISIBLE;
+    if(gIdleForeground > 1 || gBackgroundThreadCount == 0) {
+        // Another thread is still free for visible images (or there's
+        // nobody else to do it), this one can help out with the rest
+        lowest = 0;
+    }
+    return PopRequest(gDecodeQueue, lowest);
+}
+
+// Shrinks a decoded image to `max_width` pixels wide, keeping it's
+// aspect ratio. Frees `pixbuf` and returns the smaller image.
+static void* Shrink(void* pixbuf, int* w, int* h, unsigned max_width) {
+    void* ret = pixbuf;
+    int new_w = max_width;
+    int new_h = (int)((double)*h * new_w / *w + 0.5);
+    if(new_h < 1) {
+        new_h = 1;
+    }
+    // NOTE(easimer): the decoders allocate with malloc too
+    auto shrunk = (uint8_t*)malloc((size_t)new_w * new_h * 4);
+    if(shrunk) {
+        // NOTE(easimer): the decoding threads already keep every core
+        // busy, so the image is shrunk on this one only
+        Resample_Downscale((uint8_t*)pixbuf, *w, *h, shrunk, new_w, new_h, 1);
+        free(pixbuf);
+        *w = new_w;
+        *h = new_h;
+        ret = shrunk;
+    }
+    return ret;
+}
+
+static void NotifyWakeupFd() {
+#if __linux__
+    if(gWakeupFd != -1) {
+        uint64_t one = 1;
+        // Can only fail if the counter would overflow, in which case the
+        // fd is readable anyway
+        (void)!write(gWakeupFd, &one, sizeof(one));
+    }
+#endif
+}
+
+// Publishes the result of loading an image; it failed to load if it has
+// no pixels or they couldn't be decoded.
+// gCacheLock must be held.
+static void FinishImage(Cached_Image* P) {
+    if(P->pixels && P->pixels->buffer) {
+        P->buffer = P->pixels->buffer;
+        P->w = P->pixels->w;
+        P->h = P->pixels->h;
+    }
+    P->processed = true;
+    // Signaled even if nobody holds a promise: the entry stays cached and
+    // a later request awaits the same event
+    P->done.Signal();
+    if(P->refcount == 0) {
+        // Everybody gave up on this image while it was loading
+        P->refcount++;
+        Release(P);
+    } else {
+        NotifyWakeupFd();
+        EnforceCacheBudget();
+    }
+}
+
+// Hands a read file over to the decoding threads.
+// gCacheLock must be held.
+static void FinishRead(Cached_Image* P, const Fetch_Buffer& file) {
+    P->read_end = Clock::now();
+    auto elapsed = std::chrono::duration<double>(P->read_end - P->read_start).count();
+    gCacheStats.finished[IMGSTAGE_READ]++;
+    gCacheStats.busy_seconds[IMGSTAGE_READ] += elapsed;
+    P->file = file;
+    if(!file.data) {
+        printf("ImageLoader: couldn't read '%s'\n", P->path.c_str());
+        FinishImage(P);
+    } else if(P->refcount == 0) {
+        // Not worth decoding anymore
+        gCacheStats.cancellations++;
+        FinishImage(P);
+    } else {
+        Enqueue(P, gDecodeQueue, P->priority);
+        UpdateQueuePosition(P);
+    }
+}
+
+// Publishes decoded pixels to the entry that decoded them (`P`) and to
+// the entries with the same contents that were waiting for it.
+// gCacheLock must be held.
+static void FinishPixels(Image_Pixels* pixels, Cached_Image* P) {
+    pixels->done = true;
+    if(pixels->buffer) {
+        pixels->bytes = ImageBytes(pixels->format, pixels->w, pixels->h);
+        for(int i = 0; i < pixels->mip_count; i++) {
+            pixels->bytes += ImageBytes(pixels->format, pixels->mips[i].width, pixels->mips[i].height);
+        }
+        gCacheStats.bytes += pixels->bytes;
+        if(pixels->format != PIXFMT_ARGB32) {
+            gCacheStats.opaque++;
+        }
+    }
+    // Finishing an entry may delete it and drop it's pixels
+    auto waiting = std::move(pixels->waiting);
+    pixels->waiting.clear();
+    FinishImage(P);
+    for(auto img : waiting) {
+        FinishImage(img);
+    }
+}
+
+// Returns the Pixel_Conversion flags the display needs, for images with
+// an alpha channel
+static unsigned DisplayConversion() {
+    unsigned ret = 0;
+    if(Display_SwapRedBlueChannels()) {
+        ret |= PIXCONV_SWAP_RED_BLUE;
+    }
+    if(Display_PremultipliedAlpha()) {
+        ret |= PIXCONV_PREMULTIPLY;
+    }
+    return ret;
+}
+
+// Images get mip levels down to this size in both directions
+#define MIP_MIN_SIZE (128)
+
+// Makes the mip levels of decoded pixels with a box filter; each level
+// is half as large as the previous one and has the same format.
+static void BuildMips(Image_Pixels* pixels) {
+    int count = 0;
+    size_t total = 0;
+    int w = pixels->w, h = pixels->h;
+    while(count < IMAGE_MAX_MIPS && w / 2 >= MIP_MIN_SIZE && h / 2 >= MIP_MIN_SIZE) {
+        w /= 2;
+        h /= 2;
+        total += ImageBytes(pixels->format, w, h);
+        count++;
+    }
+    if(count > 0) {
+        pixels->mip_buffer = (uint8_t*)malloc(total);
+    }
+    if(pixels->mip_buffer) {
+        auto src = (const uint8_t*)pixels->buffer;
+        auto dst = pixels->mip_buffer;
+        w = pixels->w;
+        h = pixels->h;
+        for(int i = 0; i < count; i++) {
+            // Each level is made from the previous one
+            if(pixels->format == PIXFMT_RGB16_565) {
+                Pixel_HalveRGB565(src, w, h, dst);
+            } else {
+                Pixel_Halve(src, w, h, dst);
+            }
+            w /= 2;
+            h /= 2;
+            pixels->mips[i].buffer = (char*)dst;
+            pixels->mips[i].width = w;
+            pixels->mips[i].height = h;
+            src = dst;
+            dst += ImageBytes(pixels->format, w, h);
+        }
+        pixels->mip_count = count;
+    }
+}
+
+// Decodes an image file and converts it for the display, shrinking it
+// to `max_width` if it's wider. `*decoded` is set to when the decoding
+// was done and the converting started. `*opaque` is set if every pixel
+// is opaque.
+// Returns NULL if the file couldn't be decoded.
+static void* DecodeImage(const Fetch_Buffer& file, unsigned max_width, int* w, int* h, Clock::time_point* decoded,
+                         bool* opaque) {
+    bool has_alpha;
+    // JPEGs that are too wide are decoded at a smaller size where
+    // possible, but they still have to be shrunk to `max_width`
+    void* ret = Decode_Image(file.data, file.size, max_width, w, h, &has_alpha);
+    *decoded = Clock::now();
+    if(ret) {
+        unsigned conversion = DisplayConversion();
+        // Without an alpha channel premultiplying changes nothing
+        if(!has_alpha) {
+            conversion &= ~PIXCONV_PREMULTIPLY;
+        }
+        bool shrink = max_width && (unsigned)*w > max_width;
+        // Shrinking must average premultiplied colors, otherwise the
+        // color of transparent pixels bleeds into the opaque ones.
+        // Otherwise it's cheaper to convert the smaller image.
+        if(shrink && (conversion & PIXCONV_PREMULTIPLY)) {
+            Pixel_Convert((uint8_t*)ret, (size_t)*w * *h, conversion);
+            conversion = 0;
+        }
+        if(shrink) {
+            ret = Shrink(ret, w, h, max_width);
+        }
+        Pixel_Convert((uint8_t*)ret, (size_t)*w * *h, conversion);
+        // Images with an alpha channel are often opaque anyway, e.g.
+        // screenshots saved as RGBA PNGs. Decoders set the alpha of images
+        // without one to 255.
+        *opaque = !has_alpha || Pixel_IsOpaque((const uint8_t*)ret, (size_t)*w * *h);
+    }
+    return ret;
+}
+
+// Stores opaque pixels without alpha, packing them into 16 bits per
+// pixel if they're meant to be. `pixels->buffer` must have 4 byte
+// pixels.
+static void SetFormat(Image_Pixels* pixels, bool opaque) {
+    if(opaque) {
+        pixels->format = PIXFMT_RGB24;
+        if(pixels->rgb565) {
+            auto src = (uint8_t*)pixels->buffer;
+            auto dst = src;
+            size_t size = ImageBytes(PIXFMT_RGB16_565, pixels->w, pixels->h);
+            if(pixels->mapping.data) {
+                // Pixels mapped from the disk cache are read-only
+                dst = (uint8_t*)malloc(size);
+            }
+            if(dst) {
+                Pixel_PackRGB565(src, pixels->w, pixels->h, dst);
+                if(pixels->mapping.data) {
+                    Fetch_Free(&pixels->mapping);
+                } else {
+                    auto shrunk = (uint8_t*)realloc(dst, size);
+                    dst = shrunk ? shrunk : dst;
+                }
+                pixels->buffer = dst;
+                pixels->format = PIXFMT_RGB16_565;
+            }
+        }
+    }
+}
+
+static Image_Format SniffFormat(const Fetch_Buffer& file) {
+    Image_Format ret = IMGFMT_OTHER;
+    auto p = file.data;
+    if(file.size >= 4 && memcmp(p, "\x89PNG", 4) == 0) {
+        ret = IMGFMT_PNG;
+    } else if(file.size >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) {
+        ret = IMGFMT_JPEG;
+    } else if(file.size >= 4 && memcmp(p, "GIF8", 4) == 0) {
+        ret = IMGFMT_GIF;
+    } else if(file.size >= 2 && memcmp(p, "BM", 2) == 0) {
+        ret = IMGFMT_BMP;
+    }
+    return ret;
+}
+
+static void AddSample(Histogram* hist, Clock::duration duration) {
+    double us = std::chrono::duration<double, std::micro>(duration).count();
+    int bucket = 0;
+    while(bucket < HISTOGRAM_BUCKETS - 1 && us >= (double)(2ull << bucket)) {
+        bucket++;
+    }
+    hist->count++;
+    hist->total_us += us;
+    if(us > hist->max_us) {
+        hist->max_us = us;
+    }
+    hist->buckets[bucket]++;
+}
+
+// Adds the timings of a loaded file to the statistics of it's format.
+// The decoding steps are only counted if `decoded` is set, i.e. if this
+// entry decoded the file and didn't share another entry's pixels.
+// gCacheLock must be held.
+static void RecordTimings(const Cached_Image* P, Image_Format format, size_t file_bytes, bool decoded) {
+    auto& timings = gTimings[format];
+    timings.files++;
+    timings.file_bytes += file_bytes;
+    AddSample(&timings.steps[LOADSTEP_QUEUED], P->read_start - P->queued);
+    AddSample(&timings.steps[LOADSTEP_READ], P->read_end - P->read_start);
+    AddSample(&timings.steps[LOADSTEP_WAITING], P->decode_start - P->read_end);
+    if(decoded) {
+        AddSample(&timings.steps[LOADSTEP_DECODE], P->decoded - P->decode_start);
+        AddSample(&timings.steps[LOADSTEP_CONVERT], P->converted - P->decoded);
+        if(P->pixels->buffer) {
+            timings.pixel_bytes += (size_t)P->pixels->w * P->pixels->h * 4;
+        }
+    }
+}
+
+static void DecodeFunc(int i, bool background) {
+    int w, h;
     void *pixbuf;
-    while(!gShutdown) {
-        gSema.acquire();
-        if(gShutdown) break; // shutdown
-        gQueueLock.lock();
-        auto P = gRequestQueue->front();
-        //printf("Loader thread %d is loading '%s' (%p), N=%zu\n", i, P->path.c_str(), P, gRequestQueue->size());
-        gRequestQueue->pop();
-        gQueueLock.unlock();
+    Cached_Image* P = NULL;
+    Image_Pixels* pixels;
+    
+    if(background) {
+        LowerThreadPriority();
+    }
+    
+    bool shutdown = false;
+    unsigned max_width = 0;
+    bool rgb565 = false;
+    bool disk_cache = false;
+    while(!shutdown) {
+        Fetch_Buffer file;
+        {
+            Unique_Lock UL(gCacheLock);
+            if(!background) {
+                gIdleForeground++;
+            }
+            while(!gShutdown && !(P = PopDecodeRequest(background))) {
+                gDecodeCV.wait(UL);
+            }
+            if(!background) {
+                gIdleForeground--;
+            }
+            shutdown = gShutdown;
+            max_width = gMaxImageWidth;
+            rgb565 = gRGB565;
+            disk_cache = gDiskCacheOpen;
+            if(P) {
+                file = P->file;
+                P->file = {};
+            }
+        }
+        if(shutdown) break; // shutdown
+        
+        auto start = Clock::now();
+        P->decode_start = start;
+        auto format = SniffFormat(file);
+        auto file_bytes = file.size;
+        Content_Key content = {Hash_Bytes(file.data, file.size), file.size};
+        unsigned conversion = DisplayConversion();
+        // NOTE(easimer): packing expects the red and blue channels to be
+        // swapped, which is what both displays want
+        Compressed_Key compressed_key = {content, max_width, conversion,
+            rgb565 && (conversion & PIXCONV_SWAP_RED_BLUE) != 0};
+        Compressed_Image compressed = {};
+        bool decode = false;
+        gCacheLock.lock();
+        auto it = gContent.find(content);
+        if(it != gContent.end()) {
+            // The same contents were decoded or are being decoded for
+            // another path
+            pixels = it->second;
+            gCacheStats.deduplicated++;
+        } else if((pixels = TakeEvicted(compressed_key))) {
+            // Evicted a moment ago and not compressed yet
+            gContent[content] = pixels;
+            gCacheStats.bytes += pixels->bytes;
+            gCacheStats.compressed_hits++;
+        } else {
+            pixels = new Image_Pixels(content);
+            pixels->max_width = compressed_key.max_width;
+            pixels->conversion = compressed_key.conversion;
+            pixels->rgb565 = compressed_key.rgb565;
+            gContent[content] = pixels;
+            decode = true;
+            if(TakeCompressed(compressed_key, &compressed)) {
+                gCacheStats.compressed_hits++;
+            } else if(gCompressedBudget > 0) {
+                gCacheStats.compressed_misses++;
+            }
+        }
+        pixels->users++;
+        P->pixels = pixels;
+        if(!decode) {
+            RecordTimings(P, format, file_bytes, false);
+        }
+        if(pixels->done) {
+            FinishImage(P);
+        } else if(!decode) {
+            pixels->waiting.push_back(P);
+        }
+        gCacheLock.unlock();
+        if(!decode) {
+            Fetch_Free(&file);
+            continue;
+        }
         
-        pixbuf = stbi_load(P->path.c_str(), &w, &h, &channels, STBI_rgb_alpha);
+        pixbuf = NULL;
+        Fetch_Buffer mapping = {};
+        bool opaque = false;
+        if(compressed.data) {
+            w = compressed.w;
+            h = compressed.h;
+            pixbuf = ExpandCompressed(&compressed);
+            if(pixbuf) {
+                format = IMGFMT_COMPRESSED;
+                pixels->format = compressed.format;
+            } else {
+                printf("ImageLoader: compressed pixels of '%s' are corrupt\n", P->path.c_str());
+            }
+            P->decoded = Clock::now();
+        }
+        Disk_Cache_Key key;
+        if(!pixbuf && disk_cache) {
+            key.hash = content.hash;
+            key.size = content.size;
+            key.max_width = max_width;
+            key.conversion = conversion;
+            uint8_t* cached_pixels;
+            if(DiskCache_Load(key, &mapping, &cached_pixels, &w, &h)) {
+                pixbuf = cached_pixels;
+                format = IMGFMT_DISK_CACHE;
+                opaque = Pixel_IsOpaque(cached_pixels, (size_t)w * h);
+            }
+            P->decoded = Clock::now();
+        }
+        if(!pixbuf) {
+            pixbuf = DecodeImage(file, max_width, &w, &h, &P->decoded, &opaque);
+            if(!pixbuf) {
+                printf("ImageLoader: couldn't decode '%s'\n", P->path.c_str());
+            } else if(disk_cache) {
+                DiskCache_Store(key, pixbuf, w, h);
+            }
+        }
+        Fetch_Free(&file);
+        pixels->buffer = pixbuf;
+        pixels->mapping = mapping;
+        pixels->w = w;
+        pixels->h = h;
+        if(pixbuf && format != IMGFMT_COMPRESSED) {
+            // The disk cache has the pixels as they were decoded
+            SetFormat(pixels, opaque);
+        }
         if(pixbuf) {
-            if(Display_SwapRedBlueChannels()) {
-                SwapRedBlueChannels((uint8_t*)pixbuf, w, h);
+            // NOTE(easimer): mips aren't stored in the disk cache, making
+            // them takes a fraction of the time it takes to read them
+            BuildMips(pixels);
+        }
+        P->converted = Clock::now();
+        auto elapsed = std::chrono::duration<double>(P->converted - start).count();
+        
+        gCacheLock.lock();
+        gCacheStats.finished[IMGSTAGE_DECODE]++;
+        gCacheStats.busy_seconds[IMGSTAGE_DECODE] += elapsed;
+        if(format == IMGFMT_DISK_CACHE) {
+            gCacheStats.disk_hits++;
+        }
+        // NOTE(easimer): recorded before finishing, which may delete `P`
+        RecordTimings(P, format, file_bytes, true);
+        FinishPixels(pixels, P);
+        gCacheLock.unlock();
+    }
+}
+
+// Takes the most important image to be read; NULL if there's none or
+// the loader is shutting down. If `wait` is set then waits for one.
+static Cached_Image* PopReadRequest(bool wait) {
+    Cached_Image* ret = NULL;
+    Unique_Lock UL(gCacheLock);
+    while(!gShutdown && !(ret = PopRequest(gReadQueue, 0)) && wait) {
+        gReadCV.wait(UL);
+    }
+    if(ret) {
+        ret->read_start = Clock::now();
+    }
+    return ret;
+}
+
+// Reads files one at a time; there's one of these for every file that
+// may be read at once
+static void ReadFunc() {
+    Cached_Image* P;
+    while((P = PopReadRequest(true))) {
+        Fetch_Buffer file;
+        Fetch_ReadFile(P->path.c_str(), &file);
+        
+        gCacheLock.lock();
+        FinishRead(P, file);
+        gCacheLock.unlock();
+    }
+}
+
+// Reads up to `io_limit` files at once through io_uring. The ring also
+// waits for reads to be requested; CreateThreads starts the first poll.
+static void RingReadFunc(unsigned io_limit) {
+    unsigned reading = 0;
+    Cached_Image* P;
+    bool shutdown = false;
+    bool polling = true;
+    while(Fetch_InProgress(gRing) > 0) {
+        while(!shutdown && reading < io_limit && (P = PopReadRequest(false))) {
+            if(Fetch_StartRead(gRing, P->path.c_str(), P)) {
+                reading++;
+            } else {
+                Fetch_Buffer failed = {};
+                gCacheLock.lock();
+                FinishRead(P, failed);
+                gCacheLock.unlock();
             }
-            P->buffer = pixbuf;
-            P->w = w;
-            P->h = h;
-        } else {
-            printf("ImageLoader: couldn't load '%s'\n", P->path.c_str());
         }
         
-        P->processed = true;
+        Fetch_Buffer file;
+        auto user = Fetch_Wait(gRing, &file);
+        gCacheLock.lock();
+        shutdown = gShutdown;
+        if(user != &gReadWakeFd) {
+            // Finished on shutdown too; the decoding queue is emptied by
+            // ImageLoader_Shutdown
+            reading--;
+            FinishRead((Cached_Image*)user, file);
+        }
+        gCacheLock.unlock();
+        if(user == &gReadWakeFd && !shutdown) {
+            uint64_t count;
+            (void)!read(gReadWakeFd, &count, sizeof(count));
+            polling = Fetch_StartPoll(gRing, gReadWakeFd, &gReadWakeFd);
+        }
+    }
+    if(!shutdown && !polling) {
+        // New requests would go unnoticed; the reads in progress were
+        // finished above
+        fprintf(stderr, "ImageLoader: io_uring can't wait for requests anymore, reading files one at a time\n");
+        ReadFunc();
     }
 }
 
+// Reads the size of images from the headers of their files
+static void ProbeFunc() {
+    Unique_Lock UL(gCacheLock);
+    while(true) {
+        while(!gShutdown && gProbeQueue.empty()) {
+            gProbeCV.wait(UL);
+        }
+        if(gShutdown) break;
+        auto path = std::move(gProbeQueue.front());
+        gProbeQueue.pop_front();
+        UL.unlock();
+        
+        // NOTE(easimer): stb_image only reads as much of the file as it
+        // needs to find the size
+        int w, h, channels;
+        if(!stbi_info(path.c_str(), &w, &h, &channels)) {
+            w = h = 0;
+        }
+        
+        UL.lock();
+        auto it = gProbed.find(path);
+        if(it != gProbed.end()) {
+            it->second.w = w;
+            it->second.h = h;
+            it->second.queued = false;
+        }
+        // Slides with placeholders are drawn again once for all the
+        // images probed together
+        if(gProbeQueue.empty()) {
+            NotifyWakeupFd();
+        }
+    }
+}
 
 static void CreateThreads() {
-    auto N = std::thread::hardware_concurrency();
-    if(N > 1) {
-        if(N > 4) {
-            // We don't want more than 3 threads doing I/O
-            N = 3;
-        } else {
-            N -= 1;
-        }
+    auto N = gDecodeThreadLimit;
+    if(N == 0) {
+        // Decoding is CPU-bound; one core is left for the UI
+        N = std::thread::hardware_concurrency();
+        N = (N > 1) ? N - 1 : 2;
+    }
+    auto io = gIOLimit ? gIOLimit : IMAGE_LOADER_DEFAULT_IO_LIMIT;
+    // NOTE(easimer): at least one thread is kept for the visible slide;
+    // the rest loads prefetched images too
+    unsigned background = N / 2;
+    unsigned foreground = N - background;
+    // The counts are read by the threads
+    gThread = new Thread[foreground];
+    gThreadCount = foreground;
+    gBackgroundThread = new Thread[background];
+    gBackgroundThreadCount = background;
+    for(unsigned i = 0; i < foreground; i++) {
+        gThread[i] = Thread(DecodeFunc, i, false);
+    }
+    for(unsigned i = 0; i < background; i++) {
+        gBackgroundThread[i] = Thread(DecodeFunc, foreground + i, true);
+    }
+    
+#if __linux__
+    gReadWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(gReadWakeFd != -1) {
+        gRing = Fetch_CreateRing(io);
+    }
+    // NOTE(easimer): the ring's thread only notices requests through this
+    // poll, so the reading threads are used if it can't be started
+    if(gRing && !Fetch_StartPoll(gRing, gReadWakeFd, &gReadWakeFd)) {
+        Fetch_DestroyRing(gRing);
+        gRing = NULL;
+    }
+#endif
+    gProbeThread = new Thread(ProbeFunc);
+    gCompressThread = new Thread(CompressFunc);
+    if(gRing) {
+        gReadThreadCount = 1;
+        gReadThread = new Thread[1];
+        gReadThread[0] = Thread(RingReadFunc, io);
     } else {
-        N = 2;
+        gReadThreadCount = io;
+        gReadThread = new Thread[io];
+        for(unsigned i = 0; i < io; i++) {
+            gReadThread[i] = Thread(ReadFunc);
+        }
     }
-    printf("Disk I/O on %u threads\n", N);
-    gThread = new Thread[N];
-    gThreadCount = N;
-    for(unsigned i = 0; i < N; i++) {
-        gThread[i] = Thread(ThreadFunc, i);
+    if(gVerbose) {
+        printf("Decoding images on %u threads (%u for visible images), reading %u files at a time%s\n",
+               N, foreground, io, gRing ? " with io_uring" : "");
     }
 }
 
 static void CleanupThreads() {
+    gCacheLock.lock();
     gShutdown = true;
-    for(unsigned i = 0; i < gThreadCount; i++) {
-        gSema.release();
+    NotifyStage(gReadQueue);
+    NotifyStage(gDecodeQueue);
+    gProbeCV.notify_all();
+    gCompressCV.notify_all();
+    gCacheLock.unlock();
+    gProbeThread->join();
+    delete gProbeThread;
+    gProbeThread = NULL;
+    gCompressThread->join();
+    delete gCompressThread;
+    gCompressThread = NULL;
+    for(unsigned i = 0; i < gReadThreadCount; i++) {
+        gReadThread[i].join();
     }
     for(unsigned i = 0; i < gThreadCount; i++) {
         gThread[i].join();
     }
+    for(unsigned i = 0; i < gBackgroundThreadCount; i++) {
+        gBackgroundThread[i].join();
+    }
+    Fetch_DestroyRing(gRing);
+    gRing = NULL;
+#if __linux__
+    if(gReadWakeFd != -1) {
+        close(gReadWakeFd);
+        gReadWakeFd = -1;
+    }
+#endif
+    gReadThreadCount = 0;
     gThreadCount = 0;
+    gBackgroundThreadCount = 0;
+    delete[] gReadThread;
     delete[] gThread;
+    delete[] gBackgroundThread;
+    gReadThread = NULL;
+    gThread = NULL;
+    gBackgroundThread = NULL;
+}
+
+// Prints the cache statistics and how long the stages took on average
+static void PrintStats() {
+    auto& stats = gCacheStats;
+    auto requests = stats.hits + stats.misses;
+    printf("Image cache: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, %lu cancelled\n",
+           stats.hits, stats.misses, requests ? 100.0 * stats.hits / requests : 0.0, stats.evictions,
+           stats.cancellations);
+    if(stats.finished[IMGSTAGE_READ] > 0) {
+        printf("Image loader: %lu files read in %.1f ms on average, %lu decoded in %.1f ms on average\n",
+               stats.finished[IMGSTAGE_READ], 1000 * stats.busy_seconds[IMGSTAGE_READ] / stats.finished[IMGSTAGE_READ],
+               stats.finished[IMGSTAGE_DECODE],
+               stats.finished[IMGSTAGE_DECODE] ? 1000 * stats.busy_seconds[IMGSTAGE_DECODE] / stats.finished[IMGSTAGE_DECODE] : 0.0);
+    }
+    if(stats.deduplicated > 0) {
+        printf("Image loader: %lu images had the same contents as another file and weren't decoded again\n",
+               stats.deduplicated);
+    }
+    auto lookups = stats.compressed_hits + stats.compressed_misses;
+    if(lookups > 0) {
+        printf("Compressed tier: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, %u images in %.1f MiB (%.1f MiB uncompressed), %.1f s spent compressing\n",
+               stats.compressed_hits, stats.compressed_misses, 100.0 * stats.compressed_hits / lookups,
+               stats.compressed_evictions, (unsigned)gCompressed.size(), stats.compressed_bytes / (1024.0 * 1024.0),
+               stats.compressed_raw_bytes / (1024.0 * 1024.0), stats.compress_seconds);
+    }
+    if(stats.disk_hits > 0) {
+        printf("Image loader: %lu images were found in the disk cache\n", stats.disk_hits);
+    }
+    if(stats.opaque > 0) {
+        printf("Image loader: %lu opaque images were stored without alpha%s\n", stats.opaque,
+               gRGB565 ? ", in 16 bits per pixel" : "");
+    }
 }
 
 void ImageLoader_Init() {
     gShutdown = false;
-    gRequestQueue = new Request_Queue;
+#if __linux__
+    gWakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+    if(gDiskCacheBudget > 0) {
+        gDiskCacheOpen = DiskCache_Open(gDiskCacheDir.empty() ? NULL : gDiskCacheDir.c_str(), gDiskCacheBudget);
+    }
     CreateThreads();
 }
 
 void ImageLoader_Shutdown() {
     CleanupThreads();
-    delete gRequestQueue;
-    gRequestQueue = NULL;
+    if(gDiskCacheOpen) {
+        DiskCache_Close();
+        gDiskCacheOpen = false;
+    }
+    
+#if __linux__
+    if(gWakeupFd != -1) {
+        close(gWakeupFd);
+        gWakeupFd = -1;
+    }
+#endif
+    
+    // Requests that were never processed
+    for(auto queues : {gReadQueue, gDecodeQueue}) {
+        for(int pri = 0; pri < IMGPRI_MAX; pri++) {
+            for(auto img : queues[pri]) {
+                Fetch_Free(&img->file);
+                img->queue = NULL;
+                if(!img->cached) {
+                    DeleteImage(img);
+                }
+            }
+            queues[pri].clear();
+        }
+    }
+    
+    if(gVerbose) {
+        PrintStats();
+        ImageLoader_PrintTimings();
+    }
+    
+    // Images still referenced by someone are leaked
+    for(auto& it : gCache) {
+        if(it.second->refcount == 0) {
+            DeleteImage(it.second);
+        }
+    }
+    gCache.clear();
+    gContent.clear();
+    for(auto pixels : gCompressQueue) {
+        FreePixels(pixels);
+    }
+    gCompressQueue.clear();
+    gCompressQueueBytes = 0;
+    for(auto& it : gCompressed) {
+        free(it.second.data);
+    }
+    gCompressed.clear();
+    gCompressedLRU.clear();
+    gProbed.clear();
+    gProbeQueue.clear();
+    gLRU.clear();
+    gCacheStats = {};
+    memset(gTimings, 0, sizeof(gTimings));
 }
 
-Promised_Image* ImageLoader_Request(const char* path) {
+Promised_Image* ImageLoader_Request(const char* path, Image_Priority priority) {
     Promised_Image* ret = NULL;
+    Cached_Image* img = NULL;
+    File_Version version = {0, 0};
     
-    if(path && gRequestQueue) {
-        ret = new Promised_Image(std::string(path));
-        gQueueLock.lock();
-        gRequestQueue->push(ret);
-        gQueueLock.unlock();
-        //printf("Client thread notifying threads about '%p'\n", ret);
-        gSema.release();
+    assert(priority >= 0 && priority < IMGPRI_MAX);
+    if(path && gThreadCount > 0) {
+        GetFileVersion(path, &version);
+        
+        gCacheLock.lock();
+        auto it = gCache.find(path);
+        if(it != gCache.end()) {
+            if(it->second->version == version) {
+                img = it->second;
+            } else {
+                // The file has changed since it was loaded
+                Uncache(it->second);
+            }
+        }
+        if(img) {
+            gCacheStats.hits++;
+        } else {
+            gCacheStats.misses++;
+            img = new Cached_Image(path, version);
+            gCache[img->path] = img;
+            img->queued = Clock::now();
+            Enqueue(img, gReadQueue, priority);
+        }
+        Retain(img);
+        img->wanted[priority]++;
+        UpdateQueuePosition(img);
+        gCacheLock.unlock();
+        
+        ret = new Promised_Image;
+        ret->image = img;
+        ret->priority = priority;
     }
     
     return ret;
 }
 
-Loaded_Image* ImageLoader_Await(Promised_Image* pimg) {
-    Loaded_Image* ret = NULL;
+void ImageLoader_SetPriority(Promised_Image* pimg, Image_Priority priority) {
+    assert(priority >= 0 && priority < IMGPRI_MAX);
+    if(pimg && pimg->priority != priority) {
+        gCacheLock.lock();
+        pimg->image->wanted[pimg->priority]--;
+        pimg->image->wanted[priority]++;
+        pimg->priority = priority;
+        UpdateQueuePosition(pimg->image);
+        gCacheLock.unlock();
+    }
+}
+
+bool ImageLoader_AwaitFor(Promised_Image* pimg, long timeout_ms, Loaded_Image** out) {
+    bool ret = true;
     
+    assert(out);
+    *out = NULL;
     if(pimg) {
+        auto img = pimg->image;
+        // Whoever waits for an image is showing it
+        ImageLoader_SetPriority(pimg, IMGPRI_VISIBLE);
         //printf("Client thread awaiting on '%p'\n", pimg);
-        while(!pimg->processed) {
-            std::this_thread::yield();
-        }
-        if(pimg->buffer) {
-            ret = new Loaded_Image;
-            ret->buffer = (char*)pimg->buffer;
-            ret->width = pimg->w;
-            ret->height = pimg->h;
+        ret = img->done.Wait(timeout_ms);
+        if(ret) {
+            gCacheLock.lock();
+            img->wanted[pimg->priority]--;
+            if(img->buffer) {
+                // The reference held by the promise is passed on
+                auto limg = new Loaded_Image;
+                limg->buffer = (char*)img->buffer;
+                limg->width = img->w;
+                limg->height = img->h;
+                limg->format = img->pixels->format;
+                limg->mip_count = img->pixels->mip_count;
+                for(int i = 0; i < limg->mip_count; i++) {
+                    limg->mips[i] = img->pixels->mips[i];
+                }
+                limg->image = img;
+                *out = limg;
+            } else {
+                Release(img);
+            }
+            gCacheLock.unlock();
+            delete pimg;
         }
     }
     
     return ret;
 }
 
+Loaded_Image* ImageLoader_Await(Promised_Image* pimg) {
+    Loaded_Image* ret = NULL;
+    ImageLoader_AwaitFor(pimg, -1, &ret);
+    return ret;
+}
+
+bool ImageLoader_Poll(Promised_Image* pimg) {
+    bool ret = true;
+    if(pimg) {
+        ret = pimg->image->done.Poll();
+    }
+    return ret;
+}
+
+void ImageLoader_Free(Promised_Image* pimg) {
+    if(pimg) {
+        gCacheLock.lock();
+        pimg->image->wanted[pimg->priority]--;
+        UpdateQueuePosition(pimg->image);
+        Release(pimg->image);
+        gCacheLock.unlock();
+        delete pimg;
+    }
+}
+
 void ImageLoader_Free(Loaded_Image* limg) {
     if(limg) {
-        stbi_image_free(limg->buffer);
+        gCacheLock.lock();
+        Release(limg->image);
+        gCacheLock.unlock();
         delete limg;
     }
 }
+
+void ImageLoader_SetDecodeThreads(unsigned count) {
+    gDecodeThreadLimit = count;
+}
+
+void ImageLoader_SetIOLimit(unsigned count) {
+    gIOLimit = count;
+}
+
+void ImageLoader_SetDiskCache(const char* dir, size_t budget) {
+    gDiskCacheDir = dir ? dir : "";
+    gDiskCacheBudget = budget;
+}
+
+void ImageLoader_SetRGB565(bool enable) {
+    Lock_Guard G(gCacheLock);
+    gRGB565 = enable;
+}
+
+void ImageLoader_SetMaxImageWidth(unsigned width) {
+    Lock_Guard G(gCacheLock);
+    gMaxImageWidth = width;
+}
+
+unsigned ImageLoader_GetMaxImageWidth() {
+    Lock_Guard G(gCacheLock);
+    return gMaxImageWidth;
+}
+
+int ImageLoader_GetWakeupFd() {
+    return gWakeupFd;
+}
+
+void ImageLoader_AckWakeup() {
+#if __linux__
+    if(gWakeupFd != -1) {
+        uint64_t count;
+        (void)!read(gWakeupFd, &count, sizeof(count));
+    }
+#endif
+}
+
+void ImageLoader_SetCacheBudget(size_t bytes) {
+    gCacheLock.lock();
+    gCacheBudget = bytes;
+    EnforceCacheBudget();
+    gCacheLock.unlock();
+}
+
+void ImageLoader_SetCompressedBudget(size_t bytes) {
+    gCacheLock.lock();
+    gCompressedBudget = bytes;
+    EnforceCompressedBudget();
+    gCacheLock.unlock();
+}
+
+void ImageLoader_GetCacheStats(Image_Cache_Stats* out) {
+    assert(out);
+    if(out) {
+        gCacheLock.lock();
+        *out = gCacheStats;
+        out->entries = (unsigned)gCache.size();
+        out->budget = gCacheBudget;
+        out->compressed_entries = (unsigned)gCompressed.size();
+        out->compressed_budget = gCompressedBudget;
+        gCacheLock.unlock();
+    }
+}
+
+void ImageLoader_Probe(const char* path) {
+    File_Version version = {0, 0};
+    assert(path);
+    if(path && gThreadCount > 0) {
+        GetFileVersion(path, &version);
+        Lock_Guard G(gCacheLock);
+        auto it = gProbed.find(path);
+        if(it == gProbed.end() || !(it->second.version == version)) {
+            // New or changed since it was probed
+            auto& probed = gProbed[path];
+            probed.version = version;
+            probed.w = probed.h = 0;
+            if(!probed.queued) {
+                probed.queued = true;
+                gProbeQueue.push_back(path);
+                gProbeCV.notify_one();
+            }
+        }
+    }
+}
+
+bool ImageLoader_GetSize(const char* path, int* width, int* height) {
+    bool ret = false;
+    assert(path && width && height);
+    if(path && width && height) {
+        Lock_Guard G(gCacheLock);
+        auto it = gProbed.find(path);
+        if(it != gProbed.end() && !it->second.queued && it->second.w > 0) {
+            *width = it->second.w;
+            *height = it->second.h;
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+void ImageLoader_SetVerbose(bool verbose) {
+    gVerbose = verbose;
+}
+
+// Prints a duration given in microseconds as milliseconds
+static void PrintLimit(const char* prefix, double us) {
+    printf(" %s%gms", prefix, us / 1000);
+}
+
+void ImageLoader_PrintTimings() {
+    Format_Timings timings[IMGFMT_MAX];
+    gCacheLock.lock();
+    memcpy(timings, gTimings, sizeof(timings));
+    gCacheLock.unlock();
+    
+    printf("Image loading times in milliseconds (count, average, maximum, histogram):\n");
+    for(int fmt = 0; fmt < IMGFMT_MAX; fmt++) {
+        auto& T = timings[fmt];
+        if(T.files == 0) {
+            continue;
+        }
+        printf("  %s: %lu files, %.1f MiB read, %.1f MiB decoded\n", gFormatNames[fmt], T.files,
+               T.file_bytes / (1024.0 * 1024.0), T.pixel_bytes / (1024.0 * 1024.0));
+        for(int step = 0; step < LOADSTEP_MAX; step++) {
+            auto& H = T.steps[step];
+            if(H.count == 0) {
+                continue;
+            }
+            printf("    %-8s %5lu %9.3f %9.3f  ", gLoadStepNames[step], H.count,
+                   H.total_us / H.count / 1000, H.max_us / 1000);
+            for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+                if(H.buckets[i] == 0) {
+                    continue;
+                }
+                // Every bucket is labeled with it's upper limit, except
+                // the last one
+                if(i < HISTOGRAM_BUCKETS - 1) {
+                    PrintLimit("<", (double)(2ull << i));
+                } else {
+                    PrintLimit(">=", (double)(1ull << i));
+                }
+                printf(":%lu", H.buckets[i]);
+            }
+            printf("\n");
+        }
+    }
+}
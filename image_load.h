@@ -15,18 +15,175 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
+#include <stddef.h>
 #include "arena.h"
+#include "pixel.h"
 
 struct Promised_Image;
+struct Cached_Image;
+
+// A smaller version of an image
+struct Image_Mip {
+    char* buffer;
+    int width, height;
+};
+
+// Number of mip levels an image may have at most
+#define IMAGE_MAX_MIPS (7)
 
 struct Loaded_Image {
     char* buffer;
     int width, height;
+    // Opaque images are stored without alpha, see ImageLoader_SetRGB565.
+    // The mips have the same format.
+    Pixel_Format format;
+    // Versions of the image that are half as large as the previous one,
+    // so that it can be drawn small without filtering every pixel. Only
+    // large images have them.
+    int mip_count;
+    Image_Mip mips[IMAGE_MAX_MIPS];
+    
+    Cached_Image* image; // owner of `buffer` and of the mips
+};
+
+// How soon a requested image is needed
+enum Image_Priority {
+    // Might be needed later
+    IMGPRI_WARMUP = 0,
+    // On a slide near the current one
+    IMGPRI_PREFETCH,
+    // On the current slide
+    IMGPRI_VISIBLE,
+    IMGPRI_MAX
+};
+
+// Stages of loading an image
+enum Image_Stage {
+    // Reading the file into memory
+    IMGSTAGE_READ = 0,
+    // Decoding and converting the pixels
+    IMGSTAGE_DECODE,
+    IMGSTAGE_MAX
+};
+
+struct Image_Cache_Stats {
+    unsigned long hits; // requests that didn't need a decode
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long cancellations; // requests given up on before loading
+    unsigned entries;
+    size_t bytes; // size of the decoded images in memory
+    size_t budget;
+    
+    unsigned queued[IMGSTAGE_MAX]; // images waiting for each stage
+    unsigned long finished[IMGSTAGE_MAX]; // images through each stage
+    double busy_seconds[IMGSTAGE_MAX]; // time spent in each stage
+    unsigned long deduplicated; // images sharing the pixels of a file with the same contents
+    unsigned long disk_hits; // images that didn't need a decode thanks to the disk cache
+    unsigned long opaque; // images stored without alpha
+    
+    // The compressed tier, where evicted images are kept compressed
+    unsigned compressed_entries;
+    size_t compressed_bytes; // compressed size of the images in it
+    size_t compressed_raw_bytes; // their size uncompressed
+    size_t compressed_budget;
+    unsigned long compressed_hits; // decodes avoided by restoring an image from it
+    unsigned long compressed_misses;
+    unsigned long compressed_evictions;
+    double compress_seconds; // time spent compressing
 };
 
+// Decoded images are kept in a cache until it grows over this many bytes
+#define IMAGE_CACHE_DEFAULT_BUDGET ((size_t)256 * 1024 * 1024)
+// Evicted images are kept compressed until they take this many bytes
+#define IMAGE_COMPRESSED_DEFAULT_BUDGET ((size_t)128 * 1024 * 1024)
+// Default number of image files read at the same time
+#define IMAGE_LOADER_DEFAULT_IO_LIMIT (4)
+
 void ImageLoader_Init();
 void ImageLoader_Shutdown();
-Promised_Image* ImageLoader_Request(const char* path);
+// Requests an image to be loaded in the background. If the image (with
+// the same modification time and size) is in the cache then nothing is
+// decoded. Files with the same contents share one decoded image. More
+// important requests are loaded first; prefetch and warm-up requests are
+// loaded by threads of lower OS priority.
+Promised_Image* ImageLoader_Request(const char* path, Image_Priority priority = IMGPRI_VISIBLE);
+// Changes the priority of a request that may still be waiting
+void ImageLoader_SetPriority(Promised_Image* pimg, Image_Priority priority);
+// Waits for a requested image, sleeping until it's loaded. The promise
+// can't be used afterwards.
+// Returns NULL if the image couldn't be loaded.
 Loaded_Image* ImageLoader_Await(Promised_Image* pimg);
-//void ImageLoader_Free(Promised_Image* pimg);
+// Like ImageLoader_Await but waits at most `timeout_ms` milliseconds.
+// Returns false on timeout; the promise can then still be waited on.
+// Otherwise the promise is consumed and `*out` is set like
+// ImageLoader_Await's return value.
+bool ImageLoader_AwaitFor(Promised_Image* pimg, long timeout_ms, Loaded_Image** out);
+// Returns whether a requested image is ready, i.e. whether waiting for
+// it would return immediately. Never blocks.
+bool ImageLoader_Poll(Promised_Image* pimg);
+// Gives up on a requested image without waiting for it. If nobody else
+// has requested the image and it's loading hasn't started yet then the
+// request is cancelled.
+void ImageLoader_Free(Promised_Image* pimg);
 void ImageLoader_Free(Loaded_Image* limg);
+
+// Sets how many threads decode images; 0 (the default) means one for
+// every core but one. Takes effect at the next ImageLoader_Init.
+void ImageLoader_SetDecodeThreads(unsigned count);
+// Sets how many image files may be read at the same time; 0 means
+// IMAGE_LOADER_DEFAULT_IO_LIMIT. Takes effect at the next ImageLoader_Init.
+void ImageLoader_SetIOLimit(unsigned count);
+
+// Keeps decoded images on disk in `dir` (or in the user's cache
+// directory if NULL), so that they aren't decoded again the next time
+// present is started. Images are found by the contents of their file.
+// At most `budget` bytes are used; 0 (the default) disables the cache.
+// Takes effect at the next ImageLoader_Init.
+void ImageLoader_SetDiskCache(const char* dir, size_t budget);
+
+// Images wider than this are shrunk right after decoding, so that they
+// take less memory and are faster to draw; 0 (the default) keeps every
+// image at it's original size. Only affects images decoded afterwards,
+// so it should be set before any image is requested.
+void ImageLoader_SetMaxImageWidth(unsigned width);
+unsigned ImageLoader_GetMaxImageWidth();
+
+// Stores opaque images in PIXFMT_RGB16_565 rather than PIXFMT_RGB24,
+// which halves their size at the cost of color depth, for machines short
+// on memory; off by default. Images with transparent pixels are always
+// stored in PIXFMT_ARGB32. Only affects images decoded afterwards.
+void ImageLoader_SetRGB565(bool enable);
+
+// Starts reading the size of an image from the header of it's file in
+// the background, which is much cheaper than loading it. The file isn't
+// read again unless it has changed. The wakeup descriptor becomes
+// readable once the probed images' sizes are known.
+void ImageLoader_Probe(const char* path);
+// Returns the size of a probed image as stored in it's file, i.e. before
+// it's shrunk. Returns false if it's not known (yet). Never blocks.
+bool ImageLoader_GetSize(const char* path, int* width, int* height);
+
+// Returns a file descriptor that becomes readable when a requested image
+// has finished loading, or -1 if the platform doesn't support this.
+// The descriptor is owned by the loader and is valid until
+// ImageLoader_Shutdown.
+int ImageLoader_GetWakeupFd();
+// Makes the wakeup descriptor non-readable until the next image is loaded
+void ImageLoader_AckWakeup();
+
+// Sets how much memory the cached images may use. Images that are in use
+// are never evicted, so the cache may temporarily grow over the budget.
+void ImageLoader_SetCacheBudget(size_t bytes);
+// Sets how much memory the compressed tier may use. Images evicted from
+// the cache are compressed (losslessly) and kept there, so that they can
+// be restored without decoding their file again; 0 disables it.
+void ImageLoader_SetCompressedBudget(size_t bytes);
+void ImageLoader_GetCacheStats(Image_Cache_Stats* out);
+
+// Prints how long each step of loading images took (waiting in the
+// queues, reading, decoding and converting), for each file format
+void ImageLoader_PrintTimings();
+// Makes the loader print it's configuration on ImageLoader_Init, and it's
+// statistics and timings on ImageLoader_Shutdown; off by default
+void ImageLoader_SetVerbose(bool verbose);
@@ -15,33 +15,258 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <locale.h>
 #include <assert.h>
+#include <string>
+#include <chrono>
 #include "display.h"
 #include "present.h"
 #include "render_queue.h"
+#include "bench.h"
+#include "watch.h"
+#include "tiles.h"
+#if !_WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
 
-static void RenderLoop(const char* filename) {
+// How often a streamed presentation is read if the display can't wake
+// up when it's readable
+#define STREAM_POLL_MS (100)
+
+struct Reload_State {
+    Present_File* file;
+    bool reload; // the presentation has to be reloaded
+    bool redraw; // an image on the current slide has changed
+};
+
+static void WatchDependency(const char* path, Present_Dependency kind, void* user) {
+    Watch_AddFile((File_Watch*)user, path, kind);
+}
+
+static void OnFileChanged(const char* path, int tag, void* user) {
+    auto state = (Reload_State*)user;
+    if(tag == PDEP_PRESENTATION) {
+        state->reload = true;
+    } else if(Present_CurrentSlideShowsImage(state->file, path)) {
+        state->redraw = true;
+    }
+}
+
+// Reloads the presentation if any of the files it uses have changed.
+// Returns whether the current slide has to be redrawn.
+static bool HandleFileChanges(File_Watch* watch, Present_File** file) {
+    Reload_State state = {*file, false, false};
+    
+    Watch_ReadChanges(watch, OnFileChanged, &state);
+    if(state.reload) {
+        auto start = std::chrono::steady_clock::now();
+        *file = Present_Reload(*file);
+        // Included files or images may have been added or removed
+        Watch_Clear(watch);
+        Present_ForEachDependency(*file, WatchDependency, watch);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        fprintf(stderr, "Presentation reloaded in %.2f ms\n", elapsed.count());
+    }
+    
+    return state.reload || state.redraw;
+}
+
+#if !_WIN32
+// Written to when the user sends SIGUSR1 to get the image loading times
+static int gStatsPipe[2] = {-1, -1};
+
+static void OnStatsSignal(int) {
+    char c = 0;
+    // If the pipe is full then it's readable anyway
+    (void)!write(gStatsPipe[1], &c, 1);
+}
+#endif
+
+// Prints the image loading times whenever the user sends SIGUSR1
+static void ListenForStatsSignal(Display* disp) {
+#if !_WIN32
+    if(pipe(gStatsPipe) == 0) {
+        for(int i = 0; i < 2; i++) {
+            fcntl(gStatsPipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(gStatsPipe[i], F_SETFD, FD_CLOEXEC);
+        }
+        if(Display_AddWakeupSource(disp, gStatsPipe[0], DISPEV_STATS)) {
+            struct sigaction sa = {};
+            sa.sa_handler = OnStatsSignal;
+            sa.sa_flags = SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGUSR1, &sa, NULL);
+        } else {
+            close(gStatsPipe[0]);
+            close(gStatsPipe[1]);
+            gStatsPipe[0] = gStatsPipe[1] = -1;
+        }
+    }
+#endif
+}
+
+static void StopListeningForStatsSignal(Display* disp) {
+#if !_WIN32
+    if(gStatsPipe[0] != -1) {
+        signal(SIGUSR1, SIG_DFL);
+        Display_RemoveWakeupSource(disp, gStatsPipe[0]);
+        close(gStatsPipe[0]);
+        close(gStatsPipe[1]);
+        gStatsPipe[0] = gStatsPipe[1] = -1;
+    }
+#endif
+}
+
+static void HandleStatsSignal() {
+#if !_WIN32
+    char buf[64];
+    while(read(gStatsPipe[0], buf, sizeof(buf)) > 0) {
+    }
+#endif
+    ImageLoader_PrintTimings();
+    fflush(stdout);
+}
+
+struct Render_Options {
+    // How many slides' images are loaded in advance, -1 if not set
+    int prefetch_ahead;
+    int prefetch_behind;
+    // Load the images of every slide in advance
+    bool warm;
+};
+
+struct Warmup_Report {
+    bool active;
+    unsigned last_loaded;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Requests more images for the warm-up and prints it's progress
+static void UpdateWarmup(Present_File* file, Warmup_Report* report) {
+    Present_Warmup_Progress progress;
+    if(report->active && Present_UpdateWarmup(file, &progress)) {
+        if(progress.loaded != report->last_loaded) {
+            fprintf(stderr, "Warming up: %u of %u images loaded (%.1f MiB)\n", progress.loaded, progress.total,
+                    progress.bytes / (1024.0 * 1024.0));
+            report->last_loaded = progress.loaded;
+        }
+        if(progress.done) {
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - report->start);
+            fprintf(stderr, "Warm-up %s after %.2f s\n",
+                    progress.loaded < progress.total ? "stopped at the image cache's budget" : "finished",
+                    elapsed.count());
+            report->active = false;
+        }
+    }
+}
+
+static void RenderLoop(const char* filename, const Render_Options& options) {
     Display* disp;
     Present_File* file;
     Display_Event ev;
     bool requested_exit = false;
+    bool redraw;
+    bool partial; // only `area` of the slide changed
+    RQ_Rect area;
     Render_Queue* rq = NULL;
+    File_Watch* watch = NULL;
+    int stream_fd;
+    bool poll_stream = false;
+    Warmup_Report warmup = {false, 0, {}};
 
     ImageLoader_Init();
+    Tiles_Init();
 
-    // Open presentation file
-    file = Present_Open(filename);
+    // Open presentation file; "-" is the standard input
+    if(strcmp(filename, "-") == 0) {
+        file = Present_OpenStream(fileno(stdin));
+    } else {
+        file = Present_Open(filename);
+    }
+    if(file && options.prefetch_ahead >= 0) {
+        Present_SetPrefetch(file, options.prefetch_ahead, options.prefetch_behind);
+    }
     if(file) {
         // Open a window
         disp = Display_Open();
         if(disp) {
+            // NOTE(easimer): an image is never drawn wider than the screen
+            // but it's drawn height is relative to the screen height (see
+            // PlaceImage), so on a portrait screen it may need more pixels
+            int disp_w, disp_h;
+            Display_GetMaxSize(disp, &disp_w, &disp_h);
+            ImageLoader_SetMaxImageWidth(disp_w > disp_h ? disp_w : disp_h);
+            
+            // NOTE(easimer): the warm-up starts once the images' size is
+            // known, otherwise they'd be decoded at full size
+            if(options.warm) {
+                Image_Cache_Stats stats;
+                ImageLoader_GetCacheStats(&stats);
+                // Warming up more than what fits into the cache would
+                // evict the first images
+                warmup.active = true;
+                warmup.start = std::chrono::steady_clock::now();
+                Present_StartWarmup(file, stats.budget);
+                UpdateWarmup(file, &warmup);
+            }
+            
+            // Watch the presentation and it's images so that they can
+            // be reloaded while rehearsing
+            watch = Watch_Create();
+            if(watch) {
+                Present_ForEachDependency(file, WatchDependency, watch);
+                if(!Display_AddWakeupSource(disp, Watch_GetFd(watch), DISPEV_RELOAD)) {
+                    Watch_Destroy(watch);
+                    watch = NULL;
+                }
+            }
+            if(!watch && Present_GetStreamFd(file) == -1) {
+                fprintf(stderr, "Can't watch the presentation for changes; it won't be reloaded when it's edited\n");
+            }
+            
+            // Slides of a streamed presentation are parsed as they arrive
+            stream_fd = Present_GetStreamFd(file);
+            if(stream_fd != -1 && !Display_AddWakeupSource(disp, stream_fd, DISPEV_STREAM)) {
+                // Read on a timer instead, so that the slide counter keeps
+                // up while nobody touches the keyboard
+                poll_stream = true;
+            }
+            
+            // Slides are shown before their images are loaded and are
+            // drawn again as the images arrive
+            // NOTE(easimer): tiles of large images are drawn as they arrive
+            // too; without a wakeup descriptor they're waited for
+            if(Display_AddWakeupSource(disp, ImageLoader_GetWakeupFd(), DISPEV_IMAGE) &&
+               Display_AddWakeupSource(disp, Tiles_GetWakeupFd(), DISPEV_IMAGE)) {
+                Present_SetProgressive(file, true);
+            }
+            ListenForStatsSignal(disp);
+
             // Loop until the presentation is over or
             // the user has requested an exit (by pressing ESC)
             while(!Present_Over(file) && !requested_exit) {
+                // Animated GIFs on the slide wake the loop up when their
+                // next frame is due, and so does a stream that's polled
+                int wait = Present_GetAnimationWait(file);
+                if(poll_stream && (wait < 0 || wait > STREAM_POLL_MS)) {
+                    wait = STREAM_POLL_MS;
+                }
+                Display_SetTimer(disp, wait);
                 // Wait for an event
                 if(Display_FetchEvent(disp, ev)) {
                     int f;
+                    bool stream_changed = false;
+                    redraw = true;
+                    partial = false;
+                    UpdateWarmup(file, &warmup);
+                    if(poll_stream) {
+                        stream_changed = Present_ReadStream(file);
+                        poll_stream = Present_GetStreamFd(file) != -1;
+                    }
                     switch(ev) {
                         case DISPEV_PREV:
                         f = Present_Seek(file, -1);
@@ -66,16 +291,73 @@ static void RenderLoop(const char* filename) {
                         case DISPEV_EXEC:
                         Present_ExecuteCommandOnCurrentSlide(file);
                         break;
+                        case DISPEV_RELOAD:
+                        redraw = HandleFileChanges(watch, &file);
+                        break;
+                        case DISPEV_IMAGE:
+                        ImageLoader_AckWakeup();
+                        Tiles_AckWakeup();
+                        // Images of other slides may have been prefetched
+                        redraw = Present_ImagesPending(file);
+                        break;
+                        case DISPEV_STATS:
+                        HandleStatsSignal();
+                        redraw = false;
+                        break;
+                        case DISPEV_TIMER:
+                        redraw = Present_UpdateAnimations(file, &area);
+                        partial = true;
+                        break;
+                        case DISPEV_LEFT:
+                        case DISPEV_RIGHT:
+                        // Pans a zoomed in image, otherwise seeks
+                        if(Present_IsZoomed(file)) {
+                            redraw = Present_Pan(file, ev == DISPEV_LEFT ? -1 : 1, 0);
+                        } else {
+                            f = Present_Seek(file, ev == DISPEV_LEFT ? -1 : 1);
+                        }
+                        break;
+                        case DISPEV_UP:
+                        case DISPEV_DOWN:
+                        redraw = Present_Pan(file, 0, ev == DISPEV_UP ? -1 : 1);
+                        break;
+                        case DISPEV_ZOOM_IN:
+                        redraw = Present_Zoom(file, 1);
+                        break;
+                        case DISPEV_ZOOM_OUT:
+                        redraw = Present_Zoom(file, -1);
+                        break;
+                        case DISPEV_ZOOM_RESET:
+                        redraw = Present_Zoom(file, 0);
+                        break;
+                        case DISPEV_STREAM:
+                        redraw = Present_ReadStream(file);
+                        if(Present_GetStreamFd(file) == -1) {
+                            Display_RemoveWakeupSource(disp, stream_fd);
+                        }
+                        break;
                         default:
                         assert(!"Unhandled event");
                         break;
                         }
+                    if(stream_changed) {
+                        // Slides were added; the whole slide is drawn
+                        redraw = true;
+                        partial = false;
+                    }
+                    if(!redraw) {
+                        continue;
+                    }
                     // Allocate an empty render buffer
                     rq = RQ_Alloc();
                     // Only re-render if something happened
                     Present_FillRenderQueue(file, rq);
                     // Display render queue
-                    Display_RenderQueue(disp, rq);
+                    if(partial) {
+                        Display_RenderQueueArea(disp, rq, &area);
+                    } else {
+                        Display_RenderQueue(disp, rq);
+                    }
                     // Free render queue
                     RQ_Free(rq);
                     // NOTE(easimer): previously we allocated an RQ once at startup
@@ -83,22 +365,119 @@ static void RenderLoop(const char* filename) {
                     // DisplayRenderQueue call. But due to images, render queues
                     // can get quite large and we don't want to hold megabytes of memory 
                     // hostage while not even using it.
+                    
+                    // Slides of included files are loaded on demand,
+                    // their images are only known now
+                    if(watch) {
+                        Present_ForEachDependency(file, WatchDependency, watch);
+                    }
                 }
             }
+            StopListeningForStatsSignal(disp);
+            Watch_Destroy(watch);
             Display_Close(disp);
         }
         Present_Close(file);
     }
 
+    Tiles_Shutdown();
     ImageLoader_Shutdown();
 }
 
+// Handles an option that takes a value.
+// Returns false if `name` is not such an option.
+static bool ParseOption(const char* name, const char* value, Render_Options* options) {
+    bool ret = true;
+    if(strcmp(name, "--image-cache") == 0) {
+        // Budget of the decoded image cache in megabytes
+        ImageLoader_SetCacheBudget((size_t)atol(value) * 1024 * 1024);
+    } else if(strcmp(name, "--compressed-cache") == 0) {
+        // Budget of the evicted images kept compressed in megabytes
+        ImageLoader_SetCompressedBudget((size_t)atol(value) * 1024 * 1024);
+    } else if(strcmp(name, "--disk-cache") == 0) {
+        // Budget of the decoded images kept on disk in megabytes
+        ImageLoader_SetDiskCache(NULL, (size_t)atol(value) * 1024 * 1024);
+    } else if(strcmp(name, "--decode-threads") == 0) {
+        ImageLoader_SetDecodeThreads((unsigned)atoi(value));
+    } else if(strcmp(name, "--io-limit") == 0) {
+        ImageLoader_SetIOLimit((unsigned)atoi(value));
+    } else if(strcmp(name, "--prefetch") == 0) {
+        // AHEAD[,BEHIND]
+        int ahead = 0, behind = 0;
+        if(sscanf(value, "%d,%d", &ahead, &behind) >= 1 && ahead >= 0 && behind >= 0) {
+            options->prefetch_ahead = ahead;
+            options->prefetch_behind = behind;
+        } else {
+            fprintf(stderr, "Invalid --prefetch value '%s', expected AHEAD[,BEHIND]\n", value);
+        }
+    } else {
+        ret = false;
+    }
+    return ret;
+}
+
+// Handles an option that takes no value.
+// Returns false if `name` is not such an option.
+static bool ParseFlag(const char* name, Render_Options* options) {
+    bool ret = true;
+    if(strcmp(name, "-v") == 0) {
+        ImageLoader_SetVerbose(true);
+    } else if(strcmp(name, "--warm") == 0) {
+        options->warm = true;
+    } else if(strcmp(name, "--rgb565") == 0) {
+        ImageLoader_SetRGB565(true);
+    } else {
+        ret = false;
+    }
+    return ret;
+}
+
+static void PrintUsage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [-v] [--image-cache megabytes] [--prefetch ahead[,behind]]\n", argv0);
+    fprintf(stderr, "       %*s [--decode-threads count] [--io-limit count]\n", (int)strlen(argv0), "");
+    fprintf(stderr, "       %*s [--compressed-cache megabytes] [--disk-cache megabytes]\n", (int)strlen(argv0), "");
+    fprintf(stderr, "       %*s [--warm] [--rgb565] filename\n", (int)strlen(argv0), "");
+    fprintf(stderr, "       %s - (reads the presentation from the standard input)\n", argv0);
+    fprintf(stderr, "       %s --compile filename [output]\n", argv0);
+    fprintf(stderr, "       %s --bench name [arguments]\n", argv0);
+    fprintf(stderr, "  -v  print the image loader's statistics and timings on exit;\n");
+    fprintf(stderr, "      they're printed whenever SIGUSR1 is received too\n");
+    fprintf(stderr, "  --warm  load the images of every slide right away\n");
+    fprintf(stderr, "  --rgb565  store opaque images in 16 bits per pixel to save memory\n");
+}
+
 int main(int argc, char** argv) {
+    int ret = 0;
     setlocale(LC_ALL, "en_US.utf8");
-    if(argc == 2) {
-        RenderLoop(argv[1]);
+    Render_Options options = {-1, -1, false};
+    
+    // Options; they must come first
+    while(argc >= 3) {
+        if(ParseFlag(argv[1], &options)) {
+            argv[1] = argv[0];
+            argc -= 1;
+            argv += 1;
+        } else if(argc >= 4 && ParseOption(argv[1], argv[2], &options)) {
+            argv[2] = argv[0];
+            argc -= 2;
+            argv += 2;
+        } else {
+            break;
+        }
+    }
+    
+    if(argc == 2 && (argv[1][0] != '-' || strcmp(argv[1], "-") == 0)) {
+        RenderLoop(argv[1], options);
+    } else if(argc >= 3 && argc <= 4 && strcmp(argv[1], "--compile") == 0) {
+        // deck.prs is compiled to deck.prsc by default
+        std::string output = (argc == 4) ? argv[3] : std::string(argv[2]) + "c";
+        if(!Present_Compile(argv[2], output.c_str())) {
+            ret = 1;
+        }
+    } else if(argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        ret = Bench_Run(argc - 2, argv + 2);
     } else {
-        fprintf(stderr, "Usage: %s filename\n", argv[0]);
+        PrintUsage(argv[0]);
     }
-    return 0;
+    return ret;
 }
@@ -0,0 +1,424 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <assert.h>
+#include "pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PIXEL_X86 1
+#include <immintrin.h>
+#if _MSC_VER
+#include <intrin.h>
+// MSVC allows any intrinsic without enabling it for the whole file
+#define TARGET(isa)
+#else
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// c * a / 255, rounded to nearest; exact for every c and a
+static inline uint8_t MulDiv255(unsigned c, unsigned a) {
+    unsigned t = c * a + 128;
+    return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+static void ConvertScalar(uint8_t* pixels, size_t count, unsigned flags) {
+    bool swap = flags & PIXCONV_SWAP_RED_BLUE;
+    bool premultiply = flags & PIXCONV_PREMULTIPLY;
+    for(size_t i = 0; i < count; i++) {
+        auto px = pixels + i * 4;
+        uint8_t r = px[0], g = px[1], b = px[2], a = px[3];
+        if(premultiply) {
+            r = MulDiv255(r, a);
+            g = MulDiv255(g, a);
+            b = MulDiv255(b, a);
+        }
+        if(swap) {
+            uint8_t t = r;
+            r = b;
+            b = t;
+        }
+        px[0] = r;
+        px[1] = g;
+        px[2] = b;
+    }
+}
+
+// Halves pixels [from, to) of a destination row; `row0` and `row1` are
+// the two source rows it's made of
+static void HalveRowScalar(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, unsigned from, unsigned to) {
+    for(unsigned x = from; x < to; x++) {
+        auto a = row0 + x * 8;
+        auto b = row1 + x * 8;
+        for(int c = 0; c < 4; c++) {
+            dst[x * 4 + c] = (uint8_t)((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+        }
+    }
+}
+
+// Returns whether the alpha of every one of `count` pixels is 255
+static bool IsOpaqueScalar(const uint8_t* pixels, size_t count) {
+    bool ret = true;
+    for(size_t i = 0; ret && i < count; i++) {
+        ret = pixels[i * 4 + 3] == 255;
+    }
+    return ret;
+}
+
+#if PIXEL_X86
+// NOTE(easimer): the SIMD kernels widen the channels to 16 bits, then
+// for every pixel multiply R, G and B by A and A by 255, which divided by
+// 255 gives back A. Swapping red and blue is a shuffle of the 16-bit
+// lanes. The rounding is the same as MulDiv255's.
+
+TARGET("sse2")
+static inline __m128i Convert8x16_SSE2(__m128i px, bool swap, bool premultiply) {
+    if(premultiply) {
+        const __m128i alpha_lane = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        const __m128i c128 = _mm_set1_epi16(128);
+        // (a, a, a, 255) for both pixels
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_or_si128(_mm_andnot_si128(alpha_lane, a), _mm_and_si128(alpha_lane, _mm_set1_epi16(255)));
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, a), c128);
+        px = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+    if(swap) {
+        px = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+    }
+    return px;
+}
+
+TARGET("sse2")
+static void ConvertSSE2(uint8_t* pixels, size_t count, unsigned flags) {
+    bool swap = flags & PIXCONV_SWAP_RED_BLUE;
+    bool premultiply = flags & PIXCONV_PREMULTIPLY;
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        auto p = (__m128i*)(pixels + i * 4);
+        __m128i px = _mm_loadu_si128(p);
+        __m128i lo = Convert8x16_SSE2(_mm_unpacklo_epi8(px, zero), swap, premultiply);
+        __m128i hi = Convert8x16_SSE2(_mm_unpackhi_epi8(px, zero), swap, premultiply);
+        _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+    ConvertScalar(pixels + i * 4, count - i, flags);
+}
+
+TARGET("avx2")
+static inline __m256i Convert16x16_AVX2(__m256i px, bool swap, bool premultiply) {
+    if(premultiply) {
+        const __m256i alpha_lane = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+        const __m256i c128 = _mm256_set1_epi16(128);
+        __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm256_blendv_epi8(a, _mm256_set1_epi16(255), alpha_lane);
+        __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(px, a), c128);
+        px = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+    if(swap) {
+        px = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+    }
+    return px;
+}
+
+TARGET("avx2")
+static void ConvertAVX2(uint8_t* pixels, size_t count, unsigned flags) {
+    bool swap = flags & PIXCONV_SWAP_RED_BLUE;
+    bool premultiply = flags & PIXCONV_PREMULTIPLY;
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        auto p = (__m256i*)(pixels + i * 4);
+        __m256i px = _mm256_loadu_si256(p);
+        // Unpacking and packing work within 128-bit halves, so the
+        // pixels end up where they started
+        __m256i lo = Convert16x16_AVX2(_mm256_unpacklo_epi8(px, zero), swap, premultiply);
+        __m256i hi = Convert16x16_AVX2(_mm256_unpackhi_epi8(px, zero), swap, premultiply);
+        _mm256_storeu_si256(p, _mm256_packus_epi16(lo, hi));
+    }
+    ConvertSSE2(pixels + i * 4, count - i, flags);
+}
+
+// NOTE(easimer): halving adds the two source rows in 16-bit lanes, then
+// adds each pixel to it's right neighbour by splitting the even and odd
+// pixels with 64-bit unpacks.
+
+TARGET("sse2")
+static void HalveRowSSE2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, unsigned dst_w) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c2 = _mm_set1_epi16(2);
+    unsigned x = 0;
+    for(; x + 4 <= dst_w; x += 4) {
+        // 8 source pixels make 4 destination pixels
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16));
+        // Pixels 0-1, 2-3, 4-5, 6-7 of both rows added
+        __m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+        __m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67), _mm_unpackhi_epi64(s45, s67));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, c2), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, c2), 2);
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(lo, hi));
+    }
+    HalveRowScalar(row0, row1, dst, x, dst_w);
+}
+
+TARGET("avx2")
+static void HalveRowAVX2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, unsigned dst_w) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c2 = _mm256_set1_epi16(2);
+    unsigned x = 0;
+    for(; x + 8 <= dst_w; x += 8) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(row0 + x * 8));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(row0 + x * 8 + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(row1 + x * 8));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(row1 + x * 8 + 32));
+        // Same as the SSE2 kernel within each 128-bit half
+        __m256i s0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+        __m256i s1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+        __m256i s2 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+        __m256i s3 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+        __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi64(s0, s1), _mm256_unpackhi_epi64(s0, s1));
+        __m256i hi = _mm256_add_epi16(_mm256_unpacklo_epi64(s2, s3), _mm256_unpackhi_epi64(s2, s3));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, c2), 2);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, c2), 2);
+        // Packing interleaves the halves: pixels 0-1, 4-5, 2-3, 6-7
+        __m256i packed = _mm256_packus_epi16(lo, hi);
+        _mm256_storeu_si256((__m256i*)(dst + x * 4), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    HalveRowSSE2(row0 + x * 8, row1 + x * 8, dst + x * 4, dst_w - x);
+}
+
+// NOTE(easimer): the opacity kernels AND the pixels of a block together;
+// the alpha bytes of the result are 255 only if every pixel's were.
+// Transparent images are given up on after the first block with a
+// transparent pixel instead of reading the whole image.
+#define OPAQUE_BLOCK_PIXELS (256)
+
+TARGET("sse2")
+static bool IsOpaqueSSE2(const uint8_t* pixels, size_t count) {
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    bool ret = true;
+    size_t i = 0;
+    while(ret && i + 4 <= count) {
+        size_t end = (count - i > OPAQUE_BLOCK_PIXELS) ? i + OPAQUE_BLOCK_PIXELS : count;
+        __m128i acc = _mm_set1_epi32(-1);
+        for(; i + 4 <= end; i += 4) {
+            acc = _mm_and_si128(acc, _mm_loadu_si128((const __m128i*)(pixels + i * 4)));
+        }
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(acc, alpha), alpha);
+        ret = _mm_movemask_epi8(eq) == 0xFFFF;
+    }
+    return ret && IsOpaqueScalar(pixels + i * 4, count - i);
+}
+
+TARGET("avx2")
+static bool IsOpaqueAVX2(const uint8_t* pixels, size_t count) {
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    bool ret = true;
+    size_t i = 0;
+    while(ret && i + 8 <= count) {
+        size_t end = (count - i > OPAQUE_BLOCK_PIXELS) ? i + OPAQUE_BLOCK_PIXELS : count;
+        __m256i acc = _mm256_set1_epi32(-1);
+        for(; i + 8 <= end; i += 8) {
+            acc = _mm256_and_si256(acc, _mm256_loadu_si256((const __m256i*)(pixels + i * 4)));
+        }
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(acc, alpha), alpha);
+        ret = _mm256_movemask_epi8(eq) == -1;
+    }
+    return ret && IsOpaqueSSE2(pixels + i * 4, count - i);
+}
+
+static bool CpuSupports(Pixel_Kernel kernel) {
+    bool ret = false;
+#if _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] >> 26) & 1;
+    bool avx = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1); // OSXSAVE and AVX
+    bool avx2 = false;
+    if(avx && max_leaf >= 7 && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] >> 5) & 1;
+    }
+#else
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    switch(kernel) {
+        case PIXKERN_SCALAR: ret = true; break;
+        case PIXKERN_SSE2: ret = sse2; break;
+        case PIXKERN_AVX2: ret = avx2; break;
+        default: break;
+    }
+    return ret;
+}
+#else
+static bool CpuSupports(Pixel_Kernel kernel) {
+    return kernel == PIXKERN_SCALAR;
+}
+#endif
+
+bool Pixel_ConvertWith(Pixel_Kernel kernel, uint8_t* pixels, size_t count, unsigned flags) {
+    bool ret = false;
+    assert(pixels || count == 0);
+    if(CpuSupports(kernel)) {
+        switch(kernel) {
+#if PIXEL_X86
+            case PIXKERN_AVX2: ConvertAVX2(pixels, count, flags); break;
+            case PIXKERN_SSE2: ConvertSSE2(pixels, count, flags); break;
+#endif
+            default: ConvertScalar(pixels, count, flags); break;
+        }
+        ret = true;
+    }
+    return ret;
+}
+
+Pixel_Kernel Pixel_BestKernel() {
+    // Only looked at once
+    static const Pixel_Kernel best = []() {
+        int ret = PIXKERN_MAX - 1;
+        while(ret > PIXKERN_SCALAR && !CpuSupports((Pixel_Kernel)ret)) {
+            ret--;
+        }
+        return (Pixel_Kernel)ret;
+    }();
+    return best;
+}
+
+void Pixel_Convert(uint8_t* pixels, size_t count, unsigned flags) {
+    if(flags) {
+        Pixel_ConvertWith(Pixel_BestKernel(), pixels, count, flags);
+    }
+}
+
+bool Pixel_HalveWith(Pixel_Kernel kernel, const uint8_t* src, unsigned src_w, unsigned src_h, uint8_t* dst) {
+    bool ret = false;
+    unsigned dst_w = src_w / 2;
+    unsigned dst_h = src_h / 2;
+    assert((src && dst) || dst_w == 0 || dst_h == 0);
+    if(CpuSupports(kernel)) {
+        for(unsigned y = 0; y < dst_h; y++) {
+            auto row0 = src + (size_t)(y * 2) * src_w * 4;
+            auto row1 = row0 + (size_t)src_w * 4;
+            auto out = dst + (size_t)y * dst_w * 4;
+            switch(kernel) {
+#if PIXEL_X86
+                case PIXKERN_AVX2: HalveRowAVX2(row0, row1, out, dst_w); break;
+                case PIXKERN_SSE2: HalveRowSSE2(row0, row1, out, dst_w); break;
+#endif
+                default: HalveRowScalar(row0, row1, out, 0, dst_w); break;
+            }
+        }
+        ret = true;
+    }
+    return ret;
+}
+
+void Pixel_Halve(const uint8_t* src, unsigned src_w, unsigned src_h, uint8_t* dst) {
+    Pixel_HalveWith(Pixel_BestKernel(), src, src_w, src_h, dst);
+}
+
+const char* Pixel_KernelName(Pixel_Kernel kernel) {
+    const char* ret = "?";
+    switch(kernel) {
+        case PIXKERN_SCALAR: ret = "scalar"; break;
+        case PIXKERN_SSE2: ret = "SSE2"; break;
+        case PIXKERN_AVX2: ret = "AVX2"; break;
+        default: break;
+    }
+    return ret;
+}
+
+size_t Pixel_Stride(Pixel_Format format, unsigned width) {
+    size_t ret = (size_t)width * 4;
+    if(format == PIXFMT_RGB16_565) {
+        ret = ((size_t)width * 2 + 3) & ~(size_t)3;
+    }
+    return ret;
+}
+
+bool Pixel_IsOpaqueWith(Pixel_Kernel kernel, const uint8_t* pixels, size_t count, bool* opaque) {
+    bool ret = false;
+    assert((pixels || count == 0) && opaque);
+    if(CpuSupports(kernel)) {
+        switch(kernel) {
+#if PIXEL_X86
+            case PIXKERN_AVX2: *opaque = IsOpaqueAVX2(pixels, count); break;
+            case PIXKERN_SSE2: *opaque = IsOpaqueSSE2(pixels, count); break;
+#endif
+            default: *opaque = IsOpaqueScalar(pixels, count); break;
+        }
+        ret = true;
+    }
+    return ret;
+}
+
+bool Pixel_IsOpaque(const uint8_t* pixels, size_t count) {
+    bool ret = false;
+    Pixel_IsOpaqueWith(Pixel_BestKernel(), pixels, count, &ret);
+    return ret;
+}
+
+void Pixel_PackRGB565(const uint8_t* src, unsigned w, unsigned h, uint8_t* dst) {
+    size_t stride = Pixel_Stride(PIXFMT_RGB16_565, w);
+    assert((src && dst) || w == 0 || h == 0);
+    // NOTE(easimer): a packed row never reaches past the start of the
+    // unpacked pixels it's made of that weren't read yet, so packing in
+    // place works
+    for(unsigned y = 0; y < h; y++) {
+        auto in = src + (size_t)y * w * 4;
+        auto out = (uint16_t*)(dst + y * stride);
+        for(unsigned x = 0; x < w; x++) {
+            auto px = in + x * 4;
+            out[x] = (uint16_t)(((px[2] >> 3) << 11) | ((px[1] >> 2) << 5) | (px[0] >> 3));
+        }
+        if(stride > (size_t)w * 2) {
+            // Padding of odd widths
+            out[w] = 0;
+        }
+    }
+}
+
+void Pixel_HalveRGB565(const uint8_t* src, unsigned src_w, unsigned src_h, uint8_t* dst) {
+    unsigned dst_w = src_w / 2;
+    unsigned dst_h = src_h / 2;
+    size_t src_stride = Pixel_Stride(PIXFMT_RGB16_565, src_w);
+    size_t dst_stride = Pixel_Stride(PIXFMT_RGB16_565, dst_w);
+    assert((src && dst) || dst_w == 0 || dst_h == 0);
+    for(unsigned y = 0; y < dst_h; y++) {
+        auto row0 = (const uint16_t*)(src + (size_t)(y * 2) * src_stride);
+        auto row1 = (const uint16_t*)(src + (size_t)(y * 2 + 1) * src_stride);
+        auto out = (uint16_t*)(dst + y * dst_stride);
+        for(unsigned x = 0; x < dst_w; x++) {
+            unsigned a = row0[x * 2], b = row0[x * 2 + 1], c = row1[x * 2], d = row1[x * 2 + 1];
+            unsigned red = ((a >> 11) + (b >> 11) + (c >> 11) + (d >> 11) + 2) >> 2;
+            unsigned green = (((a >> 5) & 63) + ((b >> 5) & 63) + ((c >> 5) & 63) + ((d >> 5) & 63) + 2) >> 2;
+            unsigned blue = ((a & 31) + (b & 31) + (c & 31) + (d & 31) + 2) >> 2;
+            out[x] = (uint16_t)((red << 11) | (green << 5) | blue);
+        }
+        if(dst_stride > (size_t)dst_w * 2) {
+            out[dst_w] = 0;
+        }
+    }
+}
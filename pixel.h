@@ -0,0 +1,94 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// What Pixel_Convert does to the pixels
+enum Pixel_Conversion {
+    // RGBA -> BGRA
+    PIXCONV_SWAP_RED_BLUE = 1,
+    // Multiplies the color channels by alpha
+    PIXCONV_PREMULTIPLY = 2,
+};
+
+// How the pixels of an image are laid out in memory; each format is the
+// cairo format of the same name
+enum Pixel_Format {
+    // 4 bytes per pixel with alpha
+    PIXFMT_ARGB32 = 0,
+    // 4 bytes per pixel, the alpha byte is unused. Opaque images are
+    // stored like this so that they can be drawn without blending.
+    PIXFMT_RGB24,
+    // 2 bytes per pixel: 5 bits of red, 6 of green, 5 of blue
+    PIXFMT_RGB16_565,
+};
+
+// Implementations of the conversion
+enum Pixel_Kernel {
+    PIXKERN_SCALAR = 0,
+    PIXKERN_SSE2,
+    PIXKERN_AVX2,
+    PIXKERN_MAX
+};
+
+// Converts `count` RGBA8 pixels in place in a single pass, using the
+// fastest kernel the CPU supports. `flags` is a combination of
+// Pixel_Conversion values. Every kernel gives the same result.
+void Pixel_Convert(uint8_t* pixels, size_t count, unsigned flags);
+
+// Like Pixel_Convert but with a specific kernel.
+// Returns false if the CPU (or the build) doesn't support the kernel.
+bool Pixel_ConvertWith(Pixel_Kernel kernel, uint8_t* pixels, size_t count, unsigned flags);
+
+// Returns the kernel Pixel_Convert uses
+Pixel_Kernel Pixel_BestKernel();
+
+const char* Pixel_KernelName(Pixel_Kernel kernel);
+
+// Halves a 4 byte per pixel image in both directions with a 2x2 box
+// filter: every destination pixel is the rounded average of four source
+// pixels. An odd last row or column of the source is left out.
+// `dst` must have room for (src_w / 2) * (src_h / 2) pixels.
+void Pixel_Halve(const uint8_t* src, unsigned src_w, unsigned src_h, uint8_t* dst);
+
+// Like Pixel_Halve but with a specific kernel.
+// Returns false if the CPU (or the build) doesn't support the kernel.
+bool Pixel_HalveWith(Pixel_Kernel kernel, const uint8_t* src, unsigned src_w, unsigned src_h, uint8_t* dst);
+
+// Returns the number of bytes between the starts of two rows of an image;
+// rows start at 4 byte boundaries like cairo's
+size_t Pixel_Stride(Pixel_Format format, unsigned width);
+
+// Returns whether every one of `count` 4 byte pixels has an alpha of 255,
+// using the fastest kernel the CPU supports. Returns at the first pixel
+// that isn't opaque, give or take a few hundred pixels.
+bool Pixel_IsOpaque(const uint8_t* pixels, size_t count);
+
+// Like Pixel_IsOpaque but with a specific kernel; the result is written
+// to `*opaque`.
+// Returns false if the CPU (or the build) doesn't support the kernel.
+bool Pixel_IsOpaqueWith(Pixel_Kernel kernel, const uint8_t* pixels, size_t count, bool* opaque);
+
+// Packs an image of 4 byte BGRA pixels (i.e. with it's red and blue
+// channels swapped) into PIXFMT_RGB16_565 rows of Pixel_Stride bytes.
+// The low bits of every channel are dropped. `dst` may be `src`.
+void Pixel_PackRGB565(const uint8_t* src, unsigned w, unsigned h, uint8_t* dst);
+
+// Like Pixel_Halve but for PIXFMT_RGB16_565 images, whose rows are
+// Pixel_Stride bytes long
+void Pixel_HalveRGB565(const uint8_t* src, unsigned src_w, unsigned src_h, uint8_t* dst);
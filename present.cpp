@@ -22,14 +22,22 @@
 #include <stdint.h>
 #include <errno.h>
 #include <assert.h>
+#include <ctype.h>
+#include <math.h>
 #include "present.h"
 #include "arena.h"
 #include "image_load.h"
-#include "stb_image.h" // stbi_uc
+#include "fetch.h"
+#include "anim.h"
+#include "tiles.h"
 
 #define PF_MEM_SIZE (64 * 1024)
 #define TEXT_SCALE_NORMAL (1.0f)
 #define TEXT_SCALE_EXEC (0.5f)
+#define PREFETCH_DEFAULT_AHEAD (2)
+#define PREFETCH_DEFAULT_BEHIND (1)
+// Number of warm-up images loading at the same time
+#define WARMUP_WINDOW (8)
 
 #define RESOLVE_OFFSET(offset, arena, type) ((type*)Arena_Resolve((arena), (offset)))
 
@@ -49,38 +57,125 @@ enum Image_Alignment {
     IMGALIGN_MAX
 };
 
-struct Present_List_Node {
-    List_Node_Type type;
-    Mem_Arena_Offset next;
-    Mem_Arena_Offset children;
-    Mem_Arena_Offset parent; // this is not the prev->prev of next!
+// A list item on a slide.
+// The contents of a slide are stored as an array of these in depth-first
+// order: the children of a node are the nodes following it that have
+// a greater depth.
+struct Present_Content_Node {
+    uint16_t type; // List_Node_Type
+    uint16_t depth; // 0 is the outermost level
+    uint32_t index; // index into the text or image table of the slide
 };
 
-struct List_Node_Text {
-    Present_List_Node hdr;
-    
-    Mem_Arena_Offset text;
+// Nesting deeper than this is flattened onto the deepest level
+#define MAX_CONTENT_DEPTH (64)
 
+struct Slide_Text {
+    Mem_Arena_Offset text;
     float scale;
 };
 
-struct List_Node_Image {
-    Present_List_Node hdr;
-    const char* path;
+#define ASSET_INVALID ((unsigned)-1)
+
+struct Slide_Image {
+    unsigned asset; // index into the asset table
     Image_Alignment alignment;
+};
+
+// NOTE(easimer): everything that is stored in the arena must be
+// addressed by offsets and must not be modified after parsing, since
+// the arena of a compiled presentation is mapped read-only from a file.
+
+struct Present_Slide {
+    Mem_Arena_Offset chapter_title; // optional
+    Mem_Arena_Offset subtitle; // optional
+    Mem_Arena_Offset exec_cmdLine; // optional
+    
+    // If valid then this slide is a stand-in for the `fragment_slide`th
+    // slide of an #INCLUDE'd file; this is the resolved path of that file
+    Mem_Arena_Offset fragment_path;
+    int fragment_slide;
     
+    // Contents of the slide
+    Mem_Arena_Offset nodes; // Present_Content_Node[node_count]
+    Mem_Arena_Offset texts; // Slide_Text[text_count]
+    Mem_Arena_Offset images; // Slide_Image[image_count]
+    unsigned node_count;
+    unsigned text_count;
+    unsigned image_count;
+};
+
+// An image used by the presentation
+struct Present_Asset {
+    Mem_Arena_Offset path; // resolved path
+};
+
+struct Present_Stream;
+struct Present_File;
+
+// A GIF shown by the presentation
+struct Present_Animation {
+    char* path;
+    // Plays the GIF while it's on the last drawn slide
+    Animation* anim;
+    bool still; // the GIF turned out not to be animated
+    bool drawn; // it's on the last drawn slide
+    RQ_Rect area; // where it was last drawn
+};
+
+// A large image that was shown, cut into tiles so that it can be zoomed
+// into
+struct Present_Tiled {
+    char* path;
+    Tiled_Image* image;
+    bool drawn; // it's on the last drawn slide
+};
+
+// Each zoom step shows this much more or less of the image
+#define ZOOM_STEP (1.5f)
+// Each pan step moves the image by this much of what's shown
+#define PAN_STEP (0.25f)
+// Images can be zoomed until their pixels are this large on the screen
+#define ZOOM_MAX_PIXEL (2.0f)
+
+// An image requested ahead of time
+struct Present_Prefetch {
+    Present_File* owner; // the file whose asset table `asset` indexes
+    unsigned asset;
     Promised_Image* promise;
+    bool keep; // still on a slide near the current one
 };
 
-struct Present_Slide {
-    const char* chapter_title; // optional
-    const char* subtitle; // optional
-    const char* exec_cmdLine; // optional
-    Present_Slide* next;
-    
-    Mem_Arena_Offset content;
-    Mem_Arena_Offset content_cur;
-    int current_indent_level;
+// An image requested for being shown; the promise is in the owner's
+// `promises`
+struct Present_Shown {
+    Present_File* owner; // the file whose asset table `asset` indexes
+    unsigned asset;
+};
+
+// An image loaded by the warm-up
+struct Present_Warmup_Image {
+    char* path;
+    uint64_t disk_order; // see Fetch_DiskOrder
+    unsigned index; // order of first appearance in the presentation
+    Promised_Image* promise; // non-NULL while it's loading
+    // Held until the warm-up is done, so that pixels shared by files
+    // with the same contents can be recognized and counted once
+    Loaded_Image* image;
+};
+
+// Loading every image of the presentation ahead of time
+struct Present_Warmup {
+    // In the order they're loaded
+    Present_Warmup_Image* images;
+    unsigned count;
+    unsigned capacity;
+    unsigned next; // the next image to request
+    unsigned oldest; // the first requested image that may still be loading
+    unsigned loaded; // including the ones that failed to load
+    size_t bytes; // size of the loaded images, with their mips
+    size_t budget;
+    bool done;
 };
 
 struct Present_File {
@@ -94,8 +189,76 @@ struct Present_File {
     // Slides
     int slide_count;
     int current_slide;
-    Present_Slide* slides;
     Present_Slide* current_slide_data;
+    // Offsets of the slides (excluding the title slide)
+    Mem_Arena_Offset* slide_index;
+    int slide_index_capacity;
+    
+    // Images used by the slides
+    Present_Asset* assets;
+    unsigned asset_count;
+    unsigned asset_capacity;
+    // Pending image loads, one for each asset
+    Promised_Image** promises;
+    // Assets of this or included files whose promises were made for the
+    // shown slides. When another slide is shown the ones that aren't on
+    // it are given up on, so they don't keep their priority.
+    Present_Shown* shown;
+    unsigned shown_count;
+    unsigned shown_capacity;
+    
+    // Number of slides after and before the current one whose images
+    // are loaded in advance
+    int prefetch_ahead;
+    int prefetch_behind;
+    int prefetched_slide; // the slide the last prefetch was done for
+    // Images requested for the slides around the current one. They are
+    // given up on when the current slide moves away from their slide.
+    Present_Prefetch* prefetches;
+    unsigned prefetch_count;
+    unsigned prefetch_capacity;
+    
+    // If this is a compiled presentation then the arena, slide index and
+    // asset table point into this mapping of the file
+    const void* mapping;
+    size_t mapping_size;
+    
+    // Non-NULL while the presentation is being read from a pipe
+    Present_Stream* stream;
+    
+    // Whether slides are drawn with placeholders in place of images that
+    // are still loading
+    bool progressive;
+    // Set if the last drawn slide had placeholders
+    bool images_pending;
+    // Images of the last drawn slide. The render queue points into them,
+    // so they're kept until the next slide is drawn.
+    Loaded_Image** drawn_images;
+    unsigned drawn_count;
+    unsigned drawn_capacity;
+    
+    // GIFs that were shown. They are only played while they're on the
+    // last drawn slide, but GIFs that aren't animated are remembered.
+    Present_Animation* animations;
+    unsigned animation_count;
+    unsigned animation_capacity;
+    
+    // Large images that were zoomed into; they stay tiled while they're
+    // on the slides around the current one, but their tiles are only kept
+    // in memory while they're zoomed into on the last drawn slide
+    Present_Tiled* tiled;
+    unsigned tiled_count;
+    unsigned tiled_capacity;
+    // How the first large image of the current slide is zoomed in: `zoom`
+    // times, showing the area around (`zoom_x`, `zoom_y`) [0, 1]
+    float zoom;
+    float zoom_x, zoom_y;
+    float zoom_max;
+    // Set if the last drawn slide had a large image
+    bool zoomable;
+    
+    // Non-NULL if the images of every slide are being loaded in advance
+    Present_Warmup* warmup;
     
     const char* font_title; // Font used on the title slide
     const char* font_chapter; // Font used for chapter title
@@ -111,14 +274,162 @@ struct Present_File {
     RGBA_Color color_fg_header;
 };
 
+// A presentation file included by another one.
+// Fragments are shared by every inclusion site and live until the
+// presentation is reloaded. They are only scanned (slides counted) when
+// included and are only parsed when one of their slides is navigated to.
+struct Present_Fragment {
+    char* path; // resolved path
+    Present_File* file; // NULL until parsed
+    int slide_count;
+    bool scanned;
+    bool scanning; // set while scanning or parsing, used for cycle detection
+    
+    // How many slides each #INCLUDE in this file contributed during the
+    // scan. Parsing reuses these so that the slide count never changes.
+    int* include_counts;
+    int include_num;
+    
+    Present_Fragment* next;
+};
+
+static Present_Fragment* gFragments = nullptr;
+
 struct Parse_State {
-    Present_Slide* first;
     Present_Slide* last;
     
+    const char* path; // the file being parsed; relative paths are resolved against it
+    Present_Fragment* fragment; // NULL if not parsing a fragment
+    int include_idx;
+    
+    // When set, included files are parsed in place instead of being
+    // loaded on demand. Used when compiling a presentation.
+    bool splice_includes;
+    int include_depth;
+    bool after_include; // no #SLIDE since the last #INCLUDE
+    
     int current_chapter_title_len;
-    const char* current_chapter_title;
+    Mem_Arena_Offset current_chapter_title;
+    
+    // Contents of the last slide. These are copied into the arena in one
+    // piece when the slide is complete, so that they are contiguous.
+    Present_Content_Node* nodes;
+    unsigned node_count, node_capacity;
+    Slide_Text* texts;
+    unsigned text_count, text_capacity;
+    Slide_Image* images;
+    unsigned image_count, image_capacity;
+    // Indentation of the last node and of it's ancestors
+    unsigned indent_stack[MAX_CONTENT_DEPTH];
+    unsigned depth;
+};
+
+// A presentation that is parsed while it's being read, e.g. from a pipe
+struct Present_Stream {
+    int fd;
+    int fd_flags; // to be restored when the presentation is closed
+    Parse_State pstate;
+    bool header_read; // the #PRESENT line has been read
+    bool over; // end-of-file or a read error
+    
+    // Beginning of a line whose end hasn't arrived yet
+    char* pending;
+    unsigned pending_len;
+    unsigned pending_capacity;
+    
+    // Slides parsed so far. The last one isn't shown until it's complete,
+    // i.e. until the next one begins or the stream ends.
+    int parsed_slide_count;
+};
+
+#define PRSC_MAGIC "PRSC"
+#define PRSC_VERSION (2)
+
+// Header of a compiled presentation file.
+// The file contains the memory image of the arena, the slide index and
+// the asset table; the offsets of these are relative to the beginning
+// of the file. Other offsets point into the arena.
+struct Prsc_Header {
+    char magic[4];
+    uint32_t version;
+    
+    uint32_t arena_offset;
+    uint32_t arena_size;
+    uint32_t slide_index_offset; // Mem_Arena_Offset[slide_count - 1]
+    uint32_t asset_table_offset; // Present_Asset[asset_count]
+    
+    int32_t slide_count; // including the title slide
+    uint32_t asset_count;
+    
+    Mem_Arena_Offset title;
+    Mem_Arena_Offset authors;
+    Mem_Arena_Offset font_title;
+    Mem_Arena_Offset font_chapter;
+    Mem_Arena_Offset font_general;
+    
+    RGBA_Color color_bg;
+    RGBA_Color color_fg;
+    RGBA_Color color_bg_header;
+    RGBA_Color color_fg_header;
 };
 
+// Returns the string at `off` or NULL if the offset is invalid
+static const char* GetString(Mem_Arena* mem, Mem_Arena_Offset off) {
+    const char* ret = nullptr;
+    if(off != MEM_ARENA_INVALID_OFFSET) {
+        ret = RESOLVE_OFFSET(off, mem, char);
+    }
+    return ret;
+}
+
+// Returns the array at `off` or NULL if the offset is invalid
+template<typename T>
+static const T* GetTable(Mem_Arena* mem, Mem_Arena_Offset off) {
+    const T* ret = nullptr;
+    if(off != MEM_ARENA_INVALID_OFFSET) {
+        ret = RESOLVE_OFFSET(off, mem, T);
+    }
+    return ret;
+}
+
+// Copies an array into the arena
+static Mem_Arena_Offset AllocTable(Mem_Arena* mem, const void* elements, unsigned size) {
+    Mem_Arena_Offset ret = MEM_ARENA_INVALID_OFFSET;
+    if(size > 0) {
+        ret = Arena_AllocEx(mem, size);
+        memcpy(RESOLVE_OFFSET(ret, mem, void), elements, size);
+    }
+    return ret;
+}
+
+// Makes room for one more element at the end of a growing array
+template<typename T>
+static void ReserveOne(T** elements, unsigned count, unsigned* capacity) {
+    if(count == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 16;
+        *elements = (T*)realloc(*elements, *capacity * sizeof(T));
+    }
+}
+
+// Copies a string into the arena
+static Mem_Arena_Offset AllocString(Mem_Arena* mem, const char* str, unsigned len) {
+    auto ret = Arena_AllocEx(mem, len + 1);
+    auto buf = RESOLVE_OFFSET(ret, mem, char);
+    memcpy(buf, str, len);
+    buf[len] = 0;
+    return ret;
+}
+
+// Returns the `idx`th slide or NULL if there is no such slide.
+// The title slide has no Present_Slide.
+static Present_Slide* GetSlide(Present_File* file, int idx) {
+    Present_Slide* ret = nullptr;
+    if(idx >= 1 && idx < file->slide_count) {
+        ret = RESOLVE_OFFSET(file->slide_index[idx - 1], file->mem, Present_Slide);
+    }
+    return ret;
+}
+
 static unsigned ReadLine(char* buf, unsigned bufsiz, unsigned* indent_level, FILE* f) {
     unsigned ret = 0;
     unsigned i = 0;
@@ -156,6 +467,28 @@ static unsigned ReadLine(char* buf, unsigned bufsiz, unsigned* indent_level, FIL
     return ret;
 }
 
+// Same as ReadLine but the line (without the newline) is already in memory
+static unsigned CopyLine(char* buf, unsigned bufsiz, unsigned* indent_level, const char* line, unsigned line_len) {
+    unsigned ret = 0;
+    unsigned i = 0;
+    assert(buf && bufsiz > 0 && indent_level && line);
+    
+    memset(buf, 0, bufsiz);
+    
+    *indent_level = 0;
+    while(i < line_len && (line[i] == ' ' || line[i] == '\t')) {
+        (*indent_level)++; // count every space and tab as a new indent level
+        i++;
+    }
+    ret = line_len - i;
+    if(ret > bufsiz - 1) {
+        ret = bufsiz - 1;
+    }
+    memcpy(buf, line + i, ret);
+    
+    return ret;
+}
+
 // dir, dirlen are outputs
 // buf, buflen are inputs
 static bool IsDirective(const char** dirout, unsigned* dirlen, const char* buf, unsigned buflen) {
@@ -182,22 +515,41 @@ static bool IsDirective(const char** dirout, unsigned* dirlen, const char* buf,
     return ret;
 }
 
+// Moves the contents of the last slide into the arena
+static void FinishSlide(Present_File* file, Parse_State* state) {
+    auto slide = state->last;
+    if(slide && state->node_count > 0) {
+        slide->nodes = AllocTable(file->mem, state->nodes, state->node_count * sizeof(Present_Content_Node));
+        slide->texts = AllocTable(file->mem, state->texts, state->text_count * sizeof(Slide_Text));
+        slide->images = AllocTable(file->mem, state->images, state->image_count * sizeof(Slide_Image));
+        slide->node_count = state->node_count;
+        slide->text_count = state->text_count;
+        slide->image_count = state->image_count;
+    }
+    state->node_count = state->text_count = state->image_count = 0;
+    state->depth = 0;
+}
+
 static void AppendSlide(Present_File* file, Parse_State* state) {
     assert(file && state);
-    Present_Slide* next_slide = (Present_Slide*)Arena_Alloc(file->mem, sizeof(Present_Slide));
-    next_slide->content = MEM_ARENA_INVALID_OFFSET;
-    next_slide->content_cur = MEM_ARENA_INVALID_OFFSET;
+    FinishSlide(file, state);
+    auto off_slide = Arena_AllocEx(file->mem, sizeof(Present_Slide));
+    Present_Slide* next_slide = RESOLVE_OFFSET(off_slide, file->mem, Present_Slide);
+    next_slide->nodes = next_slide->texts = next_slide->images = MEM_ARENA_INVALID_OFFSET;
+    next_slide->node_count = next_slide->text_count = next_slide->image_count = 0;
     next_slide->chapter_title = state->current_chapter_title;
-    next_slide->subtitle = nullptr;
-    next_slide->next = nullptr;
-    next_slide->exec_cmdLine = nullptr;
+    next_slide->subtitle = MEM_ARENA_INVALID_OFFSET;
+    next_slide->exec_cmdLine = MEM_ARENA_INVALID_OFFSET;
+    next_slide->fragment_path = MEM_ARENA_INVALID_OFFSET;
+    next_slide->fragment_slide = 0;
     //fprintf(stderr, "=== SLIDE ===\n");
-    if(state->last != nullptr) {
-        state->last->next = next_slide;
-        state->last = next_slide;
-    } else {
-        state->first = state->last = next_slide;
+    if(file->slide_count > file->slide_index_capacity) {
+        file->slide_index_capacity = file->slide_index_capacity ? 2 * file->slide_index_capacity : 16;
+        file->slide_index = (Mem_Arena_Offset*)realloc(file->slide_index, file->slide_index_capacity * sizeof(Mem_Arena_Offset));
     }
+    file->slide_index[file->slide_count - 1] = off_slide;
+    state->last = next_slide;
+    state->after_include = false;
     file->slide_count++;
 }
 
@@ -205,12 +557,9 @@ static void SetChapterTitle(Present_File* file, Parse_State* state, const char*
     assert(file && state && title);
     
     if(title_len == 0) {
-        state->current_chapter_title = nullptr;
+        state->current_chapter_title = MEM_ARENA_INVALID_OFFSET;
     } else {
-        char* buf = (char*)Arena_Alloc(file->mem, title_len + 1);
-        memcpy(buf, title, title_len);
-        buf[title_len] = 0;
-        state->current_chapter_title = buf;
+        state->current_chapter_title = AllocString(file->mem, title, title_len);
         state->current_chapter_title_len = title_len;
     }
 }
@@ -239,6 +588,7 @@ static void SetAuthors(Present_File* file, Parse_State* state, const char* autho
 #if _WIN32
 #define WIN32_MEAN_AND_LEAN
 #include <Windows.h>
+#include <io.h>
 inline int P_Chdir(const char* path) {
     int ret = 0;
     BOOL res;
@@ -274,7 +624,66 @@ inline char* P_Realpath(const char* path, char buf[PATH_MAX]) {
     }
     return ret;
 }
+
+// Maps a file into memory read-only
+inline const void* P_MapFile(const char* path, size_t* size) {
+    const void* ret = nullptr;
+    HANDLE hFile, hMapping;
+    LARGE_INTEGER fileSize;
+    
+    hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(hFile != INVALID_HANDLE_VALUE) {
+        if(GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0) {
+            hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if(hMapping) {
+                ret = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+                *size = (size_t)fileSize.QuadPart;
+                CloseHandle(hMapping);
+            }
+        }
+        CloseHandle(hFile);
+    }
+    
+    return ret;
+}
+
+inline void P_UnmapFile(const void* addr, size_t size) {
+    UnmapViewOfFile(addr);
+}
+
+// Reads whatever is available from the pipe `fd` without blocking.
+// Returns the number of bytes read, 0 at end-of-file and -1 if nothing
+// can be read right now.
+inline int P_ReadAvailable(int fd, void* buf, unsigned size) {
+    int ret = -1;
+    HANDLE hPipe = (HANDLE)_get_osfhandle(fd);
+    DWORD available = 0, read = 0;
+    
+    if(!PeekNamedPipe(hPipe, nullptr, 0, nullptr, &available, nullptr)) {
+        // The writer has closed the pipe
+        ret = 0;
+    } else if(available > 0) {
+        if(ReadFile(hPipe, buf, available < size ? available : size, &read, nullptr)) {
+            ret = (int)read;
+        } else {
+            ret = 0;
+        }
+    }
+    
+    return ret;
+}
+
+// Pipes are never blocked on, see P_ReadAvailable
+inline int P_SetNonBlocking(int fd) {
+    return 0;
+}
+
+inline void P_RestoreFlags(int fd, int flags) {
+}
 #else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 inline int P_Chdir(const char* path) {
     return chdir(path);
@@ -287,6 +696,61 @@ inline char* P_Getcwd(char* buf, size_t size) {
 inline char* P_Realpath(const char* path, char buf[PATH_MAX]) {
     return realpath(path, buf);
 }
+
+// Maps a file into memory read-only
+inline const void* P_MapFile(const char* path, size_t* size) {
+    void* ret = nullptr;
+    struct stat st;
+    int fd;
+    
+    fd = open(path, O_RDONLY);
+    if(fd != -1) {
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+            ret = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(ret == MAP_FAILED) {
+                ret = nullptr;
+            } else {
+                *size = st.st_size;
+            }
+        }
+        close(fd);
+    }
+    
+    return ret;
+}
+
+inline void P_UnmapFile(const void* addr, size_t size) {
+    munmap((void*)addr, size);
+}
+
+// Reads whatever is available from `fd` without blocking.
+// Returns the number of bytes read, 0 at end-of-file and -1 if nothing
+// can be read right now.
+inline int P_ReadAvailable(int fd, void* buf, unsigned size) {
+    int ret = (int)read(fd, buf, size);
+    if(ret < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            fprintf(stderr, "Failed to read presentation: %s\n", strerror(errno));
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+// Makes reads from `fd` non-blocking; returns the previous flags
+inline int P_SetNonBlocking(int fd) {
+    int ret = fcntl(fd, F_GETFL);
+    if(ret != -1) {
+        fcntl(fd, F_SETFL, ret | O_NONBLOCK);
+    }
+    return ret;
+}
+
+inline void P_RestoreFlags(int fd, int flags) {
+    if(flags != -1) {
+        fcntl(fd, F_SETFL, flags);
+    }
+}
 #endif
 
 static void SaveWorkDir(char** dst) {
@@ -332,80 +796,243 @@ static void ChangeToDirOfFile(const char* path) {
     }
 }
 
-static void SwapRedBlueChannels(uint8_t* rgba_buffer, unsigned width, unsigned height) {
-    for(unsigned y = 0; y < height; y++) {
-        for(unsigned x = 0; x < width; x++) {
-            auto& c0 = rgba_buffer[y * width * 4 + x * 4 + 0];
-            auto& c1 = rgba_buffer[y * width * 4 + x * 4 + 2];
-            uint8_t t = c0;
-            c0 = c1;
-            c1 = t;
-        }
+// Resolves `path` relative to the directory of the file `base`.
+// Returns false if the path doesn't exist.
+static bool ResolvePath(char out[PATH_MAX], const char* base, const char* path, unsigned path_len) {
+    bool ret = false;
+    char* prev_workdir = nullptr;
+    char* buf;
+    
+    buf = (char*)malloc(path_len + 1);
+    memcpy(buf, path, path_len);
+    buf[path_len] = 0;
+    
+    SaveWorkDir(&prev_workdir);
+    ChangeToDirOfFile(base);
+    ret = P_Realpath(buf, out) != nullptr;
+    RestoreWorkDir(&prev_workdir);
+    
+    free(buf);
+    
+    return ret;
+}
+
+// Finds the fragment with the given resolved path or creates it
+static Present_Fragment* GetFragment(const char* path) {
+    Present_Fragment* ret = gFragments;
+    
+    while(ret && strcmp(ret->path, path) != 0) {
+        ret = ret->next;
     }
+    
+    if(!ret) {
+        unsigned len = (unsigned)strlen(path);
+        ret = (Present_Fragment*)malloc(sizeof(Present_Fragment));
+        ret->path = (char*)malloc(len + 1);
+        memcpy(ret->path, path, len + 1);
+        ret->file = nullptr;
+        ret->slide_count = 0;
+        ret->scanned = false;
+        ret->scanning = false;
+        ret->include_counts = nullptr;
+        ret->include_num = 0;
+        ret->next = gFragments;
+        gFragments = ret;
+    }
+    
+    return ret;
 }
 
-static void AppendNode(Present_File* file, Present_Slide* slide, int indent_level, Mem_Arena_Offset offNode) {
-    auto* ptrNode = RESOLVE_OFFSET(offNode, file->mem, Present_List_Node);
+static int IncludedSlideCount(Present_Fragment* frag, const char* includer);
 
-    if (slide->content_cur != MEM_ARENA_INVALID_OFFSET) {
-        auto* content_cur = RESOLVE_OFFSET(slide->content_cur, file->mem, Present_List_Node);
-        if(slide->current_indent_level < indent_level) {
-            //fprintf(stderr, "Indent IN to %d from %d\n", indent_level, slide->current_indent_level);
-            ptrNode->parent = slide->content_cur;
-            content_cur->children = offNode;
-            slide->content_cur = offNode;
-            slide->current_indent_level = indent_level;
-        } else if(slide->current_indent_level > indent_level) {
-            //fprintf(stderr, "Indent OUT to %d\n", indent_level);
-            auto offParent = content_cur->parent;
-            auto* ptrParent = RESOLVE_OFFSET(offParent, file->mem, Present_List_Node);
-            slide->content_cur = offParent;
-            ptrParent->next = offNode;
-            slide->current_indent_level = indent_level;
+// Returns whether a file is a compiled presentation.
+// The file position is reset to the beginning of the file.
+static bool IsCompiledFile(FILE* f) {
+    char magic[4];
+    bool ret = fread(magic, 1, 4, f) == 4 && memcmp(magic, PRSC_MAGIC, 4) == 0;
+    fseek(f, 0, SEEK_SET);
+    return ret;
+}
+
+// Maps a compiled presentation into memory and validates it's header.
+// Returns NULL if the file is not a valid compiled presentation.
+static const Prsc_Header* MapCompiledFile(const char* path, size_t* size) {
+    const Prsc_Header* ret = nullptr;
+    
+    ret = (const Prsc_Header*)P_MapFile(path, size);
+    if(ret) {
+        bool valid = false;
+        if(*size < sizeof(Prsc_Header) || memcmp(ret->magic, PRSC_MAGIC, 4) != 0) {
+            fprintf(stderr, "'%s' is not a compiled presentation!\n", path);
+        } else if(ret->version != PRSC_VERSION) {
+            fprintf(stderr, "Compiled presentation '%s' has unsupported version %u!\n", path, ret->version);
+        } else if(ret->slide_count < 1 ||
+                  (uint64_t)ret->arena_offset + ret->arena_size > *size ||
+                  ret->slide_index_offset + (uint64_t)(ret->slide_count - 1) * sizeof(Mem_Arena_Offset) > *size ||
+                  ret->asset_table_offset + (uint64_t)ret->asset_count * sizeof(Present_Asset) > *size) {
+            fprintf(stderr, "Compiled presentation '%s' is truncated!\n", path);
         } else {
-            //fprintf(stderr, "Indent STAYS at %d\n", indent_level);
-            content_cur->next = offNode;
-            ptrNode->parent = content_cur->parent;
-            slide->content_cur = offNode;
+            valid = true;
+        }
+        
+        if(!valid) {
+            P_UnmapFile(ret, *size);
+            ret = nullptr;
+        }
+    } else {
+        fprintf(stderr, "Failed to map presentation file '%s'!\n", path);
+    }
+    
+    return ret;
+}
+
+// Counts the slides of a fragment without parsing it.
+// Fragments included by this one are scanned too.
+static void ScanFragment(Present_Fragment* frag) {
+    unsigned line_length;
+    char line_buf[512];
+    const unsigned line_siz = 512;
+    unsigned indent_level;
+    const char* directive;
+    unsigned directive_len;
+    char inc_path[PATH_MAX];
+    FILE* f;
+    
+    assert(frag && !frag->scanned);
+    
+    frag->scanning = true;
+    f = fopen(frag->path, "r");
+    if(f) {
+        bool compiled = IsCompiledFile(f);
+        if(compiled) {
+            // Compiled files have no includes
+            size_t size;
+            const Prsc_Header* hdr = MapCompiledFile(frag->path, &size);
+            if(hdr) {
+                frag->slide_count = hdr->slide_count - 1;
+                P_UnmapFile(hdr, size);
+            }
+        }
+        while(!compiled && !feof(f)) {
+            line_length = ReadLine(line_buf, line_siz, &indent_level, f);
+            if(line_length && IsDirective(&directive, &directive_len, line_buf, line_length)) {
+                if(strncmp(directive, "SLIDE", directive_len) == 0) {
+                    frag->slide_count++;
+                } else if(strncmp(directive, "INCLUDE", directive_len) == 0) {
+                    const char* arg = directive + directive_len + 1;
+                    int count = 0;
+                    if(directive_len + 2 < line_length && ResolvePath(inc_path, frag->path, arg, line_length - directive_len - 2)) {
+                        count = IncludedSlideCount(GetFragment(inc_path), frag->path);
+                    }
+                    frag->include_counts = (int*)realloc(frag->include_counts, (frag->include_num + 1) * sizeof(int));
+                    frag->include_counts[frag->include_num++] = count;
+                    frag->slide_count += count;
+                }
+            }
         }
+        fclose(f);
+    } else {
+        fprintf(stderr, "Failed to open included file '%s'!\n", frag->path);
+    }
+    frag->scanning = false;
+    frag->scanned = true;
+}
+
+// Returns how many slides an #INCLUDE of `frag` in `includer` adds.
+// Include cycles are reported and contribute no slides.
+static int IncludedSlideCount(Present_Fragment* frag, const char* includer) {
+    int ret = 0;
+    
+    if(frag->scanning) {
+        fprintf(stderr, "Include cycle: '%s' includes '%s' which is already being included!\n", includer, frag->path);
     } else {
-        //fprintf(stderr, "Indent ESTABLISHED at %d\n", indent_level);
-        slide->content = slide->content_cur = offNode;
-        slide->current_indent_level = indent_level;
+        if(!frag->scanned) {
+            ScanFragment(frag);
+        }
+        ret = frag->slide_count;
+    }
+    
+    return ret;
+}
+
+// Content can't be added to the slides of an #INCLUDE'd file
+static bool IsAfterInclude(Parse_State* state) {
+    if(state->after_include) {
+        fprintf(stderr, "Content after #INCLUDE must begin with a #SLIDE!\n");
+    }
+    return state->after_include;
+}
+
+// Adds a node to the contents of the last slide. A node indented more
+// than the previous one becomes it's child; otherwise it becomes the
+// sibling of the closest preceding node that isn't indented more.
+static void AppendNode(Parse_State* state, List_Node_Type type, unsigned index, unsigned indent_level) {
+    Present_Content_Node* node;
+    
+    while(state->depth > 0 && state->indent_stack[state->depth - 1] > indent_level) {
+        state->depth--;
+    }
+    if(state->depth == 0 || state->indent_stack[state->depth - 1] < indent_level) {
+        if(state->depth < MAX_CONTENT_DEPTH) {
+            state->indent_stack[state->depth++] = indent_level;
+        }
+    }
+    
+    ReserveOne(&state->nodes, state->node_count, &state->node_capacity);
+    node = &state->nodes[state->node_count++];
+    node->type = (uint16_t)type;
+    node->depth = (uint16_t)(state->depth - 1);
+    node->index = index;
+}
+
+// Returns the index of the asset with the given resolved path, adding
+// it to the asset table if needed
+static unsigned AddAsset(Present_File* file, const char* path) {
+    unsigned ret;
+    
+    for(ret = 0; ret < file->asset_count; ret++) {
+        if(strcmp(GetString(file->mem, file->assets[ret].path), path) == 0) {
+            break;
+        }
+    }
+    
+    if(ret == file->asset_count) {
+        if(file->asset_count == file->asset_capacity) {
+            file->asset_capacity = file->asset_capacity ? 2 * file->asset_capacity : 8;
+            file->assets = (Present_Asset*)realloc(file->assets, file->asset_capacity * sizeof(Present_Asset));
+        }
+        file->assets[ret].path = AllocString(file->mem, path, (unsigned)strlen(path));
+        file->asset_count++;
+        // The slides can be laid out before the image is loaded
+        ImageLoader_Probe(path);
     }
-    //fprintf(stderr, "Appended image '%.*s'\n", path_len, path);
+    
+    return ret;
 }
 
 static void AddInlineImage(Present_File* file, Parse_State* state, int indent_level, const char* path, unsigned path_len, Image_Alignment alignment) {
-    char* prev_workdir = nullptr;
-    Mem_Arena_Offset offNode;
-    List_Node_Image* ptrNode;
+    Slide_Image* image;
     char full_path_buf[PATH_MAX];
     auto slide = state->last;
     if(!slide) {
         fprintf(stderr, "No #SLIDE directive before content!\n");
     }
+    if(IsAfterInclude(state)) {
+        return;
+    }
     assert(slide);
-    offNode = Arena_AllocEx(file->mem, sizeof(List_Node_Image));
-    ptrNode = RESOLVE_OFFSET(offNode, file->mem, List_Node_Image);
-    ptrNode->hdr.type = LNODE_IMAGE;
-    ptrNode->hdr.next = ptrNode->hdr.children = ptrNode->hdr.parent = MEM_ARENA_INVALID_OFFSET;
-    ptrNode->alignment = alignment;
-    
-    SaveWorkDir(&prev_workdir);
-    ChangeToDirOfFile(file->path);
+    ReserveOne(&state->images, state->image_count, &state->image_capacity);
+    image = &state->images[state->image_count];
+    image->alignment = alignment;
     
-    if(P_Realpath(path, full_path_buf)) {
-        unsigned len = (unsigned)strlen(full_path_buf);
-        ptrNode->path = (char*)Arena_Alloc(file->mem, len + 1);
-        memcpy((char*)ptrNode->path, full_path_buf, len + 1);
+    if(ResolvePath(full_path_buf, state->path, path, path_len)) {
+        image->asset = AddAsset(file, full_path_buf);
     } else {
-        ptrNode->path = nullptr;
+        fprintf(stderr, "Couldn't find image '%.*s'\n", path_len, path);
+        image->asset = ASSET_INVALID;
     }
-    
-    RestoreWorkDir(&prev_workdir);
 
-    AppendNode(file, slide, indent_level, offNode);
+    AppendNode(state, LNODE_IMAGE, state->image_count++, indent_level);
 }
 
 static void SetSubtitle(Present_File* file, Parse_State* state, const char* title, unsigned title_len) {
@@ -414,11 +1041,11 @@ static void SetSubtitle(Present_File* file, Parse_State* state, const char* titl
     if(!slide) {
         fprintf(stderr, "No #SLIDE directive before #SUBTITLE!\n");
     }
+    if(IsAfterInclude(state)) {
+        return;
+    }
     assert(slide);
-    char* buf = (char*)Arena_Alloc(file->mem, title_len + 1);
-    memcpy(buf, title, title_len);
-    buf[title_len] = 0;
-    slide->subtitle = buf;
+    slide->subtitle = AllocString(file->mem, title, title_len);
 }
 
 static void AppendToList(Present_File* file, Parse_State* state, int indent_level, const char* line, unsigned linelen, float textScale) {
@@ -426,19 +1053,16 @@ static void AppendToList(Present_File* file, Parse_State* state, int indent_leve
     if(!slide) {
         fprintf(stderr, "No #SLIDE directive before content!\n");
     }
+    if(IsAfterInclude(state)) {
+        return;
+    }
     assert(slide);
-    auto offNode = Arena_AllocEx(file->mem, sizeof(List_Node_Text));
-    auto ptrNode = RESOLVE_OFFSET(offNode, file->mem, List_Node_Text);
-    ptrNode->hdr.type = LNODE_TEXT;
-    ptrNode->hdr.next = ptrNode->hdr.children = ptrNode->hdr.parent = MEM_ARENA_INVALID_OFFSET;
-    ptrNode->scale = textScale;
-    auto offBuf = Arena_AllocEx(file->mem, linelen + 1);
-    auto* ptrBuf = RESOLVE_OFFSET(offBuf, file->mem, char);
-    memcpy(ptrBuf, line, linelen);
-    ptrBuf[linelen] = 0;
-    ptrNode->text = offBuf;
+    ReserveOne(&state->texts, state->text_count, &state->text_capacity);
+    auto text = &state->texts[state->text_count];
+    text->scale = textScale;
+    text->text = AllocString(file->mem, line, linelen);
     
-    AppendNode(file, slide, indent_level, offNode);
+    AppendNode(state, LNODE_TEXT, state->text_count++, indent_level);
 }
 
 static void SetFont(Present_File* file, const char** dst, const char* name, unsigned name_len) {
@@ -497,130 +1121,451 @@ static void AddProgramExecution(Present_File* file, Parse_State* state, const ch
         return;
     }
 
+    if(IsAfterInclude(state)) {
+        return;
+    }
+
     assert(slide);
 
-    if(slide->exec_cmdLine) {
+    if(slide->exec_cmdLine != MEM_ARENA_INVALID_OFFSET) {
         fprintf(stderr, "Duplicate #EXEC in slide %d\n", file->current_slide);
         return;
     }
 
-    char* buf = (char*)Arena_Alloc(file->mem, command_line_len + 1);
-    memcpy(buf, command_line, command_line_len);
-    buf[command_line_len] = 0;
-    slide->exec_cmdLine = buf;
+    slide->exec_cmdLine = AllocString(file->mem, command_line, command_line_len);
 
-    AppendToList(file, state, slide->current_indent_level, command_line, command_line_len, TEXT_SCALE_EXEC);
+    // Shown at the same level as the previous item
+    unsigned indent_level = state->depth > 0 ? state->indent_stack[state->depth - 1] : 0;
+    AppendToList(file, state, indent_level, command_line, command_line_len, TEXT_SCALE_EXEC);
 }
 
-static bool ParseFile(Present_File* file, FILE* f) {
-    bool ret = true;
-    unsigned line_length;
-    char line_buf[512];
-    const unsigned line_siz = 512;
-    unsigned indent_level;
+static bool ParseFile(Present_File* file, FILE* f, Parse_State* state);
+
+// Parses an included file as if it's contents were in place of the
+// #INCLUDE directive
+static void SpliceInclude(Present_File* file, Parse_State* state, Present_Fragment* frag) {
+    FILE* f;
     
-    const char* directive;
-    unsigned directive_len;
-    const char* directive_arg;
-    unsigned directive_arg_len;
-    Parse_State pstate;
+    if(frag->scanning) {
+        fprintf(stderr, "Include cycle: '%s' includes '%s' which is already being included!\n", state->path, frag->path);
+        return;
+    }
     
-    pstate.first = pstate.last = nullptr;
+    f = fopen(frag->path, "r");
+    if(f) {
+        if(IsCompiledFile(f)) {
+            fprintf(stderr, "Can't include compiled presentation '%s' here!\n", frag->path);
+        } else {
+            auto prev_path = state->path;
+            auto prev_chapter_title = state->current_chapter_title;
+            frag->scanning = true;
+            state->path = frag->path;
+            state->include_depth++;
+            if(!ParseFile(file, f, state)) {
+                fprintf(stderr, "Failed to parse included file '%s'!\n", frag->path);
+            }
+            state->include_depth--;
+            state->path = prev_path;
+            state->current_chapter_title = prev_chapter_title;
+            frag->scanning = false;
+        }
+        fclose(f);
+    } else {
+        fprintf(stderr, "Failed to open included file '%s'!\n", frag->path);
+    }
+}
+
+static void AddInclude(Present_File* file, Parse_State* state, const char* path, unsigned path_len) {
+    char full_path[PATH_MAX];
+    Present_Fragment* frag = nullptr;
+    Mem_Arena_Offset frag_path = MEM_ARENA_INVALID_OFFSET;
+    int count = 0;
+    assert(file && state && path);
     
-    assert(file && f);
+    FinishSlide(file, state);
     
-    file->font_general = file->font_title = file->font_chapter = nullptr;
+    if(path_len > 0 && ResolvePath(full_path, state->path, path, path_len)) {
+        frag = GetFragment(full_path);
+    } else {
+        fprintf(stderr, "Couldn't find included file '%.*s'!\n", path_len, path);
+    }
     
-    // First line must be a '#PRESENT'
-    line_length = ReadLine(line_buf, line_siz, &indent_level, f);
+    if(state->splice_includes) {
+        if(frag) {
+            SpliceInclude(file, state, frag);
+        }
+        state->after_include = true;
+        return;
+    }
+    
+    if(state->fragment) {
+        // Fragments were scanned before being parsed
+        if(state->include_idx < state->fragment->include_num) {
+            count = state->fragment->include_counts[state->include_idx];
+        }
+        state->include_idx++;
+    } else if(frag) {
+        count = IncludedSlideCount(frag, file->path);
+    }
+    
+    if(!frag) {
+        count = 0;
+    } else if(count > 0) {
+        frag_path = AllocString(file->mem, frag->path, (unsigned)strlen(frag->path));
+    }
+    
+    for(int i = 1; i <= count; i++) {
+        AppendSlide(file, state);
+        state->last->fragment_path = frag_path;
+        state->last->fragment_slide = i;
+    }
+    state->after_include = true;
+}
+
+// Directives that change deck-wide settings
+static const char* gGlobalDirectives[] = {
+    "TITLE", "AUTHORS", "FONT", "FONT_TITLE", "FONT_CHAPTER",
+    "COLOR_BG", "COLOR_FG", "COLOR_BG_HEADER", "COLOR_FG_HEADER",
+};
+
+static bool IsGlobalDirective(const char* directive, unsigned directive_len) {
+    bool ret = false;
+    for(auto name : gGlobalDirectives) {
+        if(strncmp(directive, name, directive_len) == 0) {
+            ret = true;
+            break;
+        }
+    }
+    return ret;
+}
+
+// Parses a single non-empty line of a presentation file
+static void ParseLine(Present_File* file, Parse_State* pstate, const char* line_buf, unsigned line_length, unsigned indent_level) {
+    const char* directive;
+    unsigned directive_len;
+    const char* directive_arg;
+    unsigned directive_arg_len;
+    
+    assert(file && pstate && line_buf && line_length > 0);
+    
+    if(IsDirective(&directive, &directive_len, line_buf, line_length)) {
+        // Calculate directive argument ptr and len
+        directive_arg = directive + directive_len + 1;
+        directive_arg_len = line_length - directive_len - 1;
+        if(directive_arg_len != 0) {
+            directive_arg_len--;
+        }
+        
+        if(pstate->include_depth > 0 && IsGlobalDirective(directive, directive_len)) {
+            // Spliced files can't change deck-wide settings
+        } else if(strncmp(directive, "SLIDE", directive_len) == 0) {
+            AppendSlide(file, pstate);
+        } else if(strncmp(directive, "SUBTITLE", directive_len) == 0) {
+            SetSubtitle(file, pstate, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "INLINE_IMAGE", directive_len) == 0) {
+            AddInlineImage(file, pstate, indent_level, directive_arg, directive_arg_len, IMGALIGN_INLINE);
+        } else if(strncmp(directive, "RIGHT_IMAGE", directive_len) == 0) {
+            AddInlineImage(file, pstate, indent_level, directive_arg, directive_arg_len, IMGALIGN_RIGHT);
+        } else if(strncmp(directive, "FULLWIDE_IMAGE", directive_len) == 0) {
+            AddInlineImage(file, pstate, indent_level, directive_arg, directive_arg_len, IMGALIGN_FULLWIDE);
+        } else if(strncmp(directive, "CHAPTER", directive_len) == 0) {
+            SetChapterTitle(file, pstate, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "TITLE", directive_len) == 0) {
+            SetTitle(file, pstate, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "AUTHORS", directive_len) == 0) {
+            SetAuthors(file, pstate, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "FONT", directive_len) == 0) {
+            SetFont(file, &file->font_general, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "FONT_TITLE", directive_len) == 0) {
+            SetFont(file, &file->font_title, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "FONT_CHAPTER", directive_len) == 0) {
+            SetFont(file, &file->font_chapter, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "COLOR_BG", directive_len) == 0) {
+            SetColor(file, &file->color_bg, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "COLOR_FG", directive_len) == 0) {
+            SetColor(file, &file->color_fg, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "COLOR_BG_HEADER", directive_len) == 0) {
+            SetColor(file, &file->color_bg_header, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "COLOR_FG_HEADER", directive_len) == 0) {
+            SetColor(file, &file->color_fg_header, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "EXECUTE", directive_len) == 0) {
+            AddProgramExecution(file, pstate, directive_arg, directive_arg_len);
+        } else if(strncmp(directive, "INCLUDE", directive_len) == 0) {
+            AddInclude(file, pstate, directive_arg, directive_arg_len);
+        } else {
+            fprintf(stderr, "Warning: unknown directive: '%.*s'\n",
+                    directive_len, directive);
+        }
+    } else {
+        AppendToList(file, pstate, indent_level, line_buf, line_length, TEXT_SCALE_NORMAL);
+    }
+}
+
+static bool ParseFile(Present_File* file, FILE* f, Parse_State* pstate) {
+    bool ret = true;
+    unsigned line_length;
+    char line_buf[512];
+    const unsigned line_siz = 512;
+    unsigned indent_level;
+    
+    const char* directive;
+    unsigned directive_len;
+    
+    assert(file && f && pstate);
+    
+    // First line must be a '#PRESENT'
+    line_length = ReadLine(line_buf, line_siz, &indent_level, f);
     if(line_length && IsDirective(&directive, &directive_len, line_buf, line_length)) {
         if(strncmp(directive, "PRESENT", directive_len) == 0) {
             while(!feof(f)) {
                 line_length = ReadLine(line_buf, line_siz, &indent_level, f);
                 if(line_length) {
-                    if(IsDirective(&directive, &directive_len, line_buf, line_length)) {
-                        // Calculate directive argument ptr and len
-                        directive_arg = directive + directive_len + 1;
-                        directive_arg_len = line_length - directive_len - 1;
-                        if(directive_arg_len != 0) {
-                            directive_arg_len--;
-                        }
-                        
-                        if(strncmp(directive, "SLIDE", directive_len) == 0) {
-                            AppendSlide(file, &pstate);
-                        } else if(strncmp(directive, "SUBTITLE", directive_len) == 0) {
-                            SetSubtitle(file, &pstate, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "INLINE_IMAGE", directive_len) == 0) {
-                            AddInlineImage(file, &pstate, indent_level, directive_arg, directive_arg_len, IMGALIGN_INLINE);
-                        } else if(strncmp(directive, "RIGHT_IMAGE", directive_len) == 0) {
-                            AddInlineImage(file, &pstate, indent_level, directive_arg, directive_arg_len, IMGALIGN_RIGHT);
-                        } else if(strncmp(directive, "FULLWIDE_IMAGE", directive_len) == 0) {
-                            AddInlineImage(file, &pstate, indent_level, directive_arg, directive_arg_len, IMGALIGN_FULLWIDE);
-                        } else if(strncmp(directive, "CHAPTER", directive_len) == 0) {
-                            SetChapterTitle(file, &pstate, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "TITLE", directive_len) == 0) {
-                            SetTitle(file, &pstate, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "AUTHORS", directive_len) == 0) {
-                            SetAuthors(file, &pstate, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "FONT", directive_len) == 0) {
-                            SetFont(file, &file->font_general, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "FONT_TITLE", directive_len) == 0) {
-                            SetFont(file, &file->font_title, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "FONT_CHAPTER", directive_len) == 0) {
-                            SetFont(file, &file->font_chapter, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "COLOR_BG", directive_len) == 0) {
-                            SetColor(file, &file->color_bg, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "COLOR_FG", directive_len) == 0) {
-                            SetColor(file, &file->color_fg, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "COLOR_BG_HEADER", directive_len) == 0) {
-                            SetColor(file, &file->color_bg_header, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "COLOR_FG_HEADER", directive_len) == 0) {
-                            SetColor(file, &file->color_fg_header, directive_arg, directive_arg_len);
-                        } else if(strncmp(directive, "EXECUTE", directive_len) == 0) {
-                            AddProgramExecution(file, &pstate, directive_arg, directive_arg_len);
-                        } else {
-                            fprintf(stderr, "Warning: unknown directive: '%.*s'\n",
-                                    directive_len, directive);
-                        }
-                    } else {
-                        AppendToList(file, &pstate, indent_level, line_buf, line_length, TEXT_SCALE_NORMAL);
-                    }
+                    ParseLine(file, pstate, line_buf, line_length, indent_level);
                 }
             }
-            file->slides = pstate.first;
         } else {
             fprintf(stderr, "#PRESENT header is missing from presentation file!\n");
             ret = false;
         }
     }
     
+    FinishSlide(file, pstate);
+    
     return ret;
 }
 
-Present_File* Present_Open(const char* filename) {
+static void InitParseState(Parse_State* pstate, const char* path, Present_Fragment* frag, bool splice_includes) {
+    pstate->last = nullptr;
+    pstate->path = path;
+    pstate->fragment = frag;
+    pstate->include_idx = 0;
+    pstate->splice_includes = splice_includes;
+    pstate->include_depth = 0;
+    pstate->after_include = false;
+    pstate->current_chapter_title = MEM_ARENA_INVALID_OFFSET;
+    pstate->current_chapter_title_len = 0;
+    pstate->nodes = nullptr;
+    pstate->node_count = pstate->node_capacity = 0;
+    pstate->texts = nullptr;
+    pstate->text_count = pstate->text_capacity = 0;
+    pstate->images = nullptr;
+    pstate->image_count = pstate->image_capacity = 0;
+    pstate->depth = 0;
+}
+
+static void FreeParseState(Parse_State* pstate) {
+    free(pstate->nodes);
+    free(pstate->texts);
+    free(pstate->images);
+}
+
+static Present_File* AllocFile(const char* filename) {
+    Present_File* ret = (Present_File*)malloc(sizeof(Present_File));
+    if(ret) {
+        ret->path = filename;
+        ret->mem = nullptr;
+        ret->title = nullptr;
+        ret->title_len = 0;
+        ret->authors = nullptr;
+        ret->authors_len = 0;
+        ret->slide_count = 1; // implicit title slide
+        ret->current_slide = 0;
+        ret->current_slide_data = nullptr;
+        ret->slide_index = nullptr;
+        ret->slide_index_capacity = 0;
+        ret->assets = nullptr;
+        ret->asset_count = 0;
+        ret->asset_capacity = 0;
+        ret->promises = nullptr;
+        ret->shown = nullptr;
+        ret->shown_count = 0;
+        ret->shown_capacity = 0;
+        ret->prefetch_ahead = PREFETCH_DEFAULT_AHEAD;
+        ret->prefetch_behind = PREFETCH_DEFAULT_BEHIND;
+        ret->prefetched_slide = -1;
+        ret->prefetches = nullptr;
+        ret->prefetch_count = 0;
+        ret->prefetch_capacity = 0;
+        ret->mapping = nullptr;
+        ret->mapping_size = 0;
+        ret->stream = nullptr;
+        ret->progressive = false;
+        ret->images_pending = false;
+        ret->drawn_images = nullptr;
+        ret->drawn_count = 0;
+        ret->drawn_capacity = 0;
+        ret->animations = nullptr;
+        ret->animation_count = 0;
+        ret->animation_capacity = 0;
+        ret->tiled = nullptr;
+        ret->tiled_count = 0;
+        ret->tiled_capacity = 0;
+        ret->zoom = 1;
+        ret->zoom_x = ret->zoom_y = 0.5f;
+        ret->zoom_max = 1;
+        ret->zoomable = false;
+        ret->warmup = nullptr;
+        ret->font_general = ret->font_title = ret->font_chapter = nullptr;
+        SET_RGB(ret->color_bg, 255, 255, 255);
+        SET_RGB(ret->color_fg, 0, 0, 0);
+        SET_RGB(ret->color_bg_header, 43, 203, 186);
+        SET_RGB(ret->color_fg_header, 255, 255, 255);
+    }
+    return ret;
+}
+
+static void FreeWarmup(Present_Warmup* warmup) {
+    if(warmup) {
+        for(unsigned i = 0; i < warmup->count; i++) {
+            ImageLoader_Free(warmup->images[i].promise);
+            ImageLoader_Free(warmup->images[i].image);
+            free(warmup->images[i].path);
+        }
+        free(warmup->images);
+        free(warmup);
+    }
+}
+
+static void FreeFile(Present_File* file) {
+    if(file->stream) {
+        P_RestoreFlags(file->stream->fd, file->stream->fd_flags);
+        FreeParseState(&file->stream->pstate);
+        free(file->stream->pending);
+        free(file->stream);
+    }
+    if(file->mapping) {
+        P_UnmapFile(file->mapping, file->mapping_size);
+    } else {
+        if(file->mem) {
+            Arena_Destroy(file->mem);
+        }
+        free(file->slide_index);
+        free(file->assets);
+    }
+    if(file->promises) {
+        for(unsigned i = 0; i < file->asset_count; i++) {
+            ImageLoader_Free(file->promises[i]);
+        }
+    }
+    free(file->promises);
+    // NOTE(easimer): the promises are freed along with their owner
+    free(file->shown);
+    for(unsigned i = 0; i < file->prefetch_count; i++) {
+        ImageLoader_Free(file->prefetches[i].promise);
+    }
+    free(file->prefetches);
+    for(unsigned i = 0; i < file->drawn_count; i++) {
+        ImageLoader_Free(file->drawn_images[i]);
+    }
+    free(file->drawn_images);
+    for(unsigned i = 0; i < file->animation_count; i++) {
+        Anim_Close(file->animations[i].anim);
+        free(file->animations[i].path);
+    }
+    free(file->animations);
+    for(unsigned i = 0; i < file->tiled_count; i++) {
+        Tiles_Close(file->tiled[i].image);
+        free(file->tiled[i].path);
+    }
+    free(file->tiled);
+    FreeWarmup(file->warmup);
+    free(file);
+}
+
+// Frees a list of fragments and their parsed files
+static void FreeFragments(Present_Fragment* frags) {
+    while(frags) {
+        auto next = frags->next;
+        if(frags->file) {
+            FreeFile(frags->file);
+        }
+        free(frags->include_counts);
+        free(frags->path);
+        free(frags);
+        frags = next;
+    }
+}
+
+// Opens a compiled presentation; nothing is parsed, the slides are used
+// directly from the mapped file
+static Present_File* OpenCompiledFile(const char* filename) {
+    Present_File* ret = nullptr;
+    const Prsc_Header* hdr;
+    const uint8_t* base;
+    size_t size;
+    Mem_Arena* mem;
+    
+    hdr = MapCompiledFile(filename, &size);
+    if(hdr) {
+        base = (const uint8_t*)hdr;
+        mem = Arena_FromImage(base + hdr->arena_offset, hdr->arena_size);
+        if(mem) {
+            ret = AllocFile(filename);
+        } else {
+            fprintf(stderr, "Compiled presentation '%s' is corrupt!\n", filename);
+            P_UnmapFile(hdr, size);
+        }
+    }
+    
+    if(ret) {
+        ret->mem = mem;
+        ret->mapping = hdr;
+        ret->mapping_size = size;
+        ret->slide_count = hdr->slide_count;
+        ret->slide_index = (Mem_Arena_Offset*)(base + hdr->slide_index_offset);
+        ret->assets = (Present_Asset*)(base + hdr->asset_table_offset);
+        ret->asset_count = hdr->asset_count;
+        ret->title = GetString(mem, hdr->title);
+        ret->title_len = ret->title ? (unsigned)strlen(ret->title) : 0;
+        ret->authors = GetString(mem, hdr->authors);
+        ret->authors_len = ret->authors ? (unsigned)strlen(ret->authors) : 0;
+        ret->font_title = GetString(mem, hdr->font_title);
+        ret->font_chapter = GetString(mem, hdr->font_chapter);
+        ret->font_general = GetString(mem, hdr->font_general);
+        ret->color_bg = hdr->color_bg;
+        ret->color_fg = hdr->color_fg;
+        ret->color_bg_header = hdr->color_bg_header;
+        ret->color_fg_header = hdr->color_fg_header;
+        ret->promises = (Promised_Image**)calloc(ret->asset_count + 1, sizeof(Promised_Image*));
+        for(unsigned i = 0; i < ret->asset_count; i++) {
+            ImageLoader_Probe(GetString(mem, ret->assets[i].path));
+        }
+    }
+    
+    return ret;
+}
+
+// Opens and parses a presentation file.
+// `frag` is non-NULL when an included file is being parsed.
+// If `splice_includes` is set then included files are parsed in place.
+static Present_File* OpenFile(const char* filename, Present_Fragment* frag, bool splice_includes) {
     Present_File* ret = nullptr;
     FILE* f = nullptr;
+    Present_Fragment* self = nullptr;
+    char full_path[PATH_MAX];
+    Parse_State pstate;
     
     assert(filename);
     if(filename) {
         f = fopen(filename, "r");
         if(f) {
-            ret = (Present_File*)malloc(sizeof(Present_File));
+            if(IsCompiledFile(f)) {
+                fclose(f);
+                return OpenCompiledFile(filename);
+            }
+            ret = AllocFile(filename);
             if(ret) {
-                ret->path = filename;
                 ret->mem = Arena_Create(PF_MEM_SIZE);
-                ret->title = nullptr;
-                ret->authors = nullptr;
-                ret->slide_count = 1; // implicit title slide
-                ret->current_slide = 0;
-                ret->slides = nullptr;
-                SET_RGB(ret->color_bg, 255, 255, 255);
-                SET_RGB(ret->color_fg, 0, 0, 0);
-                SET_RGB(ret->color_bg_header, 43, 203, 186);
-                SET_RGB(ret->color_fg_header, 255, 255, 255);
-                if(!ParseFile(ret, f)) {
-                    Arena_Destroy(ret->mem);
-                    free(ret);
+                
+                InitParseState(&pstate, filename, frag, splice_includes);
+                
+                if(!frag && P_Realpath(filename, full_path)) {
+                    // Files included by this one must not include it
+                    self = GetFragment(full_path);
+                    self->scanning = true;
+                }
+                if(!ParseFile(ret, f, &pstate)) {
+                    FreeFile(ret);
                     ret = nullptr;
                     
                     fprintf(stderr, "Presentation parse error!\n");
@@ -629,7 +1574,12 @@ Present_File* Present_Open(const char* filename) {
                     auto mmsize = Arena_Size(ret->mem);
                     auto mmperc = (float)mmused / (float)mmsize;
                     fprintf(stderr, "Presentation uses %u / %u bytes of memory (%f%%)\n", mmused, mmsize, mmperc * 100);
+                    ret->promises = (Promised_Image**)calloc(ret->asset_count + 1, sizeof(Promised_Image*));
                 }
+                if(self) {
+                    self->scanning = false;
+                }
+                FreeParseState(&pstate);
             }
             fclose(f);
         } else {
@@ -640,10 +1590,232 @@ Present_File* Present_Open(const char* filename) {
     return ret;
 }
 
+Present_File* Present_Open(const char* filename) {
+    return OpenFile(filename, nullptr, false);
+}
+
+Present_File* Present_OpenStream(int fd) {
+    Present_File* ret = nullptr;
+    Present_Stream* stream;
+    
+    assert(fd >= 0);
+    if(fd >= 0) {
+        ret = AllocFile("-");
+        if(ret) {
+            ret->mem = Arena_Create(PF_MEM_SIZE);
+            ret->promises = (Promised_Image**)calloc(1, sizeof(Promised_Image*));
+            
+            stream = (Present_Stream*)malloc(sizeof(Present_Stream));
+            stream->fd = fd;
+            stream->fd_flags = P_SetNonBlocking(fd);
+            // Paths are relative to the working directory
+            InitParseState(&stream->pstate, ret->path, nullptr, false);
+            stream->header_read = false;
+            stream->over = false;
+            stream->pending = nullptr;
+            stream->pending_len = 0;
+            stream->pending_capacity = 0;
+            stream->parsed_slide_count = ret->slide_count;
+            ret->stream = stream;
+        }
+    }
+    
+    return ret;
+}
+
+int Present_GetStreamFd(Present_File* file) {
+    int ret = -1;
+    assert(file);
+    if(file && file->stream && !file->stream->over) {
+        ret = file->stream->fd;
+    }
+    return ret;
+}
+
+// Parses a complete line read from the stream
+static void ParseStreamLine(Present_File* file, Present_Stream* stream, const char* line, unsigned line_len) {
+    unsigned line_length;
+    char line_buf[512];
+    const unsigned line_siz = 512;
+    unsigned indent_level;
+    const char* directive;
+    unsigned directive_len;
+    
+    line_length = CopyLine(line_buf, line_siz, &indent_level, line, line_len);
+    if(line_length) {
+        if(stream->header_read) {
+            ParseLine(file, &stream->pstate, line_buf, line_length, indent_level);
+        } else if(IsDirective(&directive, &directive_len, line_buf, line_length) && strncmp(directive, "PRESENT", directive_len) == 0) {
+            stream->header_read = true;
+        } else {
+            fprintf(stderr, "#PRESENT header is missing from presentation file!\n");
+            stream->over = true;
+        }
+    }
+}
+
+bool Present_ReadStream(Present_File* file) {
+    bool ret = false;
+    Present_Stream* stream;
+    char buf[4096];
+    int len;
+    int prev_slide_count;
+    unsigned prev_asset_count;
+    bool lines_parsed = false;
+    
+    assert(file && file->stream);
+    if(!file || !file->stream || file->stream->over) {
+        return false;
+    }
+    
+    stream = file->stream;
+    prev_slide_count = file->slide_count;
+    prev_asset_count = file->asset_count;
+    // The incomplete last slide is hidden, but it's still being parsed
+    file->slide_count = stream->parsed_slide_count;
+    
+    while(!stream->over && (len = P_ReadAvailable(stream->fd, buf, sizeof(buf))) != -1) {
+        if(len == 0) {
+            stream->over = true;
+        }
+        
+        if(stream->pending_len + len > stream->pending_capacity) {
+            while(stream->pending_len + len > stream->pending_capacity) {
+                stream->pending_capacity = stream->pending_capacity ? 2 * stream->pending_capacity : sizeof(buf);
+            }
+            stream->pending = (char*)realloc(stream->pending, stream->pending_capacity);
+        }
+        memcpy(stream->pending + stream->pending_len, buf, len);
+        stream->pending_len += len;
+        
+        // Parse every complete line; the last line of the stream may not
+        // have a newline at it's end
+        unsigned line_start = 0;
+        for(unsigned i = 0; i < stream->pending_len; i++) {
+            if(stream->pending[i] == '\n') {
+                ParseStreamLine(file, stream, stream->pending + line_start, i - line_start);
+                line_start = i + 1;
+                lines_parsed = true;
+            }
+        }
+        if(stream->over && line_start < stream->pending_len) {
+            ParseStreamLine(file, stream, stream->pending + line_start, stream->pending_len - line_start);
+            line_start = stream->pending_len;
+            lines_parsed = true;
+        }
+        memmove(stream->pending, stream->pending + line_start, stream->pending_len - line_start);
+        stream->pending_len -= line_start;
+    }
+    
+    stream->parsed_slide_count = file->slide_count;
+    if(!stream->over && !stream->pstate.after_include && file->slide_count > 1) {
+        // Stand-ins of an #INCLUDE are complete as soon as they are added
+        file->slide_count--;
+    }
+    
+    if(file->asset_count != prev_asset_count) {
+        file->promises = (Promised_Image**)realloc(file->promises, (file->asset_count + 1) * sizeof(Promised_Image*));
+        memset(file->promises + prev_asset_count, 0, (file->asset_count + 1 - prev_asset_count) * sizeof(Promised_Image*));
+    }
+    
+    // The end slide may have become a regular slide
+    file->current_slide_data = GetSlide(file, file->current_slide);
+    
+    if(stream->over) {
+        FinishSlide(file, &stream->pstate);
+        auto mmused = Arena_Used(file->mem);
+        auto mmsize = Arena_Size(file->mem);
+        auto mmperc = (float)mmused / (float)mmsize;
+        fprintf(stderr, "Presentation uses %u / %u bytes of memory (%f%%)\n", mmused, mmsize, mmperc * 100);
+    }
+    
+    // NOTE(easimer): deck-wide settings are usually at the top of the
+    // file, so the regular slides are only redrawn if the slide counter
+    // has changed
+    ret = file->slide_count != prev_slide_count || stream->over || (lines_parsed && file->current_slide == 0);
+    
+    return ret;
+}
+
+// Rounds up a file offset so that the section starting there is aligned
+static uint32_t AlignSection(uint32_t off) {
+    return (off + 7) & ~7u;
+}
+
+bool Present_Compile(const char* filename, const char* output) {
+    bool ret = false;
+    Present_File* file;
+    Prsc_Header hdr;
+    FILE* f;
+    void* arena_image;
+    
+    assert(filename && output);
+    
+    file = OpenFile(filename, nullptr, true);
+    if(file) {
+        if(file->mapping) {
+            fprintf(stderr, "'%s' is already compiled!\n", filename);
+            Present_Close(file);
+            return false;
+        }
+        
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, PRSC_MAGIC, 4);
+        hdr.version = PRSC_VERSION;
+        hdr.arena_offset = AlignSection(sizeof(hdr));
+        hdr.arena_size = Arena_ImageSize(file->mem);
+        hdr.slide_index_offset = AlignSection(hdr.arena_offset + hdr.arena_size);
+        hdr.asset_table_offset = AlignSection(hdr.slide_index_offset + (file->slide_count - 1) * sizeof(Mem_Arena_Offset));
+        hdr.slide_count = file->slide_count;
+        hdr.asset_count = file->asset_count;
+        hdr.title = Arena_OffsetOf(file->mem, file->title);
+        hdr.authors = Arena_OffsetOf(file->mem, file->authors);
+        hdr.font_title = Arena_OffsetOf(file->mem, file->font_title);
+        hdr.font_chapter = Arena_OffsetOf(file->mem, file->font_chapter);
+        hdr.font_general = Arena_OffsetOf(file->mem, file->font_general);
+        hdr.color_bg = file->color_bg;
+        hdr.color_fg = file->color_fg;
+        hdr.color_bg_header = file->color_bg_header;
+        hdr.color_fg_header = file->color_fg_header;
+        
+        arena_image = malloc(hdr.arena_size);
+        Arena_WriteImage(file->mem, arena_image);
+        
+        f = fopen(output, "wb");
+        if(f) {
+            static const uint8_t zeros[8] = {};
+            ret = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+            ret = ret && fwrite(zeros, hdr.arena_offset - sizeof(hdr), 1, f) <= 1;
+            ret = ret && fwrite(arena_image, hdr.arena_size, 1, f) == 1;
+            ret = ret && fwrite(zeros, hdr.slide_index_offset - hdr.arena_offset - hdr.arena_size, 1, f) <= 1;
+            if(file->slide_count > 1) {
+                ret = ret && fwrite(file->slide_index, (file->slide_count - 1) * sizeof(Mem_Arena_Offset), 1, f) == 1;
+            }
+            ret = ret && fwrite(zeros, hdr.asset_table_offset - hdr.slide_index_offset - (file->slide_count - 1) * sizeof(Mem_Arena_Offset), 1, f) <= 1;
+            if(file->asset_count > 0) {
+                ret = ret && fwrite(file->assets, file->asset_count * sizeof(Present_Asset), 1, f) == 1;
+            }
+            if(fclose(f) != 0) {
+                ret = false;
+            }
+            if(!ret) {
+                fprintf(stderr, "Failed to write compiled presentation '%s'!\n", output);
+            }
+        } else {
+            fprintf(stderr, "Failed to open '%s' for writing: %s\n", output, strerror(errno));
+        }
+        
+        free(arena_image);
+        Present_Close(file);
+    }
+    
+    return ret;
+}
+
 void Present_Close(Present_File* file) {
     assert(file);
     if(file) {
-        free(file);
+        FreeFile(file);
     }
 }
 
@@ -683,12 +1855,12 @@ int Present_SeekTo(Present_File* file, int abs) {
             abs = file->slide_count;
             file->current_slide_data = nullptr;
         } else {
-            file->current_slide_data = file->slides;
-            for(int i = 1; i < abs; i++) {
-                file->current_slide_data = file->current_slide_data->next;
-            }
+            file->current_slide_data = GetSlide(file, abs);
             file->current_slide = abs;
         }
+        // Every slide starts zoomed out
+        file->zoom = 1;
+        file->zoom_x = file->zoom_y = 0.5f;
         ret = abs;
     }
     return ret;
@@ -735,105 +1907,644 @@ struct List_Processor_State {
     int right_y;
 };
 
-static void PreloadImages(Present_File* file, Mem_Arena_Offset offNode) {
-    auto offCur = offNode;
-    while(offCur != MEM_ARENA_INVALID_OFFSET) {
-        auto* ptrCur = RESOLVE_OFFSET(offCur, file->mem, Present_List_Node);
-        if (ptrCur->type == LNODE_IMAGE) {
-            List_Node_Image* img = (List_Node_Image*)ptrCur;
-            img->promise = ImageLoader_Request(img->path);
+// Requests an image for being shown on the current slide
+static void RequestShown(Present_File* file, Present_File* owner, unsigned asset) {
+    auto path = GetString(owner->mem, owner->assets[asset].path);
+    unsigned i;
+    owner->promises[asset] = ImageLoader_Request(path);
+    // The slide may be drawn many times
+    for(i = 0; i < file->shown_count && (file->shown[i].owner != owner || file->shown[i].asset != asset); i++) {
+    }
+    if(i == file->shown_count) {
+        ReserveOne(&file->shown, file->shown_count, &file->shown_capacity);
+        file->shown[file->shown_count++] = {owner, asset};
+    }
+}
+
+// `owner` is the file containing the slide, which is not the
+// presentation being shown if the slide was included from another file
+static void PreloadImages(Present_File* file, Present_File* owner, Present_Slide* slide) {
+    auto images = GetTable<Slide_Image>(owner->mem, slide->images);
+    for(unsigned i = 0; i < slide->image_count; i++) {
+        // An image may be shown more than once on a slide
+        if(images[i].asset != ASSET_INVALID && !owner->promises[images[i].asset]) {
+            RequestShown(file, owner, images[i].asset);
+        }
+    }
+}
+
+// Aspect ratio (height / width) assumed for images whose size is not
+// known yet, not even from their header
+#define PLACEHOLDER_ASPECT (3.0f / 4.0f)
+
+// Positions an image of the given aspect ratio (height / width) on the
+// slide and advances the layout past it
+static void PlaceImage(Image_Alignment alignment, float aspect, List_Processor_State& state,
+                       float* x, float* y, float* w, float* h) {
+    *w = 0.5f;
+    *h = aspect * 0.5f;
+    switch(alignment) {
+        case IMGALIGN_RIGHT:
+        *x = 0.5;
+        *y = VIRTUAL_Y(state.right_y);
+        state.right_y += (int)(720 * *h);
+        break;
+        default:
+        fprintf(stderr, "Unimplemented image alignment %d\n", alignment);
+        case IMGALIGN_INLINE:
+        *x = 0;
+        *y = VIRTUAL_Y(state.y);
+        state.y += (int)(720 * *h);
+        break;
+        case IMGALIGN_FULLWIDE:
+        *x = 0;
+        *y = VIRTUAL_Y(state.y);
+        *w = 1.0f;
+        *h *= 2.0f;
+        state.y += (int)(720 * *h);
+        break;
+    }
+}
+
+// Draws a box where an image that is still loading will be. The box has
+// the size of the image if it's known from the file's header, so that
+// the slide doesn't move around when the image arrives.
+static void LayoutPlaceholder(Present_File* file, const char* path, const Slide_Image* img, Render_Queue* rq,
+                              List_Processor_State& state) {
+    float x, y, w, h;
+    float aspect = PLACEHOLDER_ASPECT;
+    int width, height;
+    if(ImageLoader_GetSize(path, &width, &height)) {
+        aspect = (float)height / (float)width;
+    }
+    PlaceImage(img->alignment, aspect, state, &x, &y, &w, &h);
+    auto rect = RQ_NewCmd<RQ_Draw_Rect>(rq, RQCMD_DRAW_RECTANGLE);
+    rect->x0 = x; rect->y0 = y;
+    rect->x1 = x + w; rect->y1 = y + h;
+    // A faint shade of the text color
+    rect->color.r = 0.9f * file->color_bg.r + 0.1f * file->color_fg.r;
+    rect->color.g = 0.9f * file->color_bg.g + 0.1f * file->color_fg.g;
+    rect->color.b = 0.9f * file->color_bg.b + 0.1f * file->color_fg.b;
+    rect->color.a = 1;
+}
+
+static bool IsGif(const char* path) {
+    bool ret = false;
+    size_t len = strlen(path);
+    if(len >= 4) {
+        const char* ext = path + len - 4;
+        ret = ext[0] == '.' && tolower(ext[1]) == 'g' && tolower(ext[2]) == 'i' && tolower(ext[3]) == 'f';
+    }
+    return ret;
+}
+
+// Draws the current frame of a GIF in place of the loaded image, which
+// is it's first frame, once the GIF is known to be animated
+static void ShowAnimation(Present_File* file, const char* path, RQ_Draw_Image* cmd) {
+    Present_Animation* anim = nullptr;
+    Anim_Frame frame;
+    
+    for(unsigned i = 0; i < file->animation_count && !anim; i++) {
+        if(strcmp(file->animations[i].path, path) == 0) {
+            anim = &file->animations[i];
+        }
+    }
+    if(!anim) {
+        ReserveOne(&file->animations, file->animation_count, &file->animation_capacity);
+        anim = &file->animations[file->animation_count++];
+        anim->path = strdup(path);
+        anim->anim = nullptr;
+        anim->still = false;
+        anim->drawn = false;
+    }
+    
+    if(!anim->anim && !anim->still) {
+        // The file is read and decoded in the background; the loaded
+        // image is drawn until it's done
+        anim->anim = Anim_Open(path);
+    }
+    if(anim->anim && Anim_GetStatus(anim->anim) == ANIM_STILL) {
+        Anim_Close(anim->anim);
+        anim->anim = nullptr;
+        anim->still = true;
+    }
+    if(anim->anim) {
+        anim->drawn = true;
+        anim->area.x0 = cmd->x;
+        anim->area.y0 = cmd->y;
+        anim->area.x1 = cmd->x + cmd->w;
+        anim->area.y1 = cmd->y + cmd->h;
+        if(Anim_GetFrame(anim->anim, &frame)) {
+            cmd->width = frame.width;
+            cmd->height = frame.height;
+            cmd->buffer = (void*)frame.buffer;
+            cmd->format = frame.format;
+            cmd->mip_count = 0;
+        }
+    }
+}
+
+// Returns whether an image is large enough to be tiled, judging by the
+// size in it's header
+static bool IsTiled(const char* path) {
+    int width, height;
+    return ImageLoader_GetSize(path, &width, &height) && (width >= TILES_MIN_SIDE || height >= TILES_MIN_SIDE);
+}
+
+// Keeps the shown part of a zoomed in image inside the image
+static void ClampView(Present_File* file) {
+    float half = 0.5f / file->zoom;
+    file->zoom_x = file->zoom_x < half ? half : (file->zoom_x > 1 - half ? 1 - half : file->zoom_x);
+    file->zoom_y = file->zoom_y < half ? half : (file->zoom_y > 1 - half ? 1 - half : file->zoom_y);
+}
+
+// Zooms into the first large image on the slide: the loaded image is
+// stretched and the tiles that are on the screen are drawn over it, from
+// the level that has at least as many pixels as the screen
+static void LayoutTiles(Present_File* file, const char* path, const Loaded_Image* limg, RQ_Draw_Image* cmd,
+                        Render_Queue* rq) {
+    Present_Tiled* tiled = nullptr;
+    int width, height, levels;
+    
+    if(file->zoomable || !ImageLoader_GetSize(path, &width, &height)) {
+        return;
+    }
+    file->zoomable = true;
+    
+    // NOTE(easimer): images are at most as wide as the screen, see
+    // RenderLoop
+    unsigned screen_width = ImageLoader_GetMaxImageWidth();
+    float rect_px = cmd->w * (screen_width > 0 ? screen_width : 1280);
+    file->zoom_max = ZOOM_MAX_PIXEL * width / rect_px;
+    if(file->zoom_max < 1) {
+        file->zoom_max = 1;
+    }
+    
+    float zoom = file->zoom;
+    float u0 = file->zoom_x - 0.5f / zoom;
+    float v0 = file->zoom_y - 0.5f / zoom;
+    float rect_w = cmd->w, rect_h = cmd->h;
+    cmd->x -= u0 * zoom * rect_w;
+    cmd->y -= v0 * zoom * rect_h;
+    cmd->w = rect_w * zoom;
+    cmd->h = rect_h * zoom;
+    if(zoom <= 1) {
+        // The loaded image is as sharp
+        return;
+    }
+    
+    for(unsigned i = 0; i < file->tiled_count && !tiled; i++) {
+        if(strcmp(file->tiled[i].path, path) == 0) {
+            tiled = &file->tiled[i];
+        }
+    }
+    if(!tiled) {
+        // NOTE(easimer): the image is tiled the first time it's zoomed
+        // into; until then it's temporary file would only take up space
+        ReserveOne(&file->tiled, file->tiled_count, &file->tiled_capacity);
+        tiled = &file->tiled[file->tiled_count++];
+        tiled->path = strdup(path);
+        tiled->image = Tiles_Open(path);
+    }
+    tiled->drawn = true;
+    
+    Tiles_NextFrame(tiled->image);
+    // Without a wakeup descriptor nothing would draw the slide again, so
+    // the image's size and tiles are waited for, like the images
+    if(!Tiles_GetInfo(tiled->image, &width, &height, &levels, !file->progressive)) {
+        // Drawn again once the size is known
+        if(file->progressive) {
+            file->images_pending = true;
+        }
+        return;
+    }
+    int level = 0;
+    while(level + 1 < levels && (width >> (level + 1)) / zoom >= rect_px) {
+        level++;
+    }
+    int level_w = width >> level;
+    int level_h = height >> level;
+    if(level_w <= limg->width) {
+        // The loaded image is as sharp
+        return;
+    }
+    
+    // The tiles that are at least partly shown
+    float u1 = u0 + 1 / zoom;
+    float v1 = v0 + 1 / zoom;
+    int cols = (level_w + TILE_SIZE - 1) / TILE_SIZE;
+    int rows = (level_h + TILE_SIZE - 1) / TILE_SIZE;
+    int x0 = (int)(u0 * level_w) / TILE_SIZE;
+    int y0 = (int)(v0 * level_h) / TILE_SIZE;
+    int x1 = ((int)ceilf(u1 * level_w) - 1) / TILE_SIZE;
+    int y1 = ((int)ceilf(v1 * level_h) - 1) / TILE_SIZE;
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 >= cols ? cols - 1 : x1;
+    y1 = y1 >= rows ? rows - 1 : y1;
+    for(int y = y0; y <= y1; y++) {
+        for(int x = x0; x <= x1; x++) {
+            Tile tile;
+            if(Tiles_GetTile(tiled->image, level, x, y, &tile, !file->progressive)) {
+                auto tcmd = RQ_NewCmd<RQ_Draw_Image>(rq, RQCMD_DRAW_IMAGE);
+                tcmd->x = cmd->x + cmd->w * x * TILE_SIZE / level_w;
+                tcmd->y = cmd->y + cmd->h * y * TILE_SIZE / level_h;
+                tcmd->w = cmd->w * tile.width / level_w;
+                tcmd->h = cmd->h * tile.height / level_h;
+                tcmd->width = tile.width;
+                tcmd->height = tile.height;
+                tcmd->buffer = (void*)tile.buffer;
+                tcmd->format = tile.format;
+                tcmd->mip_count = 0;
+            } else {
+                // The loaded image shows through until the tile is ready
+                if(file->progressive) {
+                    file->images_pending = true;
+                }
+            }
+        }
+    }
+}
+
+static void LayoutImage(Present_File* file, Present_File* owner, const Slide_Image* img, Render_Queue* rq, List_Processor_State& state) {
+    RQ_Push_Clip* clip = nullptr;
+    RQ_Draw_Image* cmd = nullptr;
+    int w, h;
+    Loaded_Image* limg = nullptr;
+    const char* path = nullptr;
+    
+    if(img->asset != ASSET_INVALID) {
+        auto& promise = owner->promises[img->asset];
+        path = GetString(owner->mem, owner->assets[img->asset].path);
+        if(!promise) {
+            // Shown again on this slide; it's cached by now
+            RequestShown(file, owner, img->asset);
+        }
+        if(file->progressive && !ImageLoader_Poll(promise)) {
+            // Keep the promise; the slide is drawn again once it's ready
+            LayoutPlaceholder(file, path, img, rq, state);
+            file->images_pending = true;
+            return;
+        }
+        limg = ImageLoader_Await(promise);
+        promise = nullptr;
+    }
+    if(limg && IsTiled(path)) {
+        // When zoomed in, the image mustn't cover the rest of the slide
+        clip = RQ_NewCmd<RQ_Push_Clip>(rq, RQCMD_PUSH_CLIP);
+    }
+    cmd = RQ_NewCmd<RQ_Draw_Image>(rq, RQCMD_DRAW_IMAGE);
+    if(limg) {
+        // NOTE(easimer): the command refers to the loaded image instead of
+        // a copy of it, which is freed when the next slide is drawn
+        w = limg->width;
+        h = limg->height;
+        cmd->width = w;
+        cmd->height = h;
+        cmd->buffer = limg->buffer;
+        cmd->format = limg->format;
+        // The display picks the level that's closest to the drawn size
+        cmd->mip_count = 0;
+        for(int i = 0; i < limg->mip_count && i < RQ_MAX_IMAGE_MIPS; i++) {
+            auto& level = cmd->mips[cmd->mip_count++];
+            level.width = limg->mips[i].width;
+            level.height = limg->mips[i].height;
+            level.buffer = limg->mips[i].buffer;
+        }
+        ReserveOne(&file->drawn_images, file->drawn_count, &file->drawn_capacity);
+        file->drawn_images[file->drawn_count++] = limg;
+        
+        PlaceImage(img->alignment, (float)h / (float)w, state, &cmd->x, &cmd->y, &cmd->w, &cmd->h);
+        if(IsGif(path)) {
+            ShowAnimation(file, path, cmd);
+        }
+        if(clip) {
+            clip->area.x0 = cmd->x;
+            clip->area.y0 = cmd->y;
+            clip->area.x1 = cmd->x + cmd->w;
+            clip->area.y1 = cmd->y + cmd->h;
+            LayoutTiles(file, path, limg, cmd, rq);
+            RQ_NewCmd<RQ_Pop_Clip>(rq, RQCMD_POP_CLIP);
         }
-        if(ptrCur->children != MEM_ARENA_INVALID_OFFSET) {
-            PreloadImages(file, ptrCur->children);
+    } else {
+        if(img->asset != ASSET_INVALID) {
+            fprintf(stderr, "Couldn't load image '%s'\n", GetString(owner->mem, owner->assets[img->asset].path));
         }
-        offCur = ptrCur->next;
+        cmd->width = cmd->height = 0;
+        cmd->buffer = nullptr;
+        cmd->format = PIXFMT_ARGB32;
+        cmd->mip_count = 0;
     }
 }
 
-static void ProcessListElement(Present_File* file, Mem_Arena_Offset offNode, Render_Queue* rq,
-                               List_Processor_State& state) {
-    auto offCur = offNode;
-    while(offCur != MEM_ARENA_INVALID_OFFSET) {
-        auto* ptrCur = RESOLVE_OFFSET(offCur, file->mem, Present_List_Node);
-        if (ptrCur->type == LNODE_TEXT) {
+// `owner` is the file containing the slide, which is not `file` if the
+// slide was included from another file
+static void LayoutContent(Present_File* file, Present_File* owner, Present_Slide* slide, Render_Queue* rq,
+                          List_Processor_State& state) {
+    auto mem = owner->mem;
+    auto nodes = GetTable<Present_Content_Node>(mem, slide->nodes);
+    auto texts = GetTable<Slide_Text>(mem, slide->texts);
+    auto images = GetTable<Slide_Image>(mem, slide->images);
+    for(unsigned i = 0; i < slide->node_count; i++) {
+        auto& node = nodes[i];
+        if(node.type == LNODE_TEXT) {
             RQ_Draw_Text* cmd = nullptr;
-            List_Node_Text* text = (List_Node_Text*)ptrCur;
+            auto& text = texts[node.index];
             cmd = RQ_NewCmd<RQ_Draw_Text>(rq, RQCMD_DRAW_TEXT);
-            cmd->x = VIRTUAL_X(state.x);
+            cmd->x = VIRTUAL_X(state.x + 24 * node.depth);
             cmd->y = VIRTUAL_Y(state.y);
-            cmd->size = text->scale * VIRTUAL_Y(32);
-            cmd->text = RESOLVE_OFFSET(text->text, file->mem, char);
+            cmd->size = text.scale * VIRTUAL_Y(32);
+            cmd->text = GetString(mem, text.text);
             cmd->font_name = file->font_general;
             cmd->color = file->color_fg;
             state.y += 40;
-        } else if (ptrCur->type == LNODE_IMAGE) {
-            RQ_Draw_Image* cmd = nullptr;
-            int w, h;
-            void *pixbuf_final;
-            List_Node_Image* img = (List_Node_Image*)ptrCur;
-            cmd = RQ_NewCmd<RQ_Draw_Image>(rq, RQCMD_DRAW_IMAGE);
-            
-            assert(img->promise != nullptr);
-            auto limg = ImageLoader_Await(img->promise);
-            if(limg) {
-                // TODO(easimer): this copy shouldn't be needed
-                w = limg->width;
-                h = limg->height;
-                unsigned pixbuf_siz = sizeof(stbi_uc) * w * h * 4;
-                pixbuf_final = Arena_Alloc(rq->mem, pixbuf_siz);
-                memcpy(pixbuf_final, limg->buffer, pixbuf_siz);
-                cmd->width = w;
-                cmd->height = h;
-                cmd->w = 0.5f;
-                cmd->h = ((float)h / (float)w) * 0.5f;
-                cmd->buffer = pixbuf_final;
-                ImageLoader_Free(limg);
-                img->promise = nullptr;
-                
-                switch(img->alignment) {
-                    case IMGALIGN_RIGHT:
-                    cmd->x = 0.5;
-                    cmd->y = VIRTUAL_Y(state.right_y);
-                    state.right_y += (int)(720 * cmd->h);
-                    break;
-                    default:
-                    fprintf(stderr, "Unimplemented image alignment %d\n", img->alignment);
-                    case IMGALIGN_INLINE:
-                    cmd->x = 0;
-                    cmd->y = VIRTUAL_Y(state.y);
-                    state.y += (int)(720 * cmd->h);
-                    break;
-                    case IMGALIGN_FULLWIDE:
-                    cmd->x = 0;
-                    cmd->y = VIRTUAL_Y(state.y);
-                    cmd->w = 1.0f;
-                    cmd->h *= 2.0f;
-                    state.y += (int)(720 * cmd->h);
-                    break;
+        } else if(node.type == LNODE_IMAGE) {
+            LayoutImage(file, owner, &images[node.index], rq, state);
+        }
+    }
+}
+
+// Returns the slide whose contents should be shown in place of `slide`.
+// If `slide` stands in for a slide of an included file then that file
+// gets parsed here, on first use. `owner` receives the file that holds
+// the contents of the returned slide.
+static Present_Slide* ResolveSlide(Present_File* file, Present_Slide* slide, Present_File** owner) {
+    assert(file && owner);
+    *owner = file;
+    while(slide && slide->fragment_path != MEM_ARENA_INVALID_OFFSET) {
+        auto frag = GetFragment(GetString((*owner)->mem, slide->fragment_path));
+        auto idx = slide->fragment_slide;
+        if(!frag->file) {
+            frag->file = OpenFile(frag->path, frag, false);
+        }
+        slide = nullptr;
+        if(frag->file) {
+            *owner = frag->file;
+            slide = GetSlide(frag->file, idx);
+        }
+    }
+    return slide;
+}
+
+// Starts loading the images of a slide in the background, unless they
+// have been requested already. Loaded images stay in the image cache
+// until the slide is shown.
+static void PrefetchSlide(Present_File* file, int idx) {
+    Present_File* owner;
+    auto slide = ResolveSlide(file, GetSlide(file, idx), &owner);
+    if(slide) {
+        auto images = GetTable<Slide_Image>(owner->mem, slide->images);
+        for(unsigned i = 0; i < slide->image_count; i++) {
+            if(images[i].asset != ASSET_INVALID) {
+                unsigned p;
+                for(p = 0; p < file->prefetch_count; p++) {
+                    auto& prefetch = file->prefetches[p];
+                    if(prefetch.owner == owner && prefetch.asset == images[i].asset) {
+                        prefetch.keep = true;
+                        break;
+                    }
+                }
+                if(p == file->prefetch_count) {
+                    auto path = GetString(owner->mem, owner->assets[images[i].asset].path);
+                    ReserveOne(&file->prefetches, file->prefetch_count, &file->prefetch_capacity);
+                    file->prefetches[p] = {owner, images[i].asset, ImageLoader_Request(path, IMGPRI_PREFETCH), true};
+                    file->prefetch_count++;
                 }
+            }
+        }
+    }
+}
+
+// Gives up on the images requested for the slides shown before, except
+// the ones on the current slide. Those still loading would otherwise be
+// loaded before the current slide's neighbours; the neighbours have
+// their own prefetch requests.
+static void ReleaseShown(Present_File* file) {
+    Present_File* owner;
+    unsigned kept = 0;
+    auto slide = ResolveSlide(file, GetSlide(file, file->current_slide), &owner);
+    auto images = slide ? GetTable<Slide_Image>(owner->mem, slide->images) : nullptr;
+    for(unsigned i = 0; i < file->shown_count; i++) {
+        auto& shown = file->shown[i];
+        bool keep = false;
+        for(unsigned j = 0; slide && j < slide->image_count && !keep; j++) {
+            keep = shown.owner == owner && images[j].asset == shown.asset;
+        }
+        if(keep) {
+            file->shown[kept++] = shown;
+        } else {
+            ImageLoader_Free(shown.owner->promises[shown.asset]);
+            shown.owner->promises[shown.asset] = nullptr;
+        }
+    }
+    file->shown_count = kept;
+}
+
+static bool ShowsImage(Present_File* owner, Present_Slide* slide, const char* path);
+
+// Stops tiling the large images that aren't on the slides around the
+// current one, which deletes their temporary files. They are tiled again
+// if they're zoomed into later.
+static void CloseDistantTiles(Present_File* file) {
+    unsigned kept = 0;
+    for(unsigned i = 0; i < file->tiled_count; i++) {
+        bool keep = false;
+        for(int idx = file->current_slide - file->prefetch_behind;
+            idx <= file->current_slide + file->prefetch_ahead && !keep; idx++) {
+            Present_File* owner;
+            auto slide = ResolveSlide(file, GetSlide(file, idx), &owner);
+            keep = slide && ShowsImage(owner, slide, file->tiled[i].path);
+        }
+        if(keep) {
+            file->tiled[kept++] = file->tiled[i];
+        } else {
+            Tiles_Close(file->tiled[i].image);
+            free(file->tiled[i].path);
+        }
+    }
+    file->tiled_count = kept;
+}
+
+// Prefetches the slides around the current one, once per slide change.
+// The slides ahead come first since that's where the presenter is
+// most likely going. Requests for slides that are no longer nearby are
+// cancelled if they haven't been loaded yet.
+static void PrefetchNeighbours(Present_File* file) {
+    unsigned kept = 0;
+    if(file->prefetched_slide != file->current_slide) {
+        file->prefetched_slide = file->current_slide;
+        ReleaseShown(file);
+        CloseDistantTiles(file);
+        for(unsigned i = 0; i < file->prefetch_count; i++) {
+            file->prefetches[i].keep = false;
+        }
+        for(int i = 1; i <= file->prefetch_ahead; i++) {
+            PrefetchSlide(file, file->current_slide + i);
+        }
+        for(int i = 1; i <= file->prefetch_behind; i++) {
+            PrefetchSlide(file, file->current_slide - i);
+        }
+        for(unsigned i = 0; i < file->prefetch_count; i++) {
+            if(file->prefetches[i].keep) {
+                file->prefetches[kept++] = file->prefetches[i];
             } else {
-                fprintf(stderr, "Couldn't load image '%s'\n", img->path);
-                cmd->width = cmd->height = 0;
-                cmd->buffer = nullptr;
+                ImageLoader_Free(file->prefetches[i].promise);
             }
         }
-        if(ptrCur->children != MEM_ARENA_INVALID_OFFSET) {
-            state.x += 24;
-            ProcessListElement(file, ptrCur->children, rq, state);
+        file->prefetch_count = kept;
+    }
+}
+
+// Orders warm-up images by their position on the disk, and by the slide
+// they're first shown on if that's the same (or unknown)
+static int CompareDiskOrder(const void* lhs, const void* rhs) {
+    auto a = (const Present_Warmup_Image*)lhs;
+    auto b = (const Present_Warmup_Image*)rhs;
+    int ret = 0;
+    if(a->disk_order != b->disk_order) {
+        ret = a->disk_order < b->disk_order ? -1 : 1;
+    } else if(a->index != b->index) {
+        ret = a->index < b->index ? -1 : 1;
+    }
+    return ret;
+}
+
+// Collects the images of every slide, each path once
+static void CollectWarmupImages(Present_File* file, Present_Warmup* warmup) {
+    Present_File* owner;
+    for(int idx = 1; idx < file->slide_count; idx++) {
+        auto slide = ResolveSlide(file, GetSlide(file, idx), &owner);
+        if(!slide) {
+            continue;
         }
-        offCur = ptrCur->next;
+        auto images = GetTable<Slide_Image>(owner->mem, slide->images);
+        for(unsigned i = 0; i < slide->image_count; i++) {
+            if(images[i].asset == ASSET_INVALID) {
+                continue;
+            }
+            auto path = GetString(owner->mem, owner->assets[images[i].asset].path);
+            unsigned w;
+            for(w = 0; w < warmup->count && strcmp(warmup->images[w].path, path) != 0; w++) {
+            }
+            if(w == warmup->count) {
+                ReserveOne(&warmup->images, warmup->count, &warmup->capacity);
+                warmup->images[w] = {strdup(path), 0, w, nullptr, nullptr};
+                warmup->count++;
+            }
+        }
+    }
+}
+
+// Returns whether the pixels of a warm-up image were loaded already for
+// an earlier image
+static bool IsWarmedUp(Present_Warmup* warmup, unsigned idx, const char* buffer) {
+    bool ret = false;
+    for(unsigned i = 0; i < warmup->next && !ret; i++) {
+        ret = i != idx && warmup->images[i].image && warmup->images[i].image->buffer == buffer;
+    }
+    return ret;
+}
+
+// Returns whether one more warm-up image is expected to fit into the
+// budget along with the ones still loading, going by the average size
+// of the ones loaded so far
+static bool WarmupHasRoom(Present_Warmup* warmup) {
+    size_t average = warmup->loaded ? warmup->bytes / warmup->loaded : 0;
+    size_t loading = warmup->next - warmup->loaded;
+    return warmup->bytes + average * (loading + 1) <= warmup->budget;
+}
+
+void Present_StartWarmup(Present_File* file, size_t budget) {
+    assert(file);
+    if(file) {
+        FreeWarmup(file->warmup);
+        auto warmup = (Present_Warmup*)calloc(1, sizeof(Present_Warmup));
+        warmup->budget = budget;
+        CollectWarmupImages(file, warmup);
+        // The OS reads every file in the background while the first ones
+        // are decoded
+        for(unsigned i = 0; i < warmup->count; i++) {
+            Fetch_Advise(warmup->images[i].path);
+            warmup->images[i].disk_order = Fetch_DiskOrder(warmup->images[i].path);
+        }
+        // NOTE(easimer): requests of the same priority are loaded in the
+        // order they were made
+        qsort(warmup->images, warmup->count, sizeof(Present_Warmup_Image), CompareDiskOrder);
+        file->warmup = warmup;
+        Present_UpdateWarmup(file, nullptr);
     }
-    state.x -= 24;
+}
+
+bool Present_UpdateWarmup(Present_File* file, Present_Warmup_Progress* out) {
+    bool ret = false;
+    assert(file);
+    if(file && file->warmup) {
+        auto warmup = file->warmup;
+        for(unsigned i = warmup->oldest; i < warmup->next; i++) {
+            auto& image = warmup->images[i];
+            if(image.promise && ImageLoader_Poll(image.promise)) {
+                auto limg = ImageLoader_Await(image.promise);
+                image.promise = nullptr;
+                image.image = limg;
+                if(limg && !IsWarmedUp(warmup, i, limg->buffer)) {
+                    warmup->bytes += Pixel_Stride(limg->format, limg->width) * limg->height;
+                    for(int m = 0; m < limg->mip_count; m++) {
+                        warmup->bytes += Pixel_Stride(limg->format, limg->mips[m].width) * limg->mips[m].height;
+                    }
+                }
+                warmup->loaded++;
+            }
+        }
+        // Images finish out of order; the window only moves past
+        // the finished ones at it's start
+        while(warmup->oldest < warmup->next && !warmup->images[warmup->oldest].promise) {
+            warmup->oldest++;
+        }
+        while(warmup->next < warmup->count && warmup->next - warmup->oldest < WARMUP_WINDOW &&
+              WarmupHasRoom(warmup)) {
+            auto& image = warmup->images[warmup->next];
+            image.promise = ImageLoader_Request(image.path, IMGPRI_WARMUP);
+            if(!image.promise) {
+                // The loader isn't running
+                warmup->loaded++;
+            }
+            warmup->next++;
+        }
+        if(!warmup->done && warmup->loaded == warmup->next &&
+           (warmup->next == warmup->count || !WarmupHasRoom(warmup))) {
+            // The images are left in the image cache
+            for(unsigned i = 0; i < warmup->next; i++) {
+                ImageLoader_Free(warmup->images[i].image);
+                warmup->images[i].image = nullptr;
+            }
+            warmup->done = true;
+        }
+        if(out) {
+            out->loaded = warmup->loaded;
+            out->total = warmup->count;
+            out->bytes = warmup->bytes;
+            out->done = warmup->done;
+        }
+        ret = true;
+    }
+    return ret;
 }
 
 static void PresentFillRQRegularSlide(Present_File* file, Present_Slide* slide, Render_Queue* rq) {
     List_Processor_State lps = {8, 160, 80};
     RQ_Draw_Text* cmd = nullptr;
     RQ_Draw_Rect* rect = nullptr;
+    Present_File* owner = nullptr;
+    const char* chapter_title = GetString(file->mem, slide->chapter_title);
     
     PresentClearScreen(file, rq, file->color_bg.r, file->color_bg.g, file->color_bg.b);
     
-    if(slide->chapter_title) {
+    slide = ResolveSlide(file, slide, &owner);
+    if(slide && slide->chapter_title != MEM_ARENA_INVALID_OFFSET) {
+        chapter_title = GetString(owner->mem, slide->chapter_title);
+    }
+    
+    if(chapter_title) {
         rect = RQ_NewCmd<RQ_Draw_Rect>(rq, RQCMD_DRAW_RECTANGLE);
         rect->x0 = 0; rect->y0 = 0;
         rect->x1 = 1; rect->y1 = VIRTUAL_Y(72);
@@ -843,26 +2554,35 @@ static void PresentFillRQRegularSlide(Present_File* file, Present_Slide* slide,
         cmd->x = VIRTUAL_X(10);
         cmd->y = VIRTUAL_Y(64);
         cmd->size = VIRTUAL_Y(64);
-        cmd->text = slide->chapter_title;
+        cmd->text = chapter_title;
         cmd->font_name = file->font_chapter;
         cmd->color = file->color_fg_header;
     }
-    if(slide->subtitle) {
+    if(slide && slide->subtitle != MEM_ARENA_INVALID_OFFSET) {
         cmd = RQ_NewCmd<RQ_Draw_Text>(rq, RQCMD_DRAW_TEXT);
         cmd->x = VIRTUAL_X(10); cmd->y = VIRTUAL_Y(120);
         cmd->size = VIRTUAL_Y(44);
-        cmd->text = slide->subtitle;
+        cmd->text = GetString(owner->mem, slide->subtitle);
         cmd->font_name = file->font_general;
         cmd->color = file->color_fg;
     }
     
-    PreloadImages(file, slide->content);
-    ProcessListElement(file, slide->content, rq, lps);
+    if(slide) {
+        PreloadImages(file, owner, slide);
+    }
+    // The images of this slide are requested first; they are more
+    // important and may have been prefetched
+    PrefetchNeighbours(file);
+    if(slide) {
+        LayoutContent(file, owner, slide, rq, lps);
+    }
     
     cmd = RQ_NewCmd<RQ_Draw_Text>(rq, RQCMD_DRAW_TEXT);
-    int slide_num_len = snprintf(nullptr, 0, "%d / %d", file->current_slide, file->slide_count);
+    // More slides may follow while the presentation is being streamed
+    const char* slide_num_fmt = Present_GetStreamFd(file) != -1 ? "%d / %d+" : "%d / %d";
+    int slide_num_len = snprintf(nullptr, 0, slide_num_fmt, file->current_slide, file->slide_count);
     cmd->text = (char*)Arena_Alloc(rq->mem, slide_num_len + 1);
-    snprintf((char*)cmd->text, slide_num_len + 1, "%d / %d", file->current_slide, file->slide_count);
+    snprintf((char*)cmd->text, slide_num_len + 1, slide_num_fmt, file->current_slide, file->slide_count);
     cmd->x = VIRTUAL_X(1280 - 50);
     cmd->y = VIRTUAL_Y(720 - 18);
     cmd->size = VIRTUAL_Y(18);
@@ -873,14 +2593,43 @@ static void PresentFillRQRegularSlide(Present_File* file, Present_Slide* slide,
 void Present_FillRenderQueue(Present_File* file, Render_Queue* rq) {
     assert(file && rq);
     if(file && rq) {
+        file->images_pending = false;
+        // The previous render queue is done with these
+        for(unsigned i = 0; i < file->drawn_count; i++) {
+            ImageLoader_Free(file->drawn_images[i]);
+        }
+        file->drawn_count = 0;
+        for(unsigned i = 0; i < file->animation_count; i++) {
+            file->animations[i].drawn = false;
+        }
+        for(unsigned i = 0; i < file->tiled_count; i++) {
+            file->tiled[i].drawn = false;
+        }
+        file->zoomable = false;
         if(file->current_slide == 0) {
             PresentFillRQTitleSlide(file, rq);
+            PrefetchNeighbours(file);
         } else if(file->current_slide == file->slide_count) {
             PresentFillRQEndSlide(file, rq);
+            PrefetchNeighbours(file);
         } else {
             auto slide = file->current_slide_data;
             PresentFillRQRegularSlide(file, slide, rq);
         }
+        // GIFs stop playing once they're off the slide; their frames
+        // aren't kept
+        for(unsigned i = 0; i < file->animation_count; i++) {
+            auto& anim = file->animations[i];
+            if(!anim.drawn && anim.anim) {
+                Anim_Close(anim.anim);
+                anim.anim = nullptr;
+            }
+        }
+        for(unsigned i = 0; i < file->tiled_count; i++) {
+            if(!file->tiled[i].drawn) {
+                Tiles_DropCache(file->tiled[i].image);
+            }
+        }
     }
 }
 
@@ -889,10 +2638,13 @@ void Present_ExecuteCommandOnCurrentSlide(Present_File* file) {
         return;
     if (!file->current_slide_data)
         return;
-    if(!file->current_slide_data->exec_cmdLine)
+
+    Present_File* owner;
+    auto slide = ResolveSlide(file, file->current_slide_data, &owner);
+    if(!slide || slide->exec_cmdLine == MEM_ARENA_INVALID_OFFSET)
         return;
 
-    const char* cmdline = file->current_slide_data->exec_cmdLine;
+    const char* cmdline = GetString(owner->mem, slide->exec_cmdLine);
 
 #if _WIN32
     STARTUPINFOA si;
@@ -908,4 +2660,205 @@ void Present_ExecuteCommandOnCurrentSlide(Present_File* file) {
 #else
     system(cmdline);
 #endif
-}
\ No newline at end of file
+}
+
+static void ForEachDependency(Present_File* file, void (*callback)(const char* path, Present_Dependency kind, void* user), void* user) {
+    Mem_Arena_Offset last_fragment = MEM_ARENA_INVALID_OFFSET;
+    
+    if(!file->stream) {
+        callback(file->path, PDEP_PRESENTATION, user);
+    }
+    
+    for(unsigned i = 0; i < file->asset_count; i++) {
+        callback(GetString(file->mem, file->assets[i].path), PDEP_IMAGE, user);
+    }
+    
+    for(int i = 1; i < file->slide_count; i++) {
+        auto slide = GetSlide(file, i);
+        // Every stand-in slide of an #INCLUDE shares the path
+        if(slide->fragment_path != MEM_ARENA_INVALID_OFFSET && slide->fragment_path != last_fragment) {
+            auto frag = GetFragment(GetString(file->mem, slide->fragment_path));
+            if(frag->file) {
+                ForEachDependency(frag->file, callback, user);
+            } else {
+                callback(frag->path, PDEP_PRESENTATION, user);
+            }
+            last_fragment = slide->fragment_path;
+        }
+    }
+}
+
+void Present_ForEachDependency(Present_File* file, void (*callback)(const char* path, Present_Dependency kind, void* user), void* user) {
+    assert(file && callback);
+    if(file && callback) {
+        ForEachDependency(file, callback, user);
+    }
+}
+
+void Present_SetPrefetch(Present_File* file, int ahead, int behind) {
+    assert(file && ahead >= 0 && behind >= 0);
+    if(file && ahead >= 0 && behind >= 0) {
+        file->prefetch_ahead = ahead;
+        file->prefetch_behind = behind;
+        file->prefetched_slide = -1;
+    }
+}
+
+void Present_SetProgressive(Present_File* file, bool progressive) {
+    assert(file);
+    if(file) {
+        file->progressive = progressive;
+    }
+}
+
+bool Present_ImagesPending(Present_File* file) {
+    bool ret = false;
+    assert(file);
+    if(file) {
+        ret = file->images_pending;
+    }
+    return ret;
+}
+
+bool Present_UpdateAnimations(Present_File* file, RQ_Rect* area) {
+    bool ret = false;
+    assert(file && area);
+    if(file && area) {
+        for(unsigned i = 0; i < file->animation_count; i++) {
+            auto& anim = file->animations[i];
+            if(anim.anim && Anim_Update(anim.anim)) {
+                if(!ret) {
+                    *area = anim.area;
+                } else {
+                    // Every changed GIF is covered
+                    area->x0 = anim.area.x0 < area->x0 ? anim.area.x0 : area->x0;
+                    area->y0 = anim.area.y0 < area->y0 ? anim.area.y0 : area->y0;
+                    area->x1 = anim.area.x1 > area->x1 ? anim.area.x1 : area->x1;
+                    area->y1 = anim.area.y1 > area->y1 ? anim.area.y1 : area->y1;
+                }
+                ret = true;
+            }
+        }
+    }
+    return ret;
+}
+
+int Present_GetAnimationWait(Present_File* file) {
+    int ret = -1;
+    assert(file);
+    if(file) {
+        for(unsigned i = 0; i < file->animation_count; i++) {
+            if(file->animations[i].anim) {
+                int wait = Anim_GetWait(file->animations[i].anim);
+                if(wait >= 0 && (ret < 0 || wait < ret)) {
+                    ret = wait;
+                }
+            }
+        }
+    }
+    return ret;
+}
+
+bool Present_Zoom(Present_File* file, int steps) {
+    bool ret = false;
+    assert(file);
+    if(file && file->zoomable) {
+        float zoom = steps == 0 ? 1 : file->zoom * powf(ZOOM_STEP, (float)steps);
+        zoom = zoom < 1 ? 1 : (zoom > file->zoom_max ? file->zoom_max : zoom);
+        ret = zoom != file->zoom;
+        file->zoom = zoom;
+        ClampView(file);
+    }
+    return ret;
+}
+
+bool Present_Pan(Present_File* file, int dx, int dy) {
+    bool ret = false;
+    assert(file);
+    if(file && Present_IsZoomed(file)) {
+        float x = file->zoom_x, y = file->zoom_y;
+        file->zoom_x += dx * PAN_STEP / file->zoom;
+        file->zoom_y += dy * PAN_STEP / file->zoom;
+        ClampView(file);
+        ret = x != file->zoom_x || y != file->zoom_y;
+    }
+    return ret;
+}
+
+bool Present_IsZoomed(Present_File* file) {
+    bool ret = false;
+    assert(file);
+    if(file) {
+        ret = file->zoomable && file->zoom > 1;
+    }
+    return ret;
+}
+
+Present_File* Present_Reload(Present_File* file) {
+    Present_File* ret = file;
+    Present_File* reloaded;
+    
+    assert(file);
+    if(file && file->stream) {
+        fprintf(stderr, "A presentation read from a pipe can't be reloaded\n");
+    } else if(file) {
+        // NOTE(easimer): the included files are scanned and parsed again
+        // into a new set of fragments. The old set is kept until the
+        // reload succeeds, since the old file's slides and requests point
+        // into it.
+        auto old_fragments = gFragments;
+        gFragments = nullptr;
+        reloaded = Present_Open(file->path);
+        if(reloaded) {
+            Present_SetPrefetch(reloaded, file->prefetch_ahead, file->prefetch_behind);
+            Present_SetProgressive(reloaded, file->progressive);
+            // NOTE(easimer): a finished warm-up isn't restarted since
+            // nothing polls it anymore; it's window of requests would stay
+            // pinned. New images are loaded when they're shown.
+            if(file->warmup && !file->warmup->done) {
+                // Unchanged images are found in the image cache
+                Present_StartWarmup(reloaded, file->warmup->budget);
+            }
+            // Large images that were zoomed into aren't tiled again
+            reloaded->tiled = file->tiled;
+            reloaded->tiled_count = file->tiled_count;
+            reloaded->tiled_capacity = file->tiled_capacity;
+            file->tiled = nullptr;
+            file->tiled_count = file->tiled_capacity = 0;
+            Present_SeekTo(reloaded, file->current_slide);
+            Present_Close(file);
+            FreeFragments(old_fragments);
+            ret = reloaded;
+        } else {
+            FreeFragments(gFragments);
+            gFragments = old_fragments;
+            fprintf(stderr, "Failed to reload '%s', keeping the previous version\n", file->path);
+        }
+    }
+    
+    return ret;
+}
+
+static bool ShowsImage(Present_File* owner, Present_Slide* slide, const char* path) {
+    bool ret = false;
+    auto images = GetTable<Slide_Image>(owner->mem, slide->images);
+    for(unsigned i = 0; i < slide->image_count && !ret; i++) {
+        if(images[i].asset != ASSET_INVALID) {
+            ret = strcmp(GetString(owner->mem, owner->assets[images[i].asset].path), path) == 0;
+        }
+    }
+    return ret;
+}
+
+bool Present_CurrentSlideShowsImage(Present_File* file, const char* path) {
+    bool ret = false;
+    Present_File* owner;
+    assert(file && path);
+    if(file && path && file->current_slide_data) {
+        auto slide = ResolveSlide(file, file->current_slide_data, &owner);
+        if(slide) {
+            ret = ShowsImage(owner, slide, path);
+        }
+    }
+    return ret;
+}
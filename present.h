@@ -22,6 +22,49 @@ struct Present_File;
 // Load a presentation file into memory
 Present_File* Present_Open(const char* filename);
 
+// Opens a presentation that is read from `fd` (usually a pipe) while
+// it's being shown. Nothing is read here; the presentation starts out
+// empty and grows with every call to Present_ReadStream. A slide
+// becomes visible once it's complete.
+Present_File* Present_OpenStream(int fd);
+
+// Returns the file descriptor a streamed presentation is read from or
+// -1 if the presentation isn't streamed or the stream has ended.
+// Present_ReadStream should be called when it becomes readable.
+int Present_GetStreamFd(Present_File* file);
+
+// Parses whatever can be read from the stream without blocking.
+// Returns whether the current slide has to be redrawn.
+bool Present_ReadStream(Present_File* file);
+
+// Parses a presentation file and writes it in compiled form to `output`.
+// Included files are spliced into the compiled presentation. Compiled
+// presentations can be opened by Present_Open without any parsing.
+// Returns whether it succeeded.
+bool Present_Compile(const char* filename, const char* output);
+
+// Kinds of files a presentation depends on
+enum Present_Dependency {
+    // The presentation file or a file included by it
+    PDEP_PRESENTATION,
+    // An image shown on a slide
+    PDEP_IMAGE,
+};
+
+// Calls `callback` with the path of every file the presentation depends
+// on. The images of an included file are only listed once one of it's
+// slides has been shown.
+void Present_ForEachDependency(Present_File* file, void (*callback)(const char* path, Present_Dependency kind, void* user), void* user);
+
+// Opens a presentation again after it or a file included by it has
+// changed, keeping the current slide. Closes `file` and returns the new
+// presentation. If the changed file can't be parsed then `file` is
+// returned as is.
+Present_File* Present_Reload(Present_File* file);
+
+// Returns whether the image at `path` is shown on the current slide
+bool Present_CurrentSlideShowsImage(Present_File* file, const char* path);
+
 // Close a presentation file
 void Present_Close(Present_File* file);
 
@@ -38,7 +81,63 @@ int Present_Seek(Present_File* file, int off);
 // otherwise --> goes to `idx`th slide
 int Present_SeekTo(Present_File* file, int idx);
 
-// Fill a render queue with draw commands
+// Sets how many slides after (`ahead`) and before (`behind`) the current
+// one have their images loaded in the background, so that they are
+// ready by the time they are shown. The default is 2 ahead and 1 behind.
+void Present_SetPrefetch(Present_File* file, int ahead, int behind);
+
+// Progress of loading a presentation's images in advance
+struct Present_Warmup_Progress {
+    unsigned loaded; // images loaded, including the ones that failed to
+    unsigned total; // images on the slides
+    size_t bytes; // memory used by the loaded images
+    bool done; // every image was loaded or the budget was used up
+};
+
+// Starts loading the images of every slide in the background at the
+// lowest priority, so that they're in the image cache before they are
+// shown. The OS is asked to read every image file right away; they are
+// decoded in the order they're stored on the disk until `budget` bytes of
+// decoded images have been loaded. Included files are parsed here to
+// find their images.
+void Present_StartWarmup(Present_File* file, size_t budget);
+// Requests more images for the warm-up as the previous ones arrive;
+// should be called whenever an image has been loaded. `out` may be
+// NULL. Returns false if there's no warm-up going on.
+bool Present_UpdateWarmup(Present_File* file, Present_Warmup_Progress* out);
+
+// Makes the slides be drawn right away, with placeholders in place of
+// the images that haven't been loaded yet, instead of waiting for every
+// image of the slide. The caller must draw the slide again once the
+// images are loaded; see ImageLoader_GetWakeupFd and
+// Present_ImagesPending. Off by default.
+void Present_SetProgressive(Present_File* file, bool progressive);
+// Returns whether the last drawn slide had placeholders in it
+bool Present_ImagesPending(Present_File* file);
+
+// Moves the animated GIFs of the last drawn slide to their next frame
+// where it's time. Returns whether any of them changed; `area` receives
+// the part of the screen they cover, which has to be drawn again.
+bool Present_UpdateAnimations(Present_File* file, RQ_Rect* area);
+// Returns the number of milliseconds until Present_UpdateAnimations
+// should be called, or -1 if nothing on the last drawn slide is animated
+int Present_GetAnimationWait(Present_File* file);
+
+// Zooms into the first large image of the last drawn slide (see
+// TILES_MIN_SIDE) if `steps` is positive and out of it if it's negative,
+// by half again for each step; 0 zooms out all the way. Every slide
+// starts zoomed out. Returns whether the slide has to be drawn again.
+bool Present_Zoom(Present_File* file, int steps);
+// Moves the shown part of a zoomed in image by a quarter of it's size
+// `dx` times to the right and `dy` times down. Returns whether the slide
+// has to be drawn again.
+bool Present_Pan(Present_File* file, int dx, int dy);
+// Returns whether an image on the last drawn slide is zoomed in
+bool Present_IsZoomed(Present_File* file);
+
+// Fill a render queue with draw commands.
+// Images in the queue belong to the presentation; they stay valid until
+// the queue is filled again or the presentation is closed.
 void Present_FillRenderQueue(Present_File* file, Render_Queue* rq);
 
 void Present_ExecuteCommandOnCurrentSlide(Present_File* file);
\ No newline at end of file
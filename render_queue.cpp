@@ -71,3 +71,21 @@ void* RQ_NewCmd(Render_Queue* rq, unsigned size) {
     }
     return ret;
 }
+
+RQ_Image_Level RQ_PickImageLevel(const RQ_Draw_Image* cmd, float dest_width, float dest_height) {
+    RQ_Image_Level ret = {0, 0, NULL};
+    assert(cmd);
+    if(cmd) {
+        ret.width = cmd->width;
+        ret.height = cmd->height;
+        ret.buffer = cmd->buffer;
+        for(int i = 0; i < cmd->mip_count; i++) {
+            auto& mip = cmd->mips[i];
+            if(mip.width < dest_width || mip.height < dest_height) {
+                break;
+            }
+            ret = mip;
+        }
+    }
+    return ret;
+}
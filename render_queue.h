@@ -29,6 +29,10 @@ enum RQ_Cmd {
     RQCMD_DRAW_IMAGE,
     // Draw a rectangle
     RQCMD_DRAW_RECTANGLE,
+    // Restrict drawing to an area, until the matching RQCMD_POP_CLIP
+    RQCMD_PUSH_CLIP,
+    // Undo the last RQCMD_PUSH_CLIP
+    RQCMD_POP_CLIP,
     RQCMD_MAX
 };
 
@@ -54,6 +58,15 @@ struct RQ_Draw_Text {
     const char* font_name;
 };
 
+// A version of an image at some size
+struct RQ_Image_Level {
+    int width, height;
+    void* buffer;
+};
+
+// Number of mip levels an image may have at most
+#define RQ_MAX_IMAGE_MIPS (7)
+
 // Draw image command
 struct RQ_Draw_Image {
     RQ_Draw_Cmd hdr;
@@ -61,6 +74,11 @@ struct RQ_Draw_Image {
     float w, h; // size [0, 1]
     int width, height; // Image size in pixels TODO(easimer): rename these
     void* buffer; // R8B8G8 format
+    Pixel_Format format; // of the image and of it's mips
+    // Smaller versions of the image, each half as large as the previous
+    // one; may be empty
+    int mip_count;
+    RQ_Image_Level mips[RQ_MAX_IMAGE_MIPS];
 };
 
 // Draw rectangle command
@@ -70,6 +88,22 @@ struct RQ_Draw_Rect {
     RGBA_Color color;
 };
 
+// An area of the screen
+struct RQ_Rect {
+    float x0, y0, x1, y1; // [0, 1] normalized ss coords
+};
+
+// Push clip command; the area is intersected with the one pushed before
+struct RQ_Push_Clip {
+    RQ_Draw_Cmd hdr;
+    RQ_Rect area;
+};
+
+// Pop clip command
+struct RQ_Pop_Clip {
+    RQ_Draw_Cmd hdr;
+};
+
 // Render queue
 struct Render_Queue {
     Mem_Arena* mem;
@@ -87,6 +121,10 @@ void RQ_Clear(Render_Queue* rq);
 // Creates a new command of a given size and appends it to the end of
 // the render queue.
 void* RQ_NewCmd(Render_Queue* rq, unsigned size);
+// Picks the smallest version of an image that is still at least as large
+// as the area it's drawn to (in pixels), so that drawing it samples at
+// most about twice as many pixels as it covers.
+RQ_Image_Level RQ_PickImageLevel(const RQ_Draw_Image* cmd, float dest_width, float dest_height);
 
 #ifdef __cplusplus
 // Creates a new command of a given type and appends it to the end of
@@ -0,0 +1,164 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <assert.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include "resample.h"
+
+// Weights are fixed point numbers with this many fractional bits. The
+// weights of a destination pixel add up to exactly 1 << WEIGHT_BITS.
+#define WEIGHT_BITS (14)
+// Fractional bits dropped from the vertically filtered rows so that
+// they fit in 16 bits
+#define ROW_SHIFT (6)
+
+// Don't bother with threads below this many source pixels
+#define THREADED_MIN_PIXELS (1024 * 1024)
+#define MAX_THREADS (4)
+
+// The source pixels that make up the destination pixels along one axis
+struct Resample_Axis {
+    std::vector<unsigned> first; // first source pixel of each dst pixel
+    std::vector<unsigned> count;
+    std::vector<uint16_t> weights; // `stride` weights for each dst pixel
+    unsigned stride;
+};
+
+static void ComputeAxis(Resample_Axis* axis, unsigned src_n, unsigned dst_n) {
+    double scale = (double)src_n / dst_n;
+    axis->stride = (unsigned)ceil(scale) + 1;
+    axis->first.resize(dst_n);
+    axis->count.resize(dst_n);
+    axis->weights.assign((size_t)dst_n * axis->stride, 0);
+    
+    for(unsigned i = 0; i < dst_n; i++) {
+        double start = i * scale;
+        double end = (i + 1) * scale;
+        unsigned first = (unsigned)start;
+        unsigned last = (unsigned)ceil(end);
+        if(last > src_n) {
+            last = src_n;
+        }
+        assert(last - first <= axis->stride);
+        
+        // Weights are the differences of the rounded running sum of the
+        // coverage, so they add up to exactly 1 even after rounding
+        auto weights = &axis->weights[(size_t)i * axis->stride];
+        int prev = 0;
+        for(unsigned j = first; j < last; j++) {
+            int cur = 1 << WEIGHT_BITS;
+            if(j + 1 < last) {
+                cur = (int)((j + 1 - start) / scale * (1 << WEIGHT_BITS) + 0.5);
+            }
+            weights[j - first] = (uint16_t)(cur - prev);
+            prev = cur;
+        }
+        axis->first[i] = first;
+        axis->count[i] = last - first;
+    }
+}
+
+// Produces the destination rows [y0, y1)
+static void DownscaleRows(const uint8_t* src, unsigned src_w, uint8_t* dst, unsigned dst_w,
+                          const Resample_Axis* ax, const Resample_Axis* ay, unsigned y0, unsigned y1) {
+    unsigned src_stride = src_w * 4;
+    std::vector<uint32_t> acc(src_stride);
+    std::vector<uint16_t> row(src_stride);
+    
+    for(unsigned y = y0; y < y1; y++) {
+        // Vertical pass: blend the source rows into one. The loops over
+        // whole rows are simple enough for the compiler to vectorize.
+        auto wy = &ay->weights[(size_t)y * ay->stride];
+        auto acc_p = acc.data();
+        for(unsigned i = 0; i < src_stride; i++) {
+            acc_p[i] = 0;
+        }
+        for(unsigned k = 0; k < ay->count[y]; k++) {
+            auto src_row = src + (size_t)(ay->first[y] + k) * src_stride;
+            uint32_t w = wy[k];
+            for(unsigned i = 0; i < src_stride; i++) {
+                acc_p[i] += src_row[i] * w;
+            }
+        }
+        auto row_p = row.data();
+        for(unsigned i = 0; i < src_stride; i++) {
+            row_p[i] = (uint16_t)((acc_p[i] + (1 << (ROW_SHIFT - 1))) >> ROW_SHIFT);
+        }
+        
+        // Horizontal pass
+        auto dst_row = dst + (size_t)y * dst_w * 4;
+        const unsigned shift = 2 * WEIGHT_BITS - ROW_SHIFT;
+        for(unsigned x = 0; x < dst_w; x++) {
+            auto wx = &ax->weights[(size_t)x * ax->stride];
+            auto px = row_p + ax->first[x] * 4;
+            uint32_t c[4] = {0, 0, 0, 0};
+            for(unsigned k = 0; k < ax->count[x]; k++) {
+                for(unsigned ch = 0; ch < 4; ch++) {
+                    c[ch] += px[k * 4 + ch] * (uint32_t)wx[k];
+                }
+            }
+            for(unsigned ch = 0; ch < 4; ch++) {
+                dst_row[x * 4 + ch] = (uint8_t)((c[ch] + (1u << (shift - 1))) >> shift);
+            }
+        }
+    }
+}
+
+void Resample_Downscale(const uint8_t* src, unsigned src_w, unsigned src_h,
+                        uint8_t* dst, unsigned dst_w, unsigned dst_h,
+                        unsigned threads) {
+    assert(src && dst);
+    assert(dst_w > 0 && dst_h > 0 && dst_w <= src_w && dst_h <= src_h);
+    if(src && dst && dst_w > 0 && dst_h > 0 && dst_w <= src_w && dst_h <= src_h) {
+        Resample_Axis ax, ay;
+        ComputeAxis(&ax, src_w, dst_w);
+        ComputeAxis(&ay, src_h, dst_h);
+        
+        if(threads == 0) {
+            threads = 1;
+            if((size_t)src_w * src_h >= THREADED_MIN_PIXELS) {
+                threads = std::thread::hardware_concurrency();
+                if(threads > MAX_THREADS) {
+                    threads = MAX_THREADS;
+                }
+            }
+        }
+        if(threads > dst_h) {
+            threads = dst_h;
+        }
+        if(threads < 1) {
+            threads = 1;
+        }
+        
+        // Every thread makes a band of destination rows; the calling
+        // thread makes the first one
+        std::vector<std::thread> workers;
+        unsigned band = (dst_h + threads - 1) / threads;
+        for(unsigned i = 1; i < threads; i++) {
+            unsigned y0 = i * band;
+            unsigned y1 = y0 + band < dst_h ? y0 + band : dst_h;
+            if(y0 < y1) {
+                workers.emplace_back(DownscaleRows, src, src_w, dst, dst_w, &ax, &ay, y0, y1);
+            }
+        }
+        DownscaleRows(src, src_w, dst, dst_w, &ax, &ay, 0, band < dst_h ? band : dst_h);
+        for(auto& worker : workers) {
+            worker.join();
+        }
+    }
+}
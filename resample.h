@@ -0,0 +1,29 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+
+// Shrinks an RGBA8 image with an area (box) filter: every destination
+// pixel is the average of the source pixels it covers, weighted by how
+// much of each it covers. The destination can't be larger than the
+// source in either direction.
+// The work is split between `threads` threads (the calling thread
+// included); 0 picks a count based on the image size and the CPU.
+// Threads that are already one of many busy ones should pass 1.
+void Resample_Downscale(const uint8_t* src, unsigned src_w, unsigned src_h,
+                        uint8_t* dst, unsigned dst_w, unsigned dst_h,
+                        unsigned threads = 0);
@@ -0,0 +1,704 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tiles.h"
+#include "decode.h"
+#include "compress.h"
+#include "display.h"
+#include "fetch.h"
+#include "diskcache.h"
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#if _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+#if __linux__
+#include <sys/eventfd.h>
+#endif
+
+using Lock = std::mutex;
+using Lock_Guard = std::lock_guard<std::mutex>;
+using Unique_Lock = std::unique_lock<std::mutex>;
+using Thread = std::thread;
+using Cond_Var = std::condition_variable;
+using Clock = std::chrono::steady_clock;
+
+// Where a tile is in the temporary file
+struct Tile_Entry {
+    uint64_t offset;
+    uint32_t size;
+    Pixel_Format format;
+    // Stored uncompressed, because it didn't compress. Opaque tiles are
+    // stored without their alpha byte either way.
+    bool raw;
+};
+
+struct Tile_Level {
+    int width, height;
+    int cols, rows;
+    // Row by row; only touched by the image's thread
+    std::vector<Tile_Entry> entries;
+};
+
+struct Cached_Tile {
+    uint8_t* buffer;
+    int width, height;
+    Pixel_Format format;
+    unsigned frame; // the last frame it was got in
+    // Position on the LRU list
+    std::list<uint64_t>::iterator lru;
+};
+
+struct Tiled_Image {
+    std::string path;
+    Thread thread;
+    
+    // Protects everything below
+    Lock lock;
+    // Signaled when a tile is requested or decoded, when tiling is done
+    // and on quit
+    Cond_Var cv;
+    bool quit;
+    bool known; // the levels are known
+    bool built; // every tile has been made
+    bool failed;
+    int level_count;
+    Tile_Level levels[TILES_MAX_LEVELS];
+    // Decoded tiles by TileKey, the least recently used at the back of
+    // the LRU list
+    std::unordered_map<uint64_t, Cached_Tile> cache;
+    std::list<uint64_t> lru;
+    // Tiles requested in this frame that aren't decoded, the latest first
+    std::list<uint64_t> wanted;
+    // Set while the tile is being decoded
+    bool decoding;
+    uint64_t decoding_key;
+    unsigned frame;
+    Tiles_Stats stats;
+    
+    // Only used by the image's thread
+    FILE* store;
+    uint64_t store_size;
+};
+
+static size_t gBudget = TILES_DEFAULT_BUDGET;
+// Becomes readable when a requested tile has been decoded; -1 if
+// unsupported
+static int gWakeupFd = -1;
+
+static uint64_t TileKey(int level, int x, int y) {
+    return ((uint64_t)level << 48) | ((uint64_t)y << 24) | (uint64_t)x;
+}
+
+static void NotifyWakeupFd() {
+#if __linux__
+    if(gWakeupFd != -1) {
+        uint64_t one = 1;
+        (void)!write(gWakeupFd, &one, sizeof(one));
+    }
+#endif
+}
+
+// Returns the Pixel_Conversion flags the display needs
+static unsigned DisplayConversion() {
+    unsigned ret = 0;
+    if(Display_SwapRedBlueChannels()) {
+        ret |= PIXCONV_SWAP_RED_BLUE;
+    }
+    if(Display_PremultipliedAlpha()) {
+        ret |= PIXCONV_PREMULTIPLY;
+    }
+    return ret;
+}
+
+static bool Seek(FILE* f, uint64_t offset) {
+#if _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Creates the temporary file of the tiles, which is deleted once it's
+// closed. It goes into the disk cache's directory, since the default
+// temporary directory may be in memory, or TMPDIR if there's none.
+// Returns NULL on failure.
+static FILE* OpenStore() {
+    FILE* ret = NULL;
+    char dir[1024];
+#if _WIN32
+    char path[MAX_PATH];
+    if(!DiskCache_GetDirectory(dir, sizeof(dir)) && !GetTempPathA(sizeof(dir), dir)) {
+        dir[0] = 0;
+    }
+    if(dir[0] && GetTempFileNameA(dir, "til", 0, path)) {
+        // "D" deletes it when it's closed
+        ret = fopen(path, "w+bD");
+        if(!ret) {
+            DeleteFileA(path);
+        }
+    }
+#else
+    auto tmpdir = getenv("TMPDIR");
+    if(!DiskCache_GetDirectory(dir, sizeof(dir))) {
+        snprintf(dir, sizeof(dir), "%s", tmpdir && tmpdir[0] ? tmpdir : P_tmpdir);
+    }
+    std::string path = std::string(dir) + "/tiles-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if(fd != -1) {
+        // Nobody else needs it's name
+        unlink(path.c_str());
+        ret = fdopen(fd, "w+b");
+        if(!ret) {
+            close(fd);
+        }
+    }
+#endif
+    return ret;
+}
+
+// Evicts decoded tiles that weren't got in this frame until the cache
+// fits into the budget.
+// The image's lock must be held.
+static void EnforceBudget(Tiled_Image* img) {
+    auto it = img->lru.end();
+    while(img->stats.cached_bytes > gBudget && it != img->lru.begin()) {
+        --it;
+        auto tile = img->cache.find(*it);
+        assert(tile != img->cache.end());
+        if(tile->second.frame != img->frame) {
+            img->stats.cached_bytes -= (size_t)tile->second.width * tile->second.height * 4;
+            img->stats.cached--;
+            free(tile->second.buffer);
+            img->cache.erase(tile);
+            it = img->lru.erase(it);
+        }
+    }
+}
+
+// Puts a decoded tile into the cache, which takes ownership of it's
+// buffer. It counts as got in this frame, since it was asked for.
+// The image's lock must be held.
+static void InsertTile(Tiled_Image* img, uint64_t key, uint8_t* buffer, int w, int h, Pixel_Format format) {
+    if(img->cache.count(key)) {
+        free(buffer);
+    } else {
+        auto& tile = img->cache[key];
+        tile.buffer = buffer;
+        tile.width = w;
+        tile.height = h;
+        tile.format = format;
+        tile.frame = img->frame;
+        img->lru.push_front(key);
+        tile.lru = img->lru.begin();
+        img->stats.cached++;
+        img->stats.cached_bytes += (size_t)w * h * 4;
+        EnforceBudget(img);
+    }
+}
+
+static bool IsWanted(Tiled_Image* img, uint64_t key) {
+    bool ret = false;
+    for(auto wanted : img->wanted) {
+        if(wanted == key) {
+            ret = true;
+            break;
+        }
+    }
+    return ret;
+}
+
+// Takes a tile off the list of wanted tiles.
+// Returns false if it wasn't on it.
+// The image's lock must be held.
+static bool TakeWanted(Tiled_Image* img, uint64_t key) {
+    bool ret = false;
+    for(auto it = img->wanted.begin(); it != img->wanted.end(); ++it) {
+        if(*it == key) {
+            img->wanted.erase(it);
+            ret = true;
+            break;
+        }
+    }
+    return ret;
+}
+
+// A band of TILE_SIZE rows of a level, being filled from the level
+// above it
+struct Tile_Band {
+    uint8_t* pixels;
+    int rows; // rows filled
+    int y; // the row of tiles it's cut into
+};
+
+// Buffers a tile goes through on it's way into the temporary file
+struct Tile_Scratch {
+    uint8_t* tile;
+    uint8_t* packed; // an opaque tile without it's alpha bytes
+    uint8_t* compressed;
+};
+
+// Drops the alpha byte of `count` 4 byte pixels
+static void PackOpaque(const uint8_t* src, size_t count, uint8_t* dst) {
+    for(size_t i = 0; i < count; i++) {
+        dst[i * 3 + 0] = src[i * 4 + 0];
+        dst[i * 3 + 1] = src[i * 4 + 1];
+        dst[i * 3 + 2] = src[i * 4 + 2];
+    }
+}
+
+// Undoes PackOpaque; the alpha bytes are set to 255
+static void UnpackOpaque(const uint8_t* src, size_t count, uint8_t* dst) {
+    for(size_t i = 0; i < count; i++) {
+        dst[i * 4 + 0] = src[i * 3 + 0];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 2];
+        dst[i * 4 + 3] = 255;
+    }
+}
+
+// Cuts the filled rows of a band into tiles and stores them. Tiles that
+// are wanted already are put into the cache too.
+static bool StoreBand(Tiled_Image* img, int level, Tile_Band* band, const Tile_Scratch& scratch) {
+    bool ret = true;
+    auto& lvl = img->levels[level];
+    size_t stride = (size_t)lvl.width * 4;
+    for(int x = 0; ret && x < lvl.cols; x++) {
+        int w = lvl.width - x * TILE_SIZE < TILE_SIZE ? lvl.width - x * TILE_SIZE : TILE_SIZE;
+        int h = band->rows;
+        size_t size = (size_t)w * h * 4;
+        auto tile = scratch.tile;
+        for(int row = 0; row < h; row++) {
+            memcpy(tile + (size_t)w * 4 * row, band->pixels + stride * row + (size_t)x * TILE_SIZE * 4, (size_t)w * 4);
+        }
+        Tile_Entry entry;
+        entry.offset = img->store_size;
+        entry.format = Pixel_IsOpaque(tile, (size_t)w * h) ? PIXFMT_RGB24 : PIXFMT_ARGB32;
+        const uint8_t* stored = tile;
+        size_t stored_size = size;
+        if(entry.format == PIXFMT_RGB24) {
+            PackOpaque(tile, (size_t)w * h, scratch.packed);
+            stored = scratch.packed;
+            stored_size = (size_t)w * h * 3;
+        }
+        size_t compressed_size = Compress_LZ4(stored, stored_size, scratch.compressed);
+        entry.raw = compressed_size >= stored_size;
+        const uint8_t* data = entry.raw ? stored : scratch.compressed;
+        entry.size = (uint32_t)(entry.raw ? stored_size : compressed_size);
+        ret = fwrite(data, 1, entry.size, img->store) == entry.size;
+        img->store_size += entry.size;
+        lvl.entries[(size_t)band->y * lvl.cols + x] = entry;
+        
+        Lock_Guard G(img->lock);
+        img->stats.tiles++;
+        img->stats.stored_bytes += entry.size;
+        img->stats.raw_bytes += size;
+        uint64_t key = TileKey(level, x, band->y);
+        if(TakeWanted(img, key)) {
+            auto copy = (uint8_t*)malloc(size);
+            if(copy) {
+                memcpy(copy, tile, size);
+                InsertTile(img, key, copy, w, h, entry.format);
+                NotifyWakeupFd();
+                img->cv.notify_all();
+            }
+        }
+    }
+    return ret;
+}
+
+// Stores a band of a level and halves it into the band of the next
+// level, which is stored in turn once it's full or it's the last one.
+static bool FlushBand(Tiled_Image* img, Tile_Band* bands, int level, const Tile_Scratch& scratch) {
+    auto& lvl = img->levels[level];
+    auto band = &bands[level];
+    bool ret = StoreBand(img, level, band, scratch);
+    bool last = band->y == lvl.rows - 1;
+    if(ret && level + 1 < img->level_count) {
+        auto next = &bands[level + 1];
+        auto& next_lvl = img->levels[level + 1];
+        Pixel_Halve(band->pixels, (unsigned)lvl.width, (unsigned)band->rows,
+                    next->pixels + (size_t)next_lvl.width * 4 * next->rows);
+        next->rows += band->rows / 2;
+        // NOTE(easimer): the last band of an odd-sized level may add no
+        // rows, if the next level's last band is stored already
+        if(next->rows == TILE_SIZE || (last && next->rows > 0)) {
+            ret = FlushBand(img, bands, level + 1, scratch);
+        }
+    }
+    band->rows = 0;
+    band->y++;
+    return ret;
+}
+
+// Decodes the image row by row and makes every tile of every level.
+// Only a band of each level is in memory at once.
+static bool BuildTiles(Tiled_Image* img, Decode_Rows* rows, int width, int height, bool has_alpha) {
+    bool ret = true;
+    Tile_Band bands[TILES_MAX_LEVELS] = {};
+    int count = 0;
+    
+    {
+        Lock_Guard G(img->lock);
+        int w = width, h = height;
+        while(count < TILES_MAX_LEVELS && w > 0 && h > 0) {
+            auto& lvl = img->levels[count++];
+            lvl.width = w;
+            lvl.height = h;
+            lvl.cols = (w + TILE_SIZE - 1) / TILE_SIZE;
+            lvl.rows = (h + TILE_SIZE - 1) / TILE_SIZE;
+            lvl.entries.resize((size_t)lvl.cols * lvl.rows);
+            if(w <= TILE_SIZE && h <= TILE_SIZE) {
+                break;
+            }
+            w /= 2;
+            h /= 2;
+        }
+        img->level_count = count;
+        img->stats.width = width;
+        img->stats.height = height;
+        img->stats.levels = count;
+        img->known = true;
+    }
+    img->cv.notify_all();
+    NotifyWakeupFd();
+    
+    unsigned conversion = DisplayConversion();
+    // Without an alpha channel premultiplying changes nothing
+    if(!has_alpha) {
+        conversion &= ~PIXCONV_PREMULTIPLY;
+    }
+    for(int i = 0; i < count; i++) {
+        bands[i].pixels = (uint8_t*)malloc((size_t)img->levels[i].width * 4 * TILE_SIZE);
+        ret = ret && bands[i].pixels;
+    }
+    Tile_Scratch scratch;
+    scratch.tile = (uint8_t*)malloc((size_t)TILE_SIZE * TILE_SIZE * 4);
+    scratch.packed = (uint8_t*)malloc((size_t)TILE_SIZE * TILE_SIZE * 3);
+    scratch.compressed = (uint8_t*)malloc(Compress_Bound((size_t)TILE_SIZE * TILE_SIZE * 4));
+    ret = ret && scratch.tile && scratch.packed && scratch.compressed;
+    
+    for(int y = 0; ret && y < height; y += TILE_SIZE) {
+        {
+            Lock_Guard G(img->lock);
+            ret = !img->quit;
+        }
+        int band_rows = height - y < TILE_SIZE ? height - y : TILE_SIZE;
+        ret = ret && Decode_ReadRows(rows, bands[0].pixels, band_rows);
+        if(ret) {
+            // Converted before halving, so that the premultiplied colors
+            // are averaged
+            Pixel_Convert(bands[0].pixels, (size_t)width * band_rows, conversion);
+            bands[0].rows = band_rows;
+            ret = FlushBand(img, bands, 0, scratch);
+        }
+    }
+    
+    for(int i = 0; i < count; i++) {
+        free(bands[i].pixels);
+    }
+    free(scratch.tile);
+    free(scratch.packed);
+    free(scratch.compressed);
+    return ret;
+}
+
+// Reads a stored tile and decompresses it.
+// Returns NULL on failure.
+static uint8_t* ReadTile(Tiled_Image* img, int level, int x, int y, int* w, int* h, Pixel_Format* format) {
+    uint8_t* ret = NULL;
+    auto& lvl = img->levels[level];
+    auto& entry = lvl.entries[(size_t)y * lvl.cols + x];
+    *w = lvl.width - x * TILE_SIZE < TILE_SIZE ? lvl.width - x * TILE_SIZE : TILE_SIZE;
+    *h = lvl.height - y * TILE_SIZE < TILE_SIZE ? lvl.height - y * TILE_SIZE : TILE_SIZE;
+    *format = entry.format;
+    size_t count = (size_t)*w * *h;
+    size_t stored_size = count * (entry.format == PIXFMT_RGB24 ? 3 : 4);
+    auto data = (uint8_t*)malloc(entry.size);
+    if(data && Seek(img->store, entry.offset) && fread(data, 1, entry.size, img->store) == entry.size) {
+        if(!entry.raw) {
+            auto expanded = (uint8_t*)malloc(stored_size);
+            if(expanded && !Compress_ExpandLZ4(data, entry.size, expanded, stored_size)) {
+                free(expanded);
+                expanded = NULL;
+            }
+            free(data);
+            data = expanded;
+        }
+        if(data && entry.format == PIXFMT_RGB24) {
+            ret = (uint8_t*)malloc(count * 4);
+            if(ret) {
+                UnpackOpaque(data, count, ret);
+            }
+        } else {
+            ret = data;
+            data = NULL;
+        }
+    }
+    free(data);
+    return ret;
+}
+
+// Decodes the wanted tiles, the latest request first, until quit
+static void ServeTiles(Tiled_Image* img) {
+    Unique_Lock UL(img->lock);
+    while(true) {
+        img->cv.wait(UL, [img]() { return img->quit || !img->wanted.empty(); });
+        if(img->quit) {
+            break;
+        }
+        uint64_t key = img->wanted.front();
+        img->wanted.pop_front();
+        if(img->cache.count(key)) {
+            continue;
+        }
+        int level = (int)(key >> 48);
+        int y = (int)((key >> 24) & 0xFFFFFF);
+        int x = (int)(key & 0xFFFFFF);
+        int w, h;
+        Pixel_Format format;
+        unsigned frame = img->frame;
+        img->decoding = true;
+        img->decoding_key = key;
+        UL.unlock();
+        auto buffer = ReadTile(img, level, x, y, &w, &h, &format);
+        UL.lock();
+        img->decoding = false;
+        if(buffer && img->frame != frame && !TakeWanted(img, key)) {
+            // Not asked for since; after Tiles_DropCache it would be
+            // pinned to a frame that never ends
+            free(buffer);
+        } else if(buffer) {
+            InsertTile(img, key, buffer, w, h, format);
+        } else {
+            fprintf(stderr, "Couldn't read tile %d/%d,%d of '%s'\n", level, x, y, img->path.c_str());
+        }
+        NotifyWakeupFd();
+        img->cv.notify_all();
+    }
+}
+
+static void TileFunc(Tiled_Image* img) {
+    Fetch_Buffer file;
+    bool ok = false;
+    auto start = Clock::now();
+    
+    if(Fetch_ReadFile(img->path.c_str(), &file)) {
+        int w, h;
+        bool has_alpha;
+        auto rows = Decode_OpenRows(file.data, file.size, 0, &w, &h, &has_alpha);
+        if(rows) {
+            img->store = OpenStore();
+            ok = img->store && BuildTiles(img, rows, w, h, has_alpha);
+            Decode_CloseRows(rows);
+        }
+        Fetch_Free(&file);
+    }
+    
+    {
+        Lock_Guard G(img->lock);
+        if(!img->quit && !ok) {
+            fprintf(stderr, "Couldn't tile image '%s'\n", img->path.c_str());
+        }
+        img->built = ok;
+        img->failed = !ok;
+        img->stats.built = ok;
+        img->stats.failed = !ok;
+        img->stats.build_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    img->cv.notify_all();
+    NotifyWakeupFd();
+    if(ok) {
+        ServeTiles(img);
+    }
+}
+
+void Tiles_Init() {
+#if __linux__
+    gWakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+}
+
+void Tiles_Shutdown() {
+#if __linux__
+    if(gWakeupFd != -1) {
+        close(gWakeupFd);
+        gWakeupFd = -1;
+    }
+#endif
+}
+
+Tiled_Image* Tiles_Open(const char* path) {
+    Tiled_Image* ret = NULL;
+    assert(path);
+    if(path) {
+        ret = new Tiled_Image;
+        ret->path = path;
+        ret->quit = false;
+        ret->known = false;
+        ret->built = false;
+        ret->failed = false;
+        ret->level_count = 0;
+        ret->decoding = false;
+        ret->decoding_key = 0;
+        ret->frame = 0;
+        memset(&ret->stats, 0, sizeof(ret->stats));
+        ret->store = NULL;
+        ret->store_size = 0;
+        ret->thread = Thread(TileFunc, ret);
+    }
+    return ret;
+}
+
+void Tiles_Close(Tiled_Image* image) {
+    if(image) {
+        {
+            Lock_Guard G(image->lock);
+            image->quit = true;
+        }
+        image->cv.notify_all();
+        image->thread.join();
+        Tiles_DropCache(image);
+        if(image->store) {
+            fclose(image->store);
+        }
+        delete image;
+    }
+}
+
+bool Tiles_GetInfo(Tiled_Image* image, int* width, int* height, int* levels, bool wait) {
+    bool ret = false;
+    assert(image && width && height && levels);
+    if(image) {
+        Unique_Lock UL(image->lock);
+        if(wait) {
+            image->cv.wait(UL, [image]() { return image->known || image->failed; });
+        }
+        if(image->known && !image->failed) {
+            *width = image->levels[0].width;
+            *height = image->levels[0].height;
+            *levels = image->level_count;
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+void Tiles_NextFrame(Tiled_Image* image) {
+    assert(image);
+    if(image) {
+        Lock_Guard G(image->lock);
+        image->frame++;
+        image->wanted.clear();
+    }
+}
+
+bool Tiles_GetTile(Tiled_Image* image, int level, int x, int y, Tile* out, bool wait) {
+    bool ret = false;
+    assert(image && out);
+    if(image && out) {
+        Unique_Lock UL(image->lock);
+        bool valid = image->known && level >= 0 && level < image->level_count && x >= 0 && y >= 0 &&
+            x < image->levels[level].cols && y < image->levels[level].rows;
+        uint64_t key = TileKey(level, x, y);
+        auto it = image->cache.find(key);
+        if(valid && it == image->cache.end() && !image->failed) {
+            image->stats.misses++;
+            if(!TakeWanted(image, key)) {
+                image->cv.notify_all();
+            }
+            image->wanted.push_front(key);
+            if(wait) {
+                // Until it's tiled or decoded, or it failed to be. Tiles
+                // are only given up on by this thread (Tiles_NextFrame).
+                image->cv.wait(UL, [image, key]() {
+                    return image->cache.count(key) || image->failed ||
+                        (!IsWanted(image, key) && !(image->decoding && image->decoding_key == key));
+                });
+                it = image->cache.find(key);
+            }
+        } else if(it != image->cache.end()) {
+            image->stats.hits++;
+        }
+        if(valid && it != image->cache.end()) {
+            auto& tile = it->second;
+            tile.frame = image->frame;
+            image->lru.splice(image->lru.begin(), image->lru, tile.lru);
+            out->width = tile.width;
+            out->height = tile.height;
+            out->buffer = tile.buffer;
+            out->format = tile.format;
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+void Tiles_DropCache(Tiled_Image* image) {
+    assert(image);
+    if(image) {
+        Lock_Guard G(image->lock);
+        for(auto& tile : image->cache) {
+            free(tile.second.buffer);
+        }
+        image->cache.clear();
+        image->lru.clear();
+        // Tiles that are still being decoded are thrown away
+        image->wanted.clear();
+        image->frame++;
+        image->stats.cached = 0;
+        image->stats.cached_bytes = 0;
+    }
+}
+
+void Tiles_GetStats(Tiled_Image* image, Tiles_Stats* out) {
+    assert(image && out);
+    if(image && out) {
+        Lock_Guard G(image->lock);
+        *out = image->stats;
+    }
+}
+
+void Tiles_SetBudget(size_t bytes) {
+    gBudget = bytes;
+}
+
+int Tiles_GetWakeupFd() {
+    return gWakeupFd;
+}
+
+void Tiles_AckWakeup() {
+#if __linux__
+    if(gWakeupFd != -1) {
+        uint64_t count;
+        (void)!read(gWakeupFd, &count, sizeof(count));
+    }
+#endif
+}
@@ -0,0 +1,115 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "pixel.h"
+
+// Images too large to be drawn from a single decoded image, like maps
+// and floor plans. They are cut into tiles at every level of detail,
+// which are kept compressed in a temporary file in the disk cache's
+// directory, and only the tiles that are on the screen are decoded.
+
+struct Tiled_Image;
+
+// Tiles are this many pixels on a side, except at the right and bottom
+// edges of the image
+#define TILE_SIZE (256)
+// Number of levels an image may have at most
+#define TILES_MAX_LEVELS (24)
+// Images at least this long on one side are worth tiling
+#define TILES_MIN_SIDE (8192)
+// Decoded tiles of an image are kept until they take this many bytes
+#define TILES_DEFAULT_BUDGET ((size_t)64 * 1024 * 1024)
+
+// A decoded tile, converted for the display like the images of the
+// image loader
+struct Tile {
+    int width, height;
+    const void* buffer;
+    Pixel_Format format;
+};
+
+struct Tiles_Stats {
+    // Known once the file's header has been read
+    int width, height;
+    int levels;
+    // Set once every tile has been made, or once it failed
+    bool built;
+    bool failed;
+    double build_seconds;
+    unsigned tiles; // tiles made so far
+    uint64_t stored_bytes; // their compressed size in the temporary file
+    uint64_t raw_bytes; // their decoded size
+    unsigned cached; // decoded tiles in memory
+    size_t cached_bytes;
+    unsigned long hits; // tiles that were already decoded when needed
+    unsigned long misses;
+};
+
+void Tiles_Init();
+void Tiles_Shutdown();
+
+// Starts tiling the image at `path` in the background, on a thread of
+// the image's own. The file is decoded a few rows at a time: level 0 is
+// the image at it's original size, every further level is half as large
+// as the previous one, down to a level that fits into a single tile.
+// Returns NULL if `path` is NULL.
+Tiled_Image* Tiles_Open(const char* path);
+
+// Stops tiling, frees the decoded tiles and deletes the temporary file.
+//
+// If image is NULL, this is a no-op.
+void Tiles_Close(Tiled_Image* image);
+
+// Gets the size of level 0 and the number of levels. With `wait` set
+// the image's header is waited for if it hasn't been read yet.
+// Returns false if they aren't known yet or the file couldn't be decoded.
+bool Tiles_GetInfo(Tiled_Image* image, int* width, int* height, int* levels, bool wait = false);
+
+// Starts a new frame. Tiles got before may be evicted from now on;
+// tiles got in the new frame stay until the next one is started.
+// Tiles that were requested but haven't been decoded yet are given up
+// on unless they are requested again.
+void Tiles_NextFrame(Tiled_Image* image);
+
+// Gets the tile in column `x` and row `y` of a level. If it isn't
+// decoded, it's requested from the image's thread and false is
+// returned; the wakeup descriptor becomes readable once it's decoded.
+// With `wait` set it's waited for instead; while the image is being tiled
+// that lasts until the tile's band is reached. The buffer is valid until
+// the next Tiles_NextFrame.
+bool Tiles_GetTile(Tiled_Image* image, int level, int x, int y, Tile* out, bool wait = false);
+
+// Frees every decoded tile and gives up on the requested ones; tiles got
+// before mustn't be used anymore. For images that are no longer shown.
+void Tiles_DropCache(Tiled_Image* image);
+
+void Tiles_GetStats(Tiled_Image* image, Tiles_Stats* out);
+
+// Sets how much memory the decoded tiles of each image may use. Tiles
+// of the current frame are never evicted, so an image may temporarily
+// use more.
+void Tiles_SetBudget(size_t bytes);
+
+// Returns a file descriptor that becomes readable when a requested tile
+// has been decoded or when an image's size becomes known, or -1 if the
+// platform doesn't support this. Valid until Tiles_Shutdown.
+int Tiles_GetWakeupFd();
+// Makes the wakeup descriptor non-readable until the next tile is ready
+void Tiles_AckWakeup();
@@ -0,0 +1,160 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "watch.h"
+
+#if _WIN32
+// NOTE(easimer): files aren't watched on Windows. The display can't wait
+// on a descriptor there anyway (see Display_AddWakeupSource), so the
+// presentation isn't reloaded when it's edited.
+File_Watch* Watch_Create() {
+    return NULL;
+}
+
+void Watch_Destroy(File_Watch* watch) {}
+void Watch_AddFile(File_Watch* watch, const char* path, int tag) {}
+void Watch_Clear(File_Watch* watch) {}
+
+int Watch_GetFd(File_Watch* watch) {
+    return -1;
+}
+
+void Watch_ReadChanges(File_Watch* watch, Watch_Callback callback, void* user) {}
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <string>
+#include <vector>
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct Watched_File {
+    int wd; // watch descriptor of the directory
+    std::string name; // file name inside the directory
+    std::string path;
+    int tag;
+    bool changed;
+};
+
+struct File_Watch {
+    int fd;
+    std::vector<Watched_File> files;
+};
+
+File_Watch* Watch_Create() {
+    File_Watch* ret = NULL;
+    int fd;
+    
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd != -1) {
+        ret = new File_Watch;
+        ret->fd = fd;
+    } else {
+        perror("inotify_init1");
+    }
+    
+    return ret;
+}
+
+void Watch_Destroy(File_Watch* watch) {
+    if(watch) {
+        close(watch->fd);
+        delete watch;
+    }
+}
+
+void Watch_AddFile(File_Watch* watch, const char* path, int tag) {
+    char full_path[PATH_MAX];
+    assert(watch && path);
+    if(watch && path && realpath(path, full_path)) {
+        for(auto& file : watch->files) {
+            if(file.path == full_path) {
+                return;
+            }
+        }
+        
+        char* slash = strrchr(full_path, '/');
+        assert(slash);
+        *slash = 0;
+        // Watching a directory multiple times returns the same wd
+        int wd = inotify_add_watch(watch->fd, slash == full_path ? "/" : full_path, WATCH_EVENTS);
+        *slash = '/';
+        if(wd != -1) {
+            watch->files.push_back({wd, std::string(slash + 1), std::string(full_path), tag, false});
+        } else {
+            fprintf(stderr, "Can't watch '%s' for changes: %s\n", full_path, strerror(errno));
+        }
+    }
+}
+
+void Watch_Clear(File_Watch* watch) {
+    assert(watch);
+    if(watch) {
+        for(auto& file : watch->files) {
+            // Removing a wd twice fails harmlessly
+            inotify_rm_watch(watch->fd, file.wd);
+        }
+        watch->files.clear();
+    }
+}
+
+int Watch_GetFd(File_Watch* watch) {
+    assert(watch);
+    return watch ? watch->fd : -1;
+}
+
+void Watch_ReadChanges(File_Watch* watch, Watch_Callback callback, void* user) {
+    alignas(inotify_event) char buf[4096];
+    ssize_t len;
+    assert(watch && callback);
+    if(watch && callback) {
+        // Collect everything first; editors usually generate several
+        // events for a single save
+        while((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+            for(char* cur = buf; cur < buf + len;) {
+                auto ev = (inotify_event*)cur;
+                if(ev->len > 0) {
+                    for(auto& file : watch->files) {
+                        if(file.wd == ev->wd && file.name == ev->name) {
+                            file.changed = true;
+                        }
+                    }
+                }
+                cur += sizeof(inotify_event) + ev->len;
+            }
+        }
+        
+        // The callback may change the set of watched files
+        std::vector<std::pair<std::string, int>> changed;
+        for(auto& file : watch->files) {
+            if(file.changed) {
+                file.changed = false;
+                changed.push_back({file.path, file.tag});
+            }
+        }
+        for(auto& file : changed) {
+            callback(file.first.c_str(), file.second, user);
+        }
+    }
+}
+#endif
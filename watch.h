@@ -0,0 +1,48 @@
+// present
+// Copyright (C) 2020 Daniel Meszaros <easimer@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// A set of files watched for modifications
+struct File_Watch;
+
+// Called for every changed file with the tag it was added with
+using Watch_Callback = void (*)(const char* path, int tag, void* user);
+
+// Creates an empty file watch.
+// Returns NULL if watching files is not supported.
+File_Watch* Watch_Create();
+
+// Destroys a file watch.
+//
+// If watch is NULL, this is a no-op.
+void Watch_Destroy(File_Watch* watch);
+
+// Starts watching a file. Adding a file multiple times is a no-op.
+// Files are watched through their directory, so a file replaced by an
+// editor (by writing a new file and renaming it) is still watched.
+void Watch_AddFile(File_Watch* watch, const char* path, int tag);
+
+// Stops watching every file
+void Watch_Clear(File_Watch* watch);
+
+// Returns a file descriptor that becomes readable when a watched file
+// has changed
+int Watch_GetFd(File_Watch* watch);
+
+// Reads the pending notifications without blocking and calls `callback`
+// once for every file that has changed since the last call.
+void Watch_ReadChanges(File_Watch* watch, Watch_Callback callback, void* user);